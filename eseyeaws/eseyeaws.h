@@ -26,10 +26,18 @@
 #include <WProgram.h>
 #endif
 
+/* The options below set the configuration of eseyeAWS. Each one can also be
+ * chosen per instance with eseyeAWSBasic<config> (see eseyeAWSConfig below)
+ * without editing this file, or for the whole build with a compiler flag
+ * (-DLINK_METRICS, -DCMD_QUEUE_LEN=6). The optional features - the topic
+ * pool, batching, topic recovery, link metrics, uart capture and the
+ * journal - are off by default so the default instance stays small. */
+
 /* FILTER_OK attempts to filter AT command responses from the AWS application 
  * while passing through responses to other AT commands from the application.
  * If the application is not using AT commands to the modem do not define 
- * FILTER_OK or set urccb as it will just waste program memory/cpu cycles. */
+ * FILTER_OK or set urccb as it will just waste program memory/cpu cycles.
+ * It schedules the commands as well - see CMD_QUEUE_LEN below. */
 #define FILTER_OK
 
 /* DEBUG_ESEYEAWS adds debug trace support to the uart selected in the call to 
@@ -43,125 +51,1764 @@
 #ifdef TIMEOUT_RESPONSES
 #define PUB_TIMEOUT 3000UL /* 3 second timeout */
 #define SUB_TIMEOUT 3000UL /* 3 second timeout */
+#define CMD_TIMEOUT 5000UL /* 5 seconds for any command's final result */
+#endif
+
+/* AUTO_RECOVER reopens sub/pub topics which error (a failed or timed out
+ * open, or a modem restart) from poll(), backing off from RECOVER_MIN_MS and
+ * doubling up to RECOVER_MAX_MS with random jitter. Topics are reopened by
+ * name so it needs a topic pool (TOPIC_POOL_SIZE > 0). Without it an errored
+ * topic stays errored until the application reopens it - don't define it
+ * for a sketch which does that itself, as the awsdemo example does */
+//#define AUTO_RECOVER
+#ifdef AUTO_RECOVER
+#ifndef RECOVER_MIN_MS
+#define RECOVER_MIN_MS 1000UL
+#endif
+#ifndef RECOVER_MAX_MS
+#define RECOVER_MAX_MS 60000UL
+#endif
+#endif
+
+/* LINK_METRICS counts traffic on the modem link (bytes, URCs, lines, send
+ * results and publish latency) for metrics() - a few increments per line, at
+ * about 120 bytes of RAM per instance */
+//#define LINK_METRICS
+
+/* UART_CAPTURE lets every run of bytes to and from the modem be recorded
+ * with a timestamp to a sink given to capture() (a RAM ring, a file or a
+ * spare uart) so field traffic can be replayed on the host. Without a
+ * capture() it costs a pointer test per read and write */
+//#define UART_CAPTURE
+
+/* ESEYEAWS_LOWRAM shrinks the default buffer and topic counts and bit-packs the
+ * per-instance state fields for RAM-starved parts like the 2KB ATmega328P.
+ * It changes the library's own files too, so set it for the whole build.
+ * Use staticram()/instanceram() to see what the library costs. */
+//#define ESEYEAWS_LOWRAM
+#ifdef ESEYEAWS_LOWRAM
+#define ESEYE_BITS(n) : n
+#else
+#define ESEYE_BITS(n)
 #endif
 
+/* PUB_JOURNAL lets publishes which can't be sent (their topic is errored or
+ * still registering, or the modem reports SEND FAIL or ERROR or doesn't
+ * answer) be kept in a journal on storage given to journal() and replayed
+ * once the topic is registered again. Without a journal() it costs a few bytes of RAM */
+//#define PUB_JOURNAL
+
 #define ESEYEAWSLIB_VERSION "0.5"
 
+#ifndef MAX_SUB_TOPICS
+#ifdef ESEYEAWS_LOWRAM
+#define MAX_SUB_TOPICS 4
+#else
 #define MAX_SUB_TOPICS 8
+#endif
+#endif
+#ifndef MAX_PUB_TOPICS
+#ifdef ESEYEAWS_LOWRAM
+#define MAX_PUB_TOPICS 4
+#else
 #define MAX_PUB_TOPICS 8		
+#endif
+#endif
+
+/* Publish queue - copied payloads are packed into txbuf in queue order
+ * and sent one '>' prompt at a time. Applications which only use
+ * publishref()/publishwriter() can set MODEM_TX_BUFSIZE to 0 */
+#ifndef MODEM_TX_BUFSIZE
+#ifdef ESEYEAWS_LOWRAM
+#define MODEM_TX_BUFSIZE 48
+#else
+#define MODEM_TX_BUFSIZE 128
+#endif
+#endif
+#ifndef PUB_QUEUE_LEN
+#ifdef ESEYEAWS_LOWRAM
+#define PUB_QUEUE_LEN 2
+#else
+#define PUB_QUEUE_LEN 4
+#endif
+#endif
+
+/* Command staging - each command is formatted once into cmdbuf and written
+ * with a single write(), or as the uart has room for it if txnonblock */
+#ifndef CMD_BUFSIZE
+#ifdef ESEYEAWS_LOWRAM
+#define CMD_BUFSIZE 40
+#else
+#define CMD_BUFSIZE 64
+#endif
+#endif
+
+/* Command scheduling (with FILTER_OK) - each command is remembered until its
+ * final OK/ERROR so every result, and the lines of the reply before it, go to
+ * the command which caused them. Up to CMD_QUEUE_LEN commands are queued (a
+ * command goes ahead of queued ones with a lower priority, so publishes
+ * overtake housekeeping) and CMD_WINDOW of them are sent before the oldest
+ * has been answered */
+#ifndef CMD_QUEUE_LEN
+#ifdef ESEYEAWS_LOWRAM
+#define CMD_QUEUE_LEN 3
+#else
+#define CMD_QUEUE_LEN 4
+#endif
+#endif
+#ifndef CMD_WINDOW
+#ifdef ESEYEAWS_LOWRAM
+#define CMD_WINDOW 2
+#else
+#define CMD_WINDOW 4
+#endif
+#endif
+
+/* baudup() waits BAUD_WAIT_MS for each answer while it moves the link to a
+ * new rate, and tries AT BAUD_PROBES times at a rate before deciding the
+ * modem isn't listening at it */
+#ifndef BAUD_WAIT_MS
+#define BAUD_WAIT_MS 300UL
+#endif
+#ifndef BAUD_PROBES
+#define BAUD_PROBES 3
+#endif
+
+/* Topic names can be kept in a pool of TOPIC_POOL_SIZE bytes (e.g. 128) so
+ * subscribing to (or registering) a topic which is already open shares its
+ * modem slot. SUB_SHARED_HANDLERS is how many subscriptions can share slots
+ * on top of one per slot. 0 for both (the default) keeps one subscription per
+ * slot and stores no names */
+#ifndef TOPIC_POOL_SIZE
+#define TOPIC_POOL_SIZE 0
+#endif
+#ifndef SUB_SHARED_HANDLERS
+#define SUB_SHARED_HANDLERS 0
+#endif
+
+/* Publish batching - records appended to a batching publish index are packed
+ * into one payload of up to PUB_BATCH_SIZE bytes (sent through txbuf, so it
+ * must be at least as big) and published when the batch fills or its oldest
+ * record has waited long enough. PUB_BATCHES indices can batch at once (0,
+ * the default, leaves batching out) */
+#ifndef PUB_BATCHES
+#define PUB_BATCHES 0
+#endif
+#ifndef PUB_BATCH_SIZE
+#define PUB_BATCH_SIZE 120
+#endif
+
+/* Operations given a completion callback - PENDING_OPS is how many can be
+ * waiting for their result at once (0 leaves callbacks out) */
+#ifndef PENDING_OPS
+#define PENDING_OPS 2
+#endif
+
+#ifndef MODEM_RX_BUFSIZE
+#ifdef ESEYEAWS_LOWRAM
+#define MODEM_RX_BUFSIZE 48
+#else
+#define MODEM_RX_BUFSIZE 100
+#endif
+#endif
+
+/* poll() moves received bytes from the uart in blocks of up to RX_CHUNK_SIZE
+ * (on the stack) and hands each block to ingest() */
+#ifndef RX_CHUNK_SIZE
+#ifdef ESEYEAWS_LOWRAM
+#define RX_CHUNK_SIZE 16
+#else
+#define RX_CHUNK_SIZE 32
+#endif
+#endif
 
 /* Prototype for the AT command response callback function */
 typedef void (*_atcb)(char *data);
 /* Prototype for the message callback function */	
 typedef void (*_msgcb)(uint8_t *data, uint8_t length);
+/* Prototype for the streaming message callback function - called for each
+ * chunk of a message with its offset and the total message length */
+typedef void (*_msgchunkcb)(uint8_t *chunk, uint8_t chunklen, uint16_t offset, uint16_t total);
+/* Prototype for the publish complete callback function (id returned by publish()) */
+typedef void (*_pubcb)(uint8_t id, boolean success);
+/* Prototype for a streaming publish writer - called at the '>' prompt to write
+ * exactly datalen bytes of payload to out */
+typedef void (*_pubwriter)(Print *out, uint16_t datalen, void *ctx);
+/* Prototype for an operation completion callback - op is ESEYE_OP_*, handle
+ * the index or publish id the call returned (0 for a publish it journaled)
+ * and result 0, the modem's error code or ESEYE_TIMEDOUT etc. */
+typedef void (*_donecb)(uint8_t op, int handle, int8_t result, void *ctx);
+/* Prototype for a sendAT() response callback - called with each line of the
+ * reply (result ESEYE_CMD_LINE) then the final OK (0) or ERROR
+ * (ESEYE_CMD_ERROR) line, or with a NULL line and ESEYE_TIMEDOUT or
+ * ESEYE_RESTARTED if that never came */
+typedef void (*_atrespcb)(char *line, int8_t result, void *ctx);
+/* Prototype for the function baudup() calls to run the modem uart at baud
+ * (e.g. ATSerial.begin(baud)) */
+typedef void (*_baudcb)(unsigned long baud, void *ctx);
 /* Publish topic state */
 typedef enum {PUB_TOPIC_ERROR = -1, PUB_TOPIC_NOT_IN_USE = 0, PUB_TOPIC_REGISTERING, PUB_TOPIC_REGISTERED, PUB_TOPIC_UNREGISTERING} tpubTopicState;
 /* Subscribe topic state */
 typedef enum {SUB_TOPIC_ERROR = -1, SUB_TOPIC_NOT_IN_USE = 0, SUB_TOPIC_SUBSCRIBING, SUB_TOPIC_SUBSCRIBED, SUB_TOPIC_UNSUBSCRIBING} tsubTopicState;
-/* Reason for waking up/not sleeping (unable to sleep currently, timer, message from click board or external interrupt) */
-typedef enum {TRY_AGAIN_SHORTLY, WAKE_TIMER, WAKE_CLICK, WAKE_INT} twakeReason;
+/* Reason for waking up/not sleeping (unable to sleep currently, timer, message from click board, external interrupt
+ * or a response timeout which sleep() shortened its duration to) */
+typedef enum {TRY_AGAIN_SHORTLY, WAKE_TIMER, WAKE_CLICK, WAKE_INT, WAKE_DEADLINE} twakeReason;
 
 /* Subscribed topic array element */	
 struct subtpc{
+  /* tsubTopicState */
+  int8_t substate ESEYE_BITS(4);
+};
+
+/* Subscription - subscribe() returns its index. Subscriptions to the same
+ * topic share the subtpc slot and each gets every message */
+struct subhandler{
   _msgcb messagecb;
-  tsubTopicState substate;
-#ifdef TIMEOUT_RESPONSES
-  /* Include a senttime for each sub/unsub to enable timeout */
-  unsigned long senttime;
-#endif
+  _msgchunkcb chunkcb;
+  /* subtopics index or 0xff if free */
+  uint8_t slot;
 };
 
 /* Publish topic array element */
 struct pubtpc{
-  tpubTopicState pubstate;
+  /* tpubTopicState */
+  int8_t pubstate ESEYE_BITS(4);
+  /* Number of pubreg() calls sharing the index */
+  uint8_t refs ESEYE_BITS(4);
+};
+
+/* Queued publish element - the payload is either copied into txbuf at offset,
+ * referenced in caller memory or produced by a writer at the '>' prompt */
+typedef enum {PUBQ_COPY, PUBQ_REF, PUBQ_WRITER} tpubqType;
+struct pubqentry{
+  uint8_t id;
+  uint8_t tpcidx ESEYE_BITS(4);
+  /* tpubqType */
+  uint8_t type ESEYE_BITS(2);
+  uint16_t len;
+  union{
+    uint16_t offset;
+    const uint8_t *data;
+    struct{
+      _pubwriter writer;
+      void *ctx;
+    } w;
+  } src;
+};
+
+/* Publish batch - records are separated by sep, or each preceded by its
+ * length if sep is 0 */
+struct pubbatch{
+  /* pubtopics index or 0xff if free */
+  uint8_t tpcidx;
+  uint8_t sep;
+  /* Publish once this many bytes are batched */
+  uint8_t limit;
+  uint8_t len;
+  /* Longest a record waits (0 = until full or flushed) and when the oldest is due */
+  unsigned long maxdelay;
+  unsigned long due;
+};
+
+/* Print wrapper handed to publish writers - it stops at the declared length
+ * and pads short payloads so the modem is never left waiting for data */
+class eseyePubOut : public Print
+{
+public:
+    eseyePubOut(Print *out, uint16_t len) : out(out), remaining(len) {}
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    void pad(void);
+private:
+    Print *out;
+    uint16_t remaining;
+};
+
+/* Feature policies
+ * eseyeAWSBasic inherits one of each pair so a disabled feature is an empty
+ * base class - it adds no bytes to the instance and its calls compile away */
+
+/* Response timeouts - pub/sub requests with no response after the timeout
+ * are marked as errored */
+template<unsigned long PUBMS = 3000UL, unsigned long SUBMS = 3000UL, unsigned long CMDMS = 5000UL>
+struct eseyeTimeouts
+{
+    static const bool enabled = true;
+    static const unsigned long pubtimeout = PUBMS;
+    static const unsigned long subtimeout = SUBMS;
+    static const unsigned long cmdtimeout = CMDMS;
+};
+
+struct eseyeNoTimeouts
+{
+    static const bool enabled = false;
+    static const unsigned long pubtimeout = 0;
+    static const unsigned long subtimeout = 0;
+    static const unsigned long cmdtimeout = 0;
+};
+
+/* Returned by nextDeadline() when no response is being waited for */
+#define ESEYE_NO_DEADLINE 0xffffffffUL
+
+/* Response deadlines for the requests being timed, kept sorted so the earliest
+ * is always first - checking that nothing has expired is a single compare.
+ * Each slot (sub topic, pub topic, publish queue head or oldest command) has
+ * at most one deadline. Only kept if timeouts are enabled */
+template<bool ENABLED, uint8_t N>
+class eseyeDeadlines
+{
+protected:
+    void dlreset(void) { this->dlcount = 0; }
+    /* Set (or move) the deadline for slot to ms from now */
+    void dlarm(uint8_t slot, unsigned long ms) {
+      unsigned long deadline = millis() + ms;
+      uint8_t i;
+      this->dldisarm(slot);
+      i = this->dlcount++;
+      while(i > 0 && (long)(this->dlat[i - 1] - deadline) > 0){
+        this->dlat[i] = this->dlat[i - 1];
+        this->dlslot[i] = this->dlslot[i - 1];
+        i--;
+      }
+      this->dlat[i] = deadline;
+      this->dlslot[i] = slot;
+    }
+    /* The response for slot has arrived */
+    void dldisarm(uint8_t slot) {
+      uint8_t i;
+      for(i = 0; i < this->dlcount; i++){
+        if(this->dlslot[i] == slot){
+          this->dlcount--;
+          memmove(&this->dlat[i], &this->dlat[i + 1], (this->dlcount - i) * sizeof(this->dlat[0]));
+          memmove(&this->dlslot[i], &this->dlslot[i + 1], this->dlcount - i);
+          return;
+        }
+      }
+    }
+    boolean dlpending(void) { return this->dlcount > 0; }
+    /* Remove and return the slot of an expired deadline, or 0xff if none has */
+    uint8_t dlexpired(unsigned long now) {
+      uint8_t slot;
+      if(this->dlcount == 0 || (long)(now - this->dlat[0]) < 0)
+        return 0xff;
+      slot = this->dlslot[0];
+      this->dldisarm(slot);
+      return slot;
+    }
+    /* ms until the earliest deadline (0 if it has passed) */
+    unsigned long dlnext(unsigned long now) {
+      if(this->dlcount == 0)
+        return ESEYE_NO_DEADLINE;
+      if((long)(this->dlat[0] - now) <= 0)
+        return 0;
+      return this->dlat[0] - now;
+    }
+private:
+    unsigned long dlat[N];
+    uint8_t dlslot[N];
+    uint8_t dlcount;
+};
+
+template<uint8_t N>
+class eseyeDeadlines<false, N>
+{
+protected:
+    void dlreset(void) {}
+    void dlarm(uint8_t, unsigned long) {}
+    void dldisarm(uint8_t) {}
+    boolean dlpending(void) { return false; }
+    uint8_t dlexpired(unsigned long) { return 0xff; }
+    unsigned long dlnext(unsigned long) { return ESEYE_NO_DEADLINE; }
+};
+
+/* Topic recovery - errored topics are reopened after a backoff which
+ * doubles from MINMS up to MAXMS, each one shortened by a random amount of
+ * up to half so nodes which lost the network together don't retry together */
+template<unsigned long MINMS = 1000UL, unsigned long MAXMS = 60000UL>
+struct eseyeRecovery
+{
+    static const bool enabled = true;
+    static const unsigned long minms = MINMS;
+    static const unsigned long maxms = MAXMS;
+};
+
+struct eseyeNoRecovery
+{
+    static const bool enabled = false;
+    static const unsigned long minms = 0;
+    static const unsigned long maxms = 0;
+};
+
+/* Next attempt and attempts so far for each sub and pub topic slot being
+ * recovered (numbered as for deadlines), and how long the last recovery took
+ * from the first topic erroring to the last one being open again. Only kept
+ * if recovery is enabled */
+template<bool ENABLED, uint8_t N>
+class eseyeRetries
+{
+protected:
+    void rtreset(void) {
+      memset(this->rttries, 0, sizeof(this->rttries));
+      this->rtlast = 0;
+    }
+    /* Schedule another attempt for slot - randomly between half and all of
+     * a backoff which doubles with each attempt */
+    void rtarm(uint8_t slot, unsigned long minms, unsigned long maxms) {
+      unsigned long now = millis();
+      unsigned long ms = minms;
+      uint8_t i;
+      if(this->rtpending() == false)
+        this->rtsince = now;
+      for(i = 0; i < this->rttries[slot] && ms < maxms; i++)
+        ms <<= 1;
+      if(ms > maxms)
+        ms = maxms;
+      ms -= random(ms / 2 + 1);
+      if(this->rttries[slot] < 0xff)
+        this->rttries[slot]++;
+      this->rtat[slot] = now + ms;
+    }
+    /* Hold off the next attempt while one is outstanding */
+    void rtwait(uint8_t slot, unsigned long ms) { this->rtat[slot] = millis() + ms; }
+    /* Stop retrying slot - it is open again if recovered */
+    void rtstop(uint8_t slot, boolean recovered) {
+      if(this->rttries[slot] == 0)
+        return;
+      this->rttries[slot] = 0;
+      if(recovered && this->rtpending() == false)
+        this->rtlast = millis() - this->rtsince;
+    }
+    boolean rtretrying(uint8_t slot) { return this->rttries[slot] > 0; }
+    boolean rtpending(void) {
+      uint8_t i;
+      for(i = 0; i < N; i++){
+        if(this->rttries[i] > 0)
+          return true;
+      }
+      return false;
+    }
+    /* A slot whose next attempt is due, 0xff if none is */
+    uint8_t rtdue(unsigned long now) {
+      uint8_t i;
+      for(i = 0; i < N; i++){
+        if(this->rttries[i] > 0 && (long)(now - this->rtat[i]) >= 0)
+          return i;
+      }
+      return 0xff;
+    }
+    /* ms until the next attempt (0 if one is due) */
+    unsigned long rtnext(unsigned long now) {
+      unsigned long next = ESEYE_NO_DEADLINE;
+      uint8_t i;
+      for(i = 0; i < N; i++){
+        if(this->rttries[i] == 0)
+          continue;
+        if((long)(this->rtat[i] - now) <= 0)
+          return 0;
+        if(this->rtat[i] - now < next)
+          next = this->rtat[i] - now;
+      }
+      return next;
+    }
+    unsigned long rtrecovery(void) { return this->rtlast; }
+private:
+    unsigned long rtat[N];
+    uint8_t rttries[N];
+    unsigned long rtsince;
+    unsigned long rtlast;
+};
+
+template<uint8_t N>
+class eseyeRetries<false, N>
+{
+protected:
+    void rtreset(void) {}
+    void rtarm(uint8_t, unsigned long, unsigned long) {}
+    void rtwait(uint8_t, unsigned long) {}
+    void rtstop(uint8_t, boolean) {}
+    boolean rtretrying(uint8_t) { return false; }
+    boolean rtpending(void) { return false; }
+    uint8_t rtdue(unsigned long) { return 0xff; }
+    unsigned long rtnext(unsigned long) { return ESEYE_NO_DEADLINE; }
+    unsigned long rtrecovery(void) { return 0; }
+};
+
+/* Kinds of line the URC classifier recognises (URC_* in eseyeaws_impl.h) */
+#define ESEYE_URC_TYPES 12
+
+/* Publish latency histogram - bucket i counts publishes whose SEND OK came
+ * less than eseyeLatencyBounds[i] ms after their PUBLISH command (read with
+ * pgm_read_word()), the last bucket those which took longer */
+#define ESEYE_LATENCY_BUCKETS 8
+extern const uint16_t eseyeLatencyBounds[ESEYE_LATENCY_BUCKETS - 1] PROGMEM;
+
+struct eseyeMetricCounts{
+  /* millis() when counting started */
+  unsigned long since;
+  unsigned long bytesin;
+  unsigned long bytesout;
+  /* Lines of each URC type */
+  unsigned long urcs[ESEYE_URC_TYPES];
+  /* Lines handed to the AT command callback, or dropped with no callback */
+  unsigned long forwarded;
+  unsigned long discarded;
+  /* Lines longer than the receive buffer, which wrapped round in it */
+  unsigned long rxwraps;
+  /* OK/ERROR results neither a library command nor sendAT() was owed */
+  unsigned long okstray;
+  /* Losses an eseyeRxRing reported - the line or message being received
+   * with each was dropped */
+  unsigned long rxoverruns;
+  unsigned long sendok;
+  unsigned long sendfail;
+  unsigned long latency[ESEYE_LATENCY_BUCKETS];
+};
+
+/* Link metrics */
+class eseyeMetrics
+{
+protected:
+    void mtreset(void) {
+      memset(&this->mt, 0, sizeof(this->mt));
+      this->mt.since = millis();
+      this->mtappowed = 0;
+    }
+    void mtin(uint16_t n) { this->mt.bytesin += n; }
+    void mtout(uint16_t n) { this->mt.bytesout += n; }
+    void mturc(uint8_t type) {
+      if(type < ESEYE_URC_TYPES)
+        this->mt.urcs[type]++;
+    }
+    void mtline(boolean forwarded) {
+      if(forwarded)
+        this->mt.forwarded++;
+      else
+        this->mt.discarded++;
+    }
+    void mtwrap(void) { this->mt.rxwraps++; }
+    void mtoverrun(void) { this->mt.rxoverruns++; }
+    /* sendAT() has sent a command which is owed a result */
+    void mtappcmd(void) {
+      if(this->mtappowed < 0xff)
+        this->mtappowed++;
+    }
+    /* A result which wasn't for a library command */
+    void mtappresult(void) {
+      if(this->mtappowed > 0)
+        this->mtappowed--;
+      else
+        this->mt.okstray++;
+    }
+    void mtpubstart(void) { this->mtpubat = millis(); }
+    void mtpubdone(boolean success) {
+      unsigned long ms = millis() - this->mtpubat;
+      uint8_t i = 0;
+      if(success == false){
+        this->mt.sendfail++;
+        return;
+      }
+      this->mt.sendok++;
+      while(i < ESEYE_LATENCY_BUCKETS - 1 && ms >= pgm_read_word(&eseyeLatencyBounds[i]))
+        i++;
+      this->mt.latency[i]++;
+    }
+    void mtsnapshot(struct eseyeMetricCounts *counts, boolean reset) {
+      memcpy(counts, &this->mt, sizeof(*counts));
+      if(reset){
+        memset(&this->mt, 0, sizeof(this->mt));
+        this->mt.since = millis();
+      }
+    }
+private:
+    struct eseyeMetricCounts mt;
+    unsigned long mtpubat;
+    uint8_t mtappowed;
+};
+
+class eseyeNoMetrics
+{
+protected:
+    void mtreset(void) {}
+    void mtin(uint16_t) {}
+    void mtout(uint16_t) {}
+    void mturc(uint8_t) {}
+    void mtline(boolean) {}
+    void mtwrap(void) {}
+    void mtoverrun(void) {}
+    void mtappcmd(void) {}
+    void mtappresult(void) {}
+    void mtpubstart(void) {}
+    void mtpubdone(boolean) {}
+    void mtsnapshot(struct eseyeMetricCounts *counts, boolean) { memset(counts, 0, sizeof(*counts)); }
+};
+
+/* UART capture - each run of bytes received from or sent to the modem is a
+ * record <delta><len << 1 | dir><bytes>, delta being the ms since the
+ * previous record (the first has millis()) and both varints of 7 bits a
+ * byte, least significant first. A capture starts 'E' 'C' <version>.
+ * Implemented in eseyeaws_capture.cpp */
+#define ESEYE_CAPTURE_RX 0
+#define ESEYE_CAPTURE_TX 1
+#define ESEYE_CAPTURE_VERSION 1
+/* Longest record header - a 5 byte delta and 3 byte length */
+#define ESEYE_CAPTURE_HDRMAX 8
+
+class eseyeCaptureSink
+{
+public:
+    eseyeCaptureSink() : lastms(0) {}
+    virtual void record(uint8_t dir, unsigned long ms, const uint8_t *data, uint16_t len) = 0;
+    /* Encode a varint - returns its length */
+    static uint8_t varint(uint8_t *buf, unsigned long n);
+protected:
+    /* Encode the header of a record at ms - returns its length */
+    uint8_t head(uint8_t *hdr, uint8_t dir, unsigned long ms, uint16_t len);
+    static void start(Print *out);
+    unsigned long lastms;
+};
+
+/* Capture to a Print - a file on the host, or a spare uart to a logger */
+class eseyeCapturePrint : public eseyeCaptureSink
+{
+public:
+    eseyeCapturePrint(Print *out) : out(out), started(false) {}
+    virtual void record(uint8_t dir, unsigned long ms, const uint8_t *data, uint16_t len);
+private:
+    Print *out;
+    boolean started;
+};
+
+/* Capture the latest traffic into size bytes of RAM - the oldest records are
+ * dropped to make room and a record bigger than the ring keeps its last
+ * bytes. dump() writes what is held as eseyeCapturePrint would have */
+class eseyeCaptureRing : public eseyeCaptureSink
+{
+public:
+    eseyeCaptureRing(uint8_t *buf, uint16_t size);
+    virtual void record(uint8_t dir, unsigned long ms, const uint8_t *data, uint16_t len);
+    void dump(Print *out);
+    void clear(void);
+    /* Records held and dropped (or cut short) for room */
+    uint16_t records(void) { return this->held; }
+    unsigned long dropped(void) { return this->drops; }
+private:
+    void put(const uint8_t *data, uint16_t len);
+    unsigned long getvarint(uint16_t *off);
+    void drop(void);
+
+    uint8_t *buf;
+    uint16_t size;
+    uint16_t first;
+    uint16_t used;
+    uint16_t held;
+    /* Time of the last record dropped, which the oldest held is relative to */
+    unsigned long basems;
+    unsigned long drops;
+};
+
+/* Print in front of the modem uart which records what is written to it */
+class eseyeCaptureTap : public Print
+{
+public:
+    virtual size_t write(uint8_t c) { return this->write(&c, 1); }
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+      size_t n = this->out->write(buffer, size);
+      this->sink->record(ESEYE_CAPTURE_TX, millis(), buffer, n);
+      return n;
+    }
+    using Print::write;
+    virtual int availableForWrite(void) { return this->out->availableForWrite(); }
+    Print *out;
+    eseyeCaptureSink *sink;
+};
+
+class eseyeCapture
+{
+protected:
+    void cpreset(void) { this->cptap.sink = NULL; }
+    void cpattach(eseyeCaptureSink *sink, Print *uart) {
+      this->cptap.out = uart;
+      this->cptap.sink = sink;
+    }
+    void cprx(const uint8_t *data, uint16_t len) {
+      if(this->cptap.sink != NULL)
+        this->cptap.sink->record(ESEYE_CAPTURE_RX, millis(), data, len);
+    }
+    void cptx(const uint8_t *data, uint16_t len) {
+      if(this->cptap.sink != NULL)
+        this->cptap.sink->record(ESEYE_CAPTURE_TX, millis(), data, len);
+    }
+    /* Where writes which don't go through cptx() should go */
+    Print *cpout(Print *uart) { return this->cptap.sink != NULL ? &this->cptap : uart; }
+private:
+    eseyeCaptureTap cptap;
+};
+
+class eseyeNoCapture
+{
+protected:
+    void cpreset(void) {}
+    void cpattach(eseyeCaptureSink *, Print *) {}
+    void cprx(const uint8_t *, uint16_t) {}
+    void cptx(const uint8_t *, uint16_t) {}
+    Print *cpout(Print *uart) { return uart; }
+};
+
+/* Receive ring - a Stream in front of the modem uart which a receive
+ * interrupt fills with put(), so bytes wait in size bytes of RAM (a power of
+ * two) rather than a core's 64 byte buffer while loop() is busy. Writes go
+ * to out. A byte which doesn't fit is dropped and counted, and the reader
+ * can't miss it: available() stops where the loss was until gap() has
+ * reported it, and a library instance given the ring then drops what it was
+ * receiving. Implemented in eseyeaws_rxring.cpp */
+struct eseyeRxCounts{
+  unsigned long received;
+  unsigned long dropped;
+  /* Runs of dropped bytes - from a full ring or the uart's own overrun */
+  unsigned long overruns;
+  /* Most bytes held at once */
+  uint16_t highwater;
+};
+
+class eseyeRxRing : public Stream
+{
+public:
+    eseyeRxRing(uint8_t *buf, uint16_t size, Print *out = NULL);
+    /* From the receive interrupt - a byte arrived, or the uart lost some */
+    void put(uint8_t c);
+    void lost(void);
+
+    virtual int available(void);
+    virtual int read(void);
+    virtual int peek(void);
+    /* Never waits - Stream::readBytes() isn't virtual, so poll() calls this
+     * through the ring rather than the Stream */
+    size_t readBytes(char *buffer, size_t length);
+    using Stream::readBytes;
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    virtual int availableForWrite(void);
+    virtual void flush(void);
+
+    /* Everything before a loss has been read - true once for each loss */
+    boolean gap(void);
+    /* Drop whatever is held (noise from a baud rate change) */
+    void clear(void);
+    void counts(struct eseyeRxCounts *counts, boolean reset = false);
+
+#if defined(__AVR__) && defined(ESEYEAWS_RX_USART)
+    /* Run USART ESEYEAWS_RX_USART at baud (8N1) with its receive interrupt
+     * feeding this ring and writes going straight to it. The core's
+     * HardwareSerial for that USART (e.g. Serial1) must not be used as well -
+     * their receive interrupts would clash */
+    void begin(unsigned long baud);
+    static eseyeRxRing *usartring;
+#endif
+
+private:
+    uint16_t readable(void);
+
+    uint8_t *buf;
+    uint16_t mask;
+    Print *out;
+    volatile uint16_t head;
+    volatile uint16_t tail;
+    /* Where the reader meets the oldest loss not yet reported by gap() */
+    volatile uint16_t gapat;
+    volatile boolean gapped;
+    /* The last byte was dropped - the next drop is part of the same run */
+    boolean losing;
+    struct eseyeRxCounts rc;
+};
+
+/* Debug trace to the uart passed to init() */
+class eseyeTrace
+{
+protected:
+    void traceuart(Stream *trcuart) { this->dbguart = trcuart; }
+    template<typename T> void trcprint(T x) {
+      if(this->dbguart != NULL)
+        this->dbguart->print(x);
+    }
+    template<typename T> void trcprintln(T x) {
+      if(this->dbguart != NULL)
+        this->dbguart->println(x);
+    }
+    void trcflush(void) {
+      if(this->dbguart != NULL)
+        this->dbguart->flush();
+    }
+private:
+    Stream *dbguart;
+};
+
+class eseyeNoTrace
+{
+protected:
+    void traceuart(Stream *) {}
+    template<typename T> void trcprint(T) {}
+    template<typename T> void trcprintln(T) {}
+    void trcflush(void) {}
+};
+
+/* Batches for publish indices using pubbatch() - absent if there are none */
+template<uint8_t N, uint8_t SIZE>
+class eseyeBatches
+{
+protected:
+    void btreset(void) {
+      uint8_t i;
+      for(i = 0; i < N; i++){
+        this->batches[i].tpcidx = 0xff;
+        this->batches[i].len = 0;
+      }
+    }
+    /* The batch of a publish index (or a free one to use for it) */
+    struct pubbatch *btfind(uint8_t tpcidx, boolean alloc) {
+      struct pubbatch *avail = NULL;
+      uint8_t i;
+      for(i = 0; i < N; i++){
+        if(this->batches[i].tpcidx == tpcidx)
+          return &this->batches[i];
+        if(avail == NULL && this->batches[i].tpcidx == 0xff)
+          avail = &this->batches[i];
+      }
+      if(alloc == false || avail == NULL)
+        return NULL;
+      avail->tpcidx = tpcidx;
+      avail->len = 0;
+      return avail;
+    }
+    void btfree(uint8_t tpcidx) {
+      struct pubbatch *b = this->btfind(tpcidx, false);
+      if(b != NULL)
+        b->tpcidx = 0xff;
+    }
+    uint8_t *btdata(struct pubbatch *b) { return this->btbuf[b - this->batches]; }
+    /* Add a record - false if it doesn't fit behind what is already batched */
+    boolean btadd(struct pubbatch *b, const uint8_t *data, uint8_t len, unsigned long now) {
+      uint8_t *buf = this->btdata(b);
+      uint8_t framing = (b->sep == 0 || b->len > 0) ? 1 : 0;
+      if((uint16_t)b->len + framing + len > SIZE)
+        return false;
+      if(b->len == 0)
+        b->due = now + b->maxdelay;
+      if(b->sep == 0)
+        buf[b->len++] = len;
+      else if(b->len > 0)
+        buf[b->len++] = b->sep;
+      memcpy(&buf[b->len], data, len);
+      b->len += len;
+      return true;
+    }
+    static boolean bttimed(struct pubbatch *b) { return b->tpcidx != 0xff && b->len > 0 && b->maxdelay > 0; }
+    /* A batch whose oldest record is due, NULL if none is */
+    struct pubbatch *btdue(unsigned long now) {
+      uint8_t i;
+      for(i = 0; i < N; i++){
+        if(bttimed(&this->batches[i]) && (long)(now - this->batches[i].due) >= 0)
+          return &this->batches[i];
+      }
+      return NULL;
+    }
+    /* ms until the next batch is due (0 if one is) */
+    unsigned long btnext(unsigned long now) {
+      unsigned long next = ESEYE_NO_DEADLINE;
+      uint8_t i;
+      for(i = 0; i < N; i++){
+        if(bttimed(&this->batches[i]) == false)
+          continue;
+        if((long)(this->batches[i].due - now) <= 0)
+          return 0;
+        if(this->batches[i].due - now < next)
+          next = this->batches[i].due - now;
+      }
+      return next;
+    }
+private:
+    struct pubbatch batches[N];
+    uint8_t btbuf[N][SIZE];
+};
+
+template<uint8_t SIZE>
+class eseyeBatches<0, SIZE>
+{
+protected:
+    void btreset(void) {}
+    struct pubbatch *btfind(uint8_t, boolean) { return NULL; }
+    void btfree(uint8_t) {}
+    uint8_t *btdata(struct pubbatch *) { return NULL; }
+    boolean btadd(struct pubbatch *, const uint8_t *, uint8_t, unsigned long) { return false; }
+    struct pubbatch *btdue(unsigned long) { return NULL; }
+    unsigned long btnext(unsigned long) { return ESEYE_NO_DEADLINE; }
+};
+
+/* Publish journal storage - a byte addressable region which keeps its
+ * contents through a reset */
+class eseyeJournalStore
+{
+public:
+    virtual uint16_t size(void) = 0;
+    virtual void read(uint16_t addr, uint8_t *data, uint16_t len) = 0;
+    virtual void write(uint16_t addr, const uint8_t *data, uint16_t len) = 0;
+    /* Make everything written so far durable */
+    virtual void commit(void) {}
+};
+
+#ifdef __AVR__
+/* The journal in len bytes of EEPROM from base - only bytes which change are
+ * written, but each record added or sent rewrites the 8 byte header */
+class eseyeEEPROMStore : public eseyeJournalStore
+{
+public:
+    eseyeEEPROMStore(uint16_t base, uint16_t len) : base(base), len(len) {}
+    virtual uint16_t size(void) { return this->len; }
+    virtual void read(uint16_t addr, uint8_t *data, uint16_t len);
+    virtual void write(uint16_t addr, const uint8_t *data, uint16_t len);
+private:
+    uint16_t base;
+    uint16_t len;
+};
+#endif
+
+/* Returned by publish() for a payload kept in the journal instead of queued */
+#define ESEYE_JOURNALED -2
+
+struct eseyeJournalCounts{
+  /* Records added, sent from the journal and lost to make room (or too big) */
+  unsigned long journaled;
+  unsigned long replayed;
+  unsigned long evicted;
+  /* Records in the journal now */
+  uint16_t records;
+};
+
+/* Publish journal - records are kept oldest first in a ring on the store
+ * behind an 8 byte header, each as <len lo><len hi><tpcidx><payload>. The
+ * oldest record is replayed once its topic is registered, one at a time and
+ * no more often than the replay interval; a full journal drops its oldest
+ * records to make room. Implemented in eseyeaws_journal.cpp */
+class eseyeJournal
+{
+protected:
+    void jnreset(void);
+    void jnattach(eseyeJournalStore *store, unsigned long replayms);
+    /* Add a record from data, or the bytes writer produces */
+    boolean jnkeep(uint8_t tpcidx, const uint8_t *data, uint16_t len);
+    boolean jnwrite(uint8_t tpcidx, uint16_t len, _pubwriter writer, void *ctx);
+    /* The oldest record - false if there is none or it is being replayed */
+    boolean jnhead(uint8_t *tpcidx, uint16_t *len);
+    /* ms until the next replay may start */
+    unsigned long jnwait(unsigned long now);
+    /* The oldest record has been queued as publish id */
+    void jnsent(uint8_t id);
+    /* Publish id completed - returns true if it was a replay (which is
+     * removed from the journal if it was sent) */
+    boolean jndone(uint8_t id, boolean success);
+    /* Drop the oldest record unsent */
+    void jndiscard(void);
+    void jncounts(struct eseyeJournalCounts *counts);
+    void *jnctx(void) { return this; }
+    /* Publish writer for the oldest record (ctx is jnctx()) */
+    static void jnreplay(Print *out, uint16_t datalen, void *ctx);
+private:
+    friend class eseyeJournalOut;
+    uint16_t jnspan(void);
+    void jnio(uint16_t off, uint8_t *data, uint16_t len, boolean write);
+    void jnsave(void);
+    boolean jnbegin(uint8_t tpcidx, uint16_t len);
+    void jnput(const uint8_t *data, uint16_t len);
+    void jnend(void);
+    void jndrop(void);
+
+    eseyeJournalStore *jnstore;
+    /* Ring offsets of the oldest record and of the next byte of the record
+     * being added, bytes and records held */
+    uint16_t jnfirst;
+    uint16_t jnwr;
+    uint16_t jnused;
+    uint16_t jnrecords;
+    /* Size of the record being added */
+    uint16_t jnadding;
+    /* The oldest record is being replayed as publish jnid */
+    boolean jnbusy;
+    uint8_t jnid;
+    unsigned long jninterval;
+    unsigned long jnlast;
+    unsigned long journaled;
+    unsigned long replayed;
+    unsigned long evicted;
+};
+
+class eseyeNoJournal
+{
+protected:
+    void jnreset(void) {}
+    void jnattach(eseyeJournalStore *, unsigned long) {}
+    boolean jnkeep(uint8_t, const uint8_t *, uint16_t) { return false; }
+    boolean jnwrite(uint8_t, uint16_t, _pubwriter, void *) { return false; }
+    boolean jnhead(uint8_t *, uint16_t *) { return false; }
+    unsigned long jnwait(unsigned long) { return ESEYE_NO_DEADLINE; }
+    void jnsent(uint8_t) {}
+    boolean jndone(uint8_t, boolean) { return false; }
+    void jndiscard(void) {}
+    void jncounts(struct eseyeJournalCounts *counts) { memset(counts, 0, sizeof(*counts)); }
+    void *jnctx(void) { return NULL; }
+    static void jnreplay(Print *, uint16_t, void *) {}
+};
+
+/* Operations which can be given a completion callback */
+#define ESEYE_OP_SUBSCRIBE   1
+#define ESEYE_OP_UNSUBSCRIBE 2
+#define ESEYE_OP_PUBREG      3
+#define ESEYE_OP_PUBUNREG    4
+#define ESEYE_OP_PUBLISH     5
+
+/* Completion results other than 0 (done), ESEYE_CMD_ERROR (the command was
+ * refused) and the modem's own error codes - no answer in time, SEND FAIL,
+ * given up on by the library (the topic went before the publish was sent,
+ * the subscription before its topic opened, or the answer may have been
+ * lost in a receive overrun) and the modem restarting. A publish which fails into the journal
+ * completes with ESEYE_JOURNALED */
+#define ESEYE_TIMEDOUT  -100
+#define ESEYE_SENDFAIL  -101
+#define ESEYE_DROPPED   -102
+#define ESEYE_RESTARTED -103
+
+/* An operation waiting for its result - key is the handle its call returned
+ * (subscription index, publish index or publish id) */
+struct eseyeop{
+  _donecb done;
+  void *ctx;
+  uint8_t op;
+  uint8_t key;
+  /* ESEYE_OP_PENDING until the result is known */
+  int8_t result;
+};
+
+#define ESEYE_OP_PENDING 127
+
+/* Completion callbacks - an operation which was accepted settles exactly
+ * once, with the first result for it, and its callback is run from the end
+ * of poll() so it can call the library again. Absent if there are none */
+template<uint8_t N>
+class eseyeOps
+{
+protected:
+    void opreset(void) {
+      uint8_t i;
+      for(i = 0; i < N; i++)
+        this->ops[i].op = 0;
+    }
+    boolean opfree(void) { return this->opfind(0, 0, false) != NULL; }
+    /* Wait for the result of op on key, or report result if it is already known */
+    void opadd(uint8_t op, uint8_t key, int8_t result, _donecb done, void *ctx) {
+      struct eseyeop *o = this->opfind(0, 0, false);
+      if(done == NULL || o == NULL)
+        return;
+      o->done = done;
+      o->ctx = ctx;
+      o->op = op;
+      o->key = key;
+      o->result = result;
+    }
+    /* The result of op on key has arrived */
+    void opsettle(uint8_t op, uint8_t key, int8_t result) {
+      struct eseyeop *o;
+      while((o = this->opfind(op, key, true)) != NULL)
+        o->result = result;
+    }
+    /* Any results waiting to be reported */
+    boolean opready(void) {
+      uint8_t i;
+      for(i = 0; i < N; i++){
+        if(this->ops[i].op != 0 && this->ops[i].result != ESEYE_OP_PENDING)
+          return true;
+      }
+      return false;
+    }
+    /* Report settled operations - each is freed before its callback runs */
+    void opdeliver(void) {
+      struct eseyeop o;
+      uint8_t i;
+      for(i = 0; i < N; i++){
+        if(this->ops[i].op == 0 || this->ops[i].result == ESEYE_OP_PENDING)
+          continue;
+        o = this->ops[i];
+        this->ops[i].op = 0;
+        o.done(o.op, o.key, o.result, o.ctx);
+      }
+    }
+private:
+    /* A free entry (op 0), or one waiting for op on key */
+    struct eseyeop *opfind(uint8_t op, uint8_t key, boolean pending) {
+      uint8_t i;
+      for(i = 0; i < N; i++){
+        if(this->ops[i].op == op && (op == 0 || (this->ops[i].key == key && (pending == false || this->ops[i].result == ESEYE_OP_PENDING))))
+          return &this->ops[i];
+      }
+      return NULL;
+    }
+    struct eseyeop ops[N];
+};
+
+template<>
+class eseyeOps<0>
+{
+protected:
+    void opreset(void) {}
+    boolean opfree(void) { return false; }
+    void opadd(uint8_t, uint8_t, int8_t, _donecb, void *) {}
+    void opsettle(uint8_t, uint8_t, int8_t) {}
+    boolean opready(void) { return false; }
+    void opdeliver(void) {}
+};
+
+/* sendAT() priorities - a command is sent ahead of queued commands with a
+ * lower one. The library's topic commands are ESEYE_PRIO_CONTROL and its
+ * publishes ESEYE_PRIO_PUBLISH */
+#define ESEYE_PRIO_HOUSEKEEPING 0
+#define ESEYE_PRIO_CONTROL      1
+#define ESEYE_PRIO_PUBLISH      2
+
+/* Response callback results other than 0 (OK) */
+#define ESEYE_CMD_LINE   1
+#define ESEYE_CMD_ERROR  -1
+
+/* A scheduled command - len is how many of its bytes are still staged, slot
+ * is the topic or publish queue slot a library command is for (0xff for
+ * sendAT() commands) */
+struct eseyecmd{
+  _atrespcb cb;
+  void *ctx;
+  uint8_t len;
+  uint8_t slot;
+  uint8_t prio ESEYE_BITS(2);
+};
+
+/* Command scheduling - commands are kept in the order they will be (or
+ * were) sent. The first cqsent have been started and are waiting for their
+ * final result, which the modem gives in order, so each OK/ERROR answers the
+ * first of them. At most WINDOW are started at once */
+template<uint8_t QLEN, uint8_t WINDOW>
+class eseyeCmdQueue
+{
+public:
+    static const bool enabled = true;
+protected:
+    void cqreset(void) {
+      this->cqcount = 0;
+      this->cqsent = 0;
+    }
+    boolean cqroom(void) { return this->cqcount < QLEN; }
+    /* A command of len bytes has been staged after the others - it is
+     * queued behind those of its priority or higher which haven't started.
+     * Returns how many staged bytes it goes ahead of */
+    uint8_t cqadd(uint8_t len, uint8_t prio, uint8_t slot, _atrespcb cb, void *ctx) {
+      uint8_t i = this->cqcount, behind = 0;
+      while(i > this->cqsent && this->cq[i - 1].prio < prio){
+        behind += this->cq[i - 1].len;
+        this->cq[i] = this->cq[i - 1];
+        i--;
+      }
+      this->cqset(i, len, prio, slot, cb, ctx);
+      this->cqcount++;
+      return behind;
+    }
+    /* A command written straight to the uart with nothing staged - it
+     * started regardless of the window. Returns true if it is the oldest */
+    boolean cqdirect(uint8_t slot, _atrespcb cb, void *ctx) {
+      this->cqset(this->cqcount++, 0, 0, slot, cb, ctx);
+      this->cqsent = this->cqcount;
+      return this->cqsent == 1;
+    }
+    /* How many of n staged bytes the window lets be written */
+    uint16_t cqallow(uint16_t n) {
+      uint16_t allow = this->cqsent > 0 ? this->cq[this->cqsent - 1].len : 0;
+      uint8_t i;
+      for(i = this->cqsent; i < this->cqcount && i < WINDOW; i++)
+        allow += this->cq[i].len;
+      return n < allow ? n : allow;
+    }
+    /* n staged bytes were written - returns true if the oldest command
+     * started with them */
+    boolean cqwrote(uint16_t n) {
+      boolean first = false;
+      uint8_t take;
+      if(this->cqsent > 0){
+        take = n < this->cq[this->cqsent - 1].len ? n : this->cq[this->cqsent - 1].len;
+        this->cq[this->cqsent - 1].len -= take;
+        n -= take;
+      }
+      while(n > 0 && this->cqsent < this->cqcount){
+        if(this->cqsent == 0)
+          first = true;
+        take = n < this->cq[this->cqsent].len ? n : this->cq[this->cqsent].len;
+        this->cq[this->cqsent++].len -= take;
+        n -= take;
+      }
+      return first;
+    }
+    /* A final result line - returns false if it is for a sendAT() command
+     * without a response callback (or no command at all). slot is set to
+     * the slot of the library command it answered, if it was one */
+    boolean cqresult(char *line, int8_t result, uint8_t *slot) {
+      struct eseyecmd c;
+      *slot = 0xff;
+      if(this->cqsent == 0 || this->cq[0].len > 0)
+        return false;
+      c = this->cqpop();
+      *slot = c.slot;
+      if(c.cb != NULL)
+        c.cb(line, result, c.ctx);
+      return c.slot != 0xff || c.cb != NULL;
+    }
+    /* A line of the reply to the oldest command - returns true if its
+     * response callback took it */
+    boolean cqline(char *line) {
+      if(this->cqsent == 0 || this->cq[0].len > 0 || this->cq[0].cb == NULL)
+        return false;
+      this->cq[0].cb(line, ESEYE_CMD_LINE, this->cq[0].ctx);
+      return true;
+    }
+    /* The reply coming in belongs to the library or a response callback */
+    boolean cqowed(void) { return this->cqsent > 0 && (this->cq[0].slot != 0xff || this->cq[0].cb != NULL); }
+    boolean cqbusy(void) { return this->cqsent > 0; }
+    /* How many commands have been written in full and are waiting for
+     * their result (only the newest started one can still be going out) */
+    uint8_t cqwaiting(void) {
+      if(this->cqsent > 0 && this->cq[this->cqsent - 1].len > 0)
+        return this->cqsent - 1;
+      return this->cqsent;
+    }
+    /* A command for slot is still queued or waiting for its result */
+    boolean cqholds(uint8_t slot) {
+      uint8_t i;
+      for(i = 0; i < this->cqcount; i++){
+        if(this->cq[i].slot == slot)
+          return true;
+      }
+      return false;
+    }
+    /* Give up on the oldest command - returns its slot if it was a
+     * library command */
+    uint8_t cqexpire(int8_t result) {
+      struct eseyecmd c;
+      if(this->cqsent == 0)
+        return 0xff;
+      c = this->cqpop();
+      if(c.cb != NULL)
+        c.cb(NULL, result, c.ctx);
+      return c.slot;
+    }
+    /* The modem restarted - nothing it was sent will be answered (one still
+     * being written carries on) */
+    void cqrestart(void) {
+      while(this->cqsent > 0 && this->cq[0].len == 0)
+        this->cqexpire(ESEYE_RESTARTED);
+    }
+private:
+    struct eseyecmd cq[QLEN];
+    uint8_t cqcount;
+    uint8_t cqsent;
+    void cqset(uint8_t i, uint8_t len, uint8_t prio, uint8_t slot, _atrespcb cb, void *ctx) {
+      this->cq[i].cb = cb;
+      this->cq[i].ctx = ctx;
+      this->cq[i].len = len;
+      this->cq[i].slot = slot;
+      this->cq[i].prio = prio;
+    }
+    struct eseyecmd cqpop(void) {
+      struct eseyecmd c = this->cq[0];
+      this->cqcount--;
+      this->cqsent--;
+      memmove(&this->cq[0], &this->cq[1], this->cqcount * sizeof(this->cq[0]));
+      return c;
+    }
+};
+
+typedef eseyeCmdQueue<CMD_QUEUE_LEN, CMD_WINDOW> eseyeFilterOK;
+
+/* No scheduling - commands are streamed as they come and every result goes
+ * to the AT command callback */
+class eseyeNoFilterOK
+{
+public:
+    static const bool enabled = false;
+protected:
+    void cqreset(void) {}
+    boolean cqroom(void) { return true; }
+    uint8_t cqadd(uint8_t, uint8_t, uint8_t, _atrespcb, void *) { return 0; }
+    boolean cqdirect(uint8_t, _atrespcb, void *) { return false; }
+    uint16_t cqallow(uint16_t n) { return n; }
+    boolean cqwrote(uint16_t) { return false; }
+    boolean cqresult(char *, int8_t, uint8_t *slot) {
+      *slot = 0xff;
+      return false;
+    }
+    boolean cqline(char *) { return false; }
+    boolean cqowed(void) { return false; }
+    boolean cqbusy(void) { return false; }
+    uint8_t cqwaiting(void) { return 0; }
+    boolean cqholds(uint8_t) { return false; }
+    uint8_t cqexpire(int8_t) { return 0xff; }
+    void cqrestart(void) {}
+};
+
+/* Library configuration - the defaults come from the options above
+ * Derive from eseyeAWSDefaults and override members, or use eseyeAWSConfig,
+ * to size an instance without editing this file */
+struct eseyeAWSDefaults
+{
+    static const uint8_t maxSubTopics = MAX_SUB_TOPICS;
+    static const uint8_t maxPubTopics = MAX_PUB_TOPICS;
+    static const uint16_t txBufSize = MODEM_TX_BUFSIZE;
+    static const uint8_t rxBufSize = MODEM_RX_BUFSIZE;
+    static const uint8_t rxChunkSize = RX_CHUNK_SIZE;
+    static const uint8_t pubQueueLen = PUB_QUEUE_LEN;
+    static const uint8_t cmdBufSize = CMD_BUFSIZE;
+    static const uint8_t topicPoolSize = TOPIC_POOL_SIZE;
+    static const uint8_t sharedSubHandlers = SUB_SHARED_HANDLERS;
+    static const uint8_t pubBatches = MODEM_TX_BUFSIZE >= PUB_BATCH_SIZE ? PUB_BATCHES : 0;
+    static const uint8_t pubBatchSize = PUB_BATCH_SIZE;
+    static const uint8_t pendingOps = PENDING_OPS;
+#ifdef FILTER_OK
+    typedef eseyeFilterOK okPolicy;
+#else
+    typedef eseyeNoFilterOK okPolicy;
+#endif
 #ifdef TIMEOUT_RESPONSES
-  /* Include a senttime for each pub to enable timeout */
-  unsigned long senttime;
+    typedef eseyeTimeouts<PUB_TIMEOUT, SUB_TIMEOUT, CMD_TIMEOUT> timeoutPolicy;
+#else
+    typedef eseyeNoTimeouts timeoutPolicy;
+#endif
+#ifdef AUTO_RECOVER
+    typedef eseyeRecovery<RECOVER_MIN_MS, RECOVER_MAX_MS> recoveryPolicy;
+#else
+    typedef eseyeNoRecovery recoveryPolicy;
+#endif
+#ifdef DEBUG_ESEYEAWS
+    typedef eseyeTrace tracePolicy;
+#else
+    typedef eseyeNoTrace tracePolicy;
+#endif
+#ifdef LINK_METRICS
+    typedef eseyeMetrics metricsPolicy;
+#else
+    typedef eseyeNoMetrics metricsPolicy;
+#endif
+#ifdef UART_CAPTURE
+    typedef eseyeCapture capturePolicy;
+#else
+    typedef eseyeNoCapture capturePolicy;
+#endif
+#ifdef PUB_JOURNAL
+    typedef eseyeJournal journalPolicy;
+#else
+    typedef eseyeNoJournal journalPolicy;
+#endif
+};
+
+/* e.g. a battery node with one sub topic and no txbuf, OK filtering, trace or topic pool:
+ *   eseyeAWSBasic<eseyeAWSConfig<1, 2, 0, 32, eseyeNoFilterOK, eseyeNoTimeouts, eseyeNoTrace, 0> > aws(&ATSerial);
+ * There must be at least one of each kind of topic. The other settings and
+ * policies (pubBatches, pendingOps, journalPolicy, recoveryPolicy, metrics
+ * and capture...) are set by deriving a struct from eseyeAWSDefaults, as
+ * extras/host/hostconfig.h does */
+template<uint8_t SUBS = MAX_SUB_TOPICS, uint8_t PUBS = MAX_PUB_TOPICS,
+         uint16_t TXBUF = MODEM_TX_BUFSIZE, uint8_t RXBUF = MODEM_RX_BUFSIZE,
+         class OKP = eseyeAWSDefaults::okPolicy,
+         class TOP = eseyeAWSDefaults::timeoutPolicy,
+         class TRP = eseyeAWSDefaults::tracePolicy,
+         uint8_t POOL = TOPIC_POOL_SIZE>
+struct eseyeAWSConfig : eseyeAWSDefaults
+{
+    static const uint8_t maxSubTopics = SUBS;
+    static const uint8_t maxPubTopics = PUBS;
+    static const uint16_t txBufSize = TXBUF;
+    static const uint8_t rxBufSize = RXBUF;
+    static const uint8_t topicPoolSize = POOL;
+    /* Batches are sent through txbuf so only keep them if it can carry one */
+    static const uint8_t pubBatches = TXBUF >= PUB_BATCH_SIZE ? PUB_BATCHES : 0;
+    typedef OKP okPolicy;
+    typedef TOP timeoutPolicy;
+    typedef TRP tracePolicy;
+};
+
+/* Copied publish payload buffer - absent if txBufSize is 0 */
+template<uint16_t N>
+class eseyeTxBuf
+{
+protected:
+    uint8_t *txdata(void) { return this->txbuf; }
+private:
+    uint8_t txbuf[N];
+};
+
+template<>
+class eseyeTxBuf<0>
+{
+protected:
+    uint8_t *txdata(void) { return NULL; }
+};
+
+/* Topic names of the sub and pub slots packed into a pool - each name is
+ * NUL terminated so it can be sent again. Names which don't fit are simply
+ * not kept (that slot can't be shared). Absent if the pool size is 0 */
+template<uint8_t SIZE, uint8_t N>
+class eseyeTopicPool
+{
+protected:
+    void tpreset(void) {
+      this->tpused = 0;
+      memset(this->tplen, 0, sizeof(this->tplen));
+    }
+    /* Is slot named topic */
+    boolean tpis(uint8_t slot, const char *topic) {
+      return this->tplen[slot] > 0 && strcmp((const char *)&this->tppool[this->tpoff[slot]], topic) == 0;
+    }
+    void tpset(uint8_t slot, const char *topic) {
+      size_t len = strlen(topic);
+      this->tpfree(slot);
+      if(len == 0 || len + 1 > (size_t)(SIZE - this->tpused))
+        return;
+      memcpy(&this->tppool[this->tpused], topic, len + 1);
+      this->tpoff[slot] = this->tpused;
+      this->tplen[slot] = len;
+      this->tpused += len + 1;
+    }
+    /* Release the name of slot and close up the gap it leaves */
+    void tpfree(uint8_t slot) {
+      uint8_t off, size, i;
+      if(this->tplen[slot] == 0)
+        return;
+      off = this->tpoff[slot];
+      size = this->tplen[slot] + 1;
+      memmove(&this->tppool[off], &this->tppool[off + size], this->tpused - off - size);
+      for(i = 0; i < N; i++){
+        if(this->tplen[i] > 0 && this->tpoff[i] > off)
+          this->tpoff[i] -= size;
+      }
+      this->tpused -= size;
+      this->tplen[slot] = 0;
+    }
+    const char *tpname(uint8_t slot) {
+      return this->tplen[slot] > 0 ? (const char *)&this->tppool[this->tpoff[slot]] : NULL;
+    }
+private:
+    uint8_t tppool[SIZE];
+    uint8_t tpoff[N];
+    uint8_t tplen[N];
+    uint8_t tpused;
+};
+
+template<uint8_t N>
+class eseyeTopicPool<0, N>
+{
+protected:
+    void tpreset(void) {}
+    boolean tpis(uint8_t, const char *) { return false; }
+    void tpset(uint8_t, const char *) {}
+    void tpfree(uint8_t) {}
+    const char *tpname(uint8_t) { return NULL; }
+};
+
+/* External interrupt numbers which can wake an instance from sleep (4 or 8) */
+#ifndef ESEYE_WAKE_INTS
+#define ESEYE_WAKE_INTS 8
+#endif
+#if ESEYE_WAKE_INTS != 4 && ESEYE_WAKE_INTS != 8
+#error ESEYE_WAKE_INTS must be 4 or 8
 #endif
+
+#define INVALID_INT	0xFF
+
+#define NO_INT_OCCURRED 0x00
+#define CLICK_INT_OCCURRED  0x01
+#define EXT_INT_OCCURRED  0x02
+
+/* Sleep hardware abstraction - everything sleep() needs from the board goes
+ * through one of these so the schedule can also be run against a simulated
+ * clock. eseyeBoardSleep (watchdog timed power-down on AVR, delay()
+ * elsewhere) is used unless sleephal() selects another */
+class eseyeSleepHal
+{
+public:
+    /* Drive an output pin (the click sleep control) */
+    virtual void pinwrite(uint8_t pin, uint8_t level) = 0;
+    /* External interrupt number of a pin, INVALID_INT if it has none */
+    virtual uint8_t pinint(uint8_t pin) = 0;
+    virtual void intattach(uint8_t intnum, void (*isr)(void), int mode) = 0;
+    virtual void intdetach(uint8_t intnum) = 0;
+    /* Power down for up to ms (0 = until an interrupt), waking early once
+     * *woken is set - returns the ms spent asleep */
+    virtual unsigned long powerdown(unsigned long ms, volatile uint8_t *woken) = 0;
+    /* Move millis() on by ms which passed while its timer was stopped */
+    virtual void clockadvance(unsigned long ms) = 0;
 };
-				
-class eseyeAWS
+
+class eseyeBoardSleepHal : public eseyeSleepHal
 {
 public:
-	eseyeAWS(Stream *uart);
-    void init(_atcb urccallback = NULL, Stream *trcuart = NULL);
+    virtual void pinwrite(uint8_t pin, uint8_t level);
+    virtual uint8_t pinint(uint8_t pin);
+    virtual void intattach(uint8_t intnum, void (*isr)(void), int mode);
+    virtual void intdetach(uint8_t intnum);
+    virtual unsigned long powerdown(unsigned long ms, volatile uint8_t *woken);
+    virtual void clockadvance(unsigned long ms);
+};
+
+extern eseyeBoardSleepHal eseyeBoardSleep;
+
+/* The parts of the library which don't depend on its configuration: the
+ * modem uart and sleep support. Each instance has its own wake state so
+ * several modems can be driven from one host */
+class eseyeAWSCore
+{
+public:
+    eseyeAWSCore(Stream *uart);
+    eseyeAWSCore(eseyeRxRing *ring);
+    /* Pins are Arduino pin numbers - the click sleep pin is driven to
+     * clickSleepPolarity while sleeping and the host is woken when the click
+     * drives hostWakeIntPin to hostWakeIntPolarity (LOW is a level interrupt,
+     * which can wake AVRs from power-down, HIGH a rising edge) */
     void sleepctrl(uint8_t clickSleepPin, int clickSleepPolarity, uint8_t hostWakeIntPin, int hostWakeIntPolarity);
+    /* Use another sleep HAL - call before sleepctrl() */
+    void sleephal(eseyeSleepHal *hal);
+
+    /* RAM used outside of eseyeAWS instances */
+    static size_t staticram(void);
+
+    twakeReason hostSleep(uint8_t clickInt, uint8_t clickIntMode, uint8_t extInt, uint8_t extIntMode, unsigned long sleepMs);
+    /* How long (ms) the last sleep lasted - millis() has been corrected by it */
+    unsigned long lastsleep(void) { return this->sleptms; }
+
+protected:
+    Stream *atuart;
+    /* atuart when it is a receive ring, which reports lost bytes */
+    eseyeRxRing *rxring;
+    eseyeSleepHal *hal;
+
+    uint8_t clkslppin;
+    uint8_t clkslppol;
+    uint8_t hstwkpin;
+    uint8_t hstwkpol;
+    unsigned long sleptms;
+
+    /* Wake interrupt state - set from the interrupt trampolines */
+    volatile uint8_t wokeup;
+    uint8_t clickint;
+    uint8_t extint;
+    static eseyeAWSCore *wakeowner[ESEYE_WAKE_INTS];
+    static void (*const wakeisrs[ESEYE_WAKE_INTS])(void);
+    template<uint8_t N> static void wakeisrN(void);
+    static void wakeisr(uint8_t intnum);
+    void wakeattach(uint8_t intnum, uint8_t mode);
+    void wakedetach(uint8_t intnum);
+
+    bool interruptWakeUp(void);
+    /* Put the click to sleep and sleep on its wake pin (and extPin if >= 0) */
+    twakeReason pinSleep(unsigned long sleepMs, int extPin, int extPolarity);
+
+    /* Result of baudup()'s latest command, for this instance - one it gives
+     * up on is expired from the queue so a late answer can't land here */
+    int8_t baudresult;
+    static void baudreply(char *line, int8_t result, void *ctx);
+};
+
+template<class CFG>
+class eseyeAWSBasic : public eseyeAWSCore,
+                      private CFG::okPolicy,
+                      private CFG::tracePolicy,
+                      private eseyeDeadlines<CFG::timeoutPolicy::enabled, CFG::maxSubTopics + CFG::maxPubTopics + 2>,
+                      private eseyeRetries<CFG::recoveryPolicy::enabled && CFG::topicPoolSize != 0, CFG::maxSubTopics + CFG::maxPubTopics>,
+                      private eseyeTxBuf<CFG::txBufSize>,
+                      private eseyeTopicPool<CFG::topicPoolSize, CFG::maxSubTopics + CFG::maxPubTopics>,
+                      private eseyeBatches<CFG::pubBatches, CFG::pubBatchSize>,
+                      private eseyeOps<CFG::pendingOps>,
+                      private CFG::journalPolicy,
+                      private CFG::metricsPolicy,
+                      private CFG::capturePolicy
+{
+public:
+    typedef CFG config;
+
+	eseyeAWSBasic(Stream *uart);
+    /* Read the modem through a receive ring (see eseyeRxRing) */
+    eseyeAWSBasic(eseyeRxRing *ring);
+    void init(_atcb urccallback = NULL, Stream *trcuart = NULL);
     twakeReason sleep(unsigned long duration_mS, int additionalWakeGpio = -1, int AdditionalWakeGpioPolarity = 0);
 
-    /* Subscribe topic API */
-    int subscribe(char *topic, _msgcb callback);
+    /* Subscribe topic API - each call can be given a completion callback */
+    int subscribe(char *topic, _msgcb callback, _donecb done = NULL, void *donectx = NULL);
+    int subscribestream(char *topic, _msgchunkcb callback, _donecb done = NULL, void *donectx = NULL);
     tsubTopicState substate(int idx);
-    int unsubscribe(int idx);
+    int unsubscribe(int idx, _donecb done = NULL, void *donectx = NULL);
 
     /* Publish topic API */
-    int pubreg(char *topic);
+    int pubreg(char *topic, _donecb done = NULL, void *donectx = NULL);
     tpubTopicState pubstate(int idx);
-    int pubunreg(int idx);
+    int pubunreg(int idx, _donecb done = NULL, void *donectx = NULL);
 	
     /* Publish API */
-    int publish(int tpcidx, uint8_t *data, uint8_t datalen);
+    int publish(int tpcidx, uint8_t *data, uint8_t datalen, _donecb done = NULL, void *donectx = NULL);
+    int publishref(int tpcidx, const uint8_t *data, uint16_t datalen, _donecb done = NULL, void *donectx = NULL);
+    int publishwriter(int tpcidx, uint16_t datalen, _pubwriter writer, void *ctx = NULL, _donecb done = NULL, void *donectx = NULL);
     boolean pubdone(void);
+    uint8_t pubqueued(void);
+    void pubcallback(_pubcb callback);
+
+    /* Publish batching API */
+    int pubbatch(int tpcidx, unsigned long maxdelayms, uint8_t maxbytes = 0, uint8_t separator = '\n');
+    int pubunbatch(int tpcidx);
+    int pubappend(int tpcidx, const uint8_t *data, uint8_t datalen);
+    int pubflush(int tpcidx);
+
+    /* Publish journal API - call journal() after init() */
+    void journal(eseyeJournalStore *store, unsigned long replayms = 1000);
+    void journalcounts(struct eseyeJournalCounts *counts);
 	
-    /* Polling loop */
-    void poll(void);
+    /* Polling loop - handles at most budget received bytes (0 = all available) */
+    void poll(uint16_t budget = 0);
+    /* Nothing is left to send or receive, so the host can power down */
+    boolean sleepready(void);
+    /* Handle a block of bytes received from the modem - for transports which
+     * can hand over everything they have at once instead of poll() reading it */
+    void ingest(const uint8_t *data, uint16_t len);
 
-    /* Send AT command */
-    void sendAT(char *atcmd);
+    /* Time (ms) until the next response timeout, ESEYE_NO_DEADLINE if none */
+    unsigned long nextDeadline(void);
 
-    twakeReason hostSleep(uint8_t clickInt, uint8_t clickIntMode, uint8_t extInt, uint8_t extIntMode, unsigned long sleepMs);
+    /* Topic recovery API */
+    void modemrestarted(void);
+    boolean recovering(void);
+    unsigned long recoverytime(void);
+
+    /* Send AT command - response (if given) gets its reply */
+    int sendAT(char *atcmd, _atrespcb response = NULL, void *ctx = NULL, uint8_t prio = ESEYE_PRIO_HOUSEKEEPING);
+    void txnonblocking(boolean enable);
+
+    /* Move the modem link from baud from to baud to with AT+IPR - call after
+     * init() (needs FILTER_OK). Returns the rate in use */
+    unsigned long baudup(unsigned long from, unsigned long to, _baudcb setbaud, void *ctx = NULL);
+
+    /* Link metrics - copy them out, optionally starting the counts again */
+    void metrics(struct eseyeMetricCounts *counts, boolean reset = false);
+
+    /* UART capture - record modem traffic to sink (NULL stops), call after init() */
+    void capture(eseyeCaptureSink *sink);
+
+    /* RAM used by this instance */
+    size_t instanceram(void);
 
 private:
+#ifdef ESEYEAWS_LOWRAM
+    static_assert(CFG::pubQueueLen <= 7 && CFG::maxPubTopics <= 15,
+                  "ESEYEAWS_LOWRAM packs the publish queue into 3 bits and topic indices into 4 bits");
+#endif
+    static_assert(CFG::maxSubTopics > 0 && CFG::maxPubTopics > 0, "there must be at least one sub and one pub topic");
+    static_assert(CFG::pubQueueLen > 0, "the publish queue needs at least one entry");
+    static_assert(CFG::pubBatches == 0 || CFG::pubBatchSize <= CFG::txBufSize,
+                  "publish batches are sent through txbuf so it must hold a whole batch");
+
+    /* Slots in the deadline and topic name tables */
+    enum {
+      SLOT_SUB = 0,
+      SLOT_PUB = CFG::maxSubTopics,
+      SLOT_PUBQ = CFG::maxSubTopics + CFG::maxPubTopics,
+      SLOT_CMD = SLOT_PUBQ + 1
+    };
+    /* Subscriptions - one per slot plus those that can share */
+    enum {
+      SUB_HANDLERS = CFG::maxSubTopics + CFG::sharedSubHandlers
+    };
+
     /* Callback function for unhandled URCs */
     _atcb atcallback;	
+
+    int subopen(char *topic, _msgcb callback, _msgchunkcb chunkcallback, _donecb done, void *donectx);
+    void subsettle(uint8_t slot, uint8_t op, int8_t result);
   
-    struct subtpc subtopics[MAX_SUB_TOPICS];
-    struct pubtpc pubtopics[MAX_PUB_TOPICS];
+    struct subtpc subtopics[CFG::maxSubTopics];
+    struct subhandler subhandlers[SUB_HANDLERS];
+    uint8_t subusers(uint8_t slot);
+    void subclear(uint8_t slot);
+    struct pubtpc pubtopics[CFG::maxPubTopics];
 
-    Stream *atuart;
-    Stream *dbguart;
+    struct pubqentry pubq[CFG::pubQueueLen];
+    uint8_t pubqnextid;
+    uint8_t pubqhead ESEYE_BITS(3);
+    uint8_t pubqcount ESEYE_BITS(3);
+    uint8_t pubqstate ESEYE_BITS(2);
+    _pubcb pubdonecb;
+    uint16_t payloadoff;
+    int txalloc(uint16_t len);
+    struct pubqentry *pubenqueue(int tpcidx, uint16_t datalen);
+    int pubcommit(struct pubqentry *entry, _donecb done, void *donectx);
+    int batchsend(struct pubbatch *b);
+    void batchpoll(void);
+    int journalkeep(int tpcidx, const uint8_t *data, uint16_t datalen, _pubwriter writer, void *ctx, _donecb done, void *donectx);
+    boolean journalready(uint8_t *tpcidx, uint16_t *len);
+    void journalpoll(void);
 
-    #define MODEM_TX_BUFSIZE 128
-    uint8_t txbuf[MODEM_TX_BUFSIZE];
-    uint8_t txbuflen;
+    uint8_t cmdbuf[CFG::cmdBufSize];
+    uint8_t cmdstart;
+    uint8_t cmdend;
+    uint8_t cmdhold;
+    boolean txnonblock;
+    boolean txidle(void);
+    boolean cmdreserve(size_t len);
+    void cmdappend_P(const char *str);
+    void cmdappendnum(uint16_t n);
+    static uint8_t numlen(uint16_t n);
+    void cmdpromote(uint8_t len, uint8_t behind);
+    int awscmd(uint8_t slot, const char *verb, uint8_t idx, const char *topic, int num, uint8_t prio = ESEYE_PRIO_CONTROL);
+    void txpump(void);
+    void cmdsettled(void);
+    void cmdfailed(uint8_t slot, int8_t result);
+    int8_t baudcmd(char *cmd);
+    boolean baudprobe(void);
+    int8_t baudipr(unsigned long baud);
+    void baudswitch(unsigned long baud, _baudcb setbaud, void *ctx);
+    void pubkick(void);
+    void pubcomplete(int8_t result);
 
-    #define MODEM_RX_BUFSIZE 100
-    uint8_t modemrxbuf[MODEM_RX_BUFSIZE];
+    uint8_t modemrxbuf[CFG::rxBufSize + 1];
     unsigned char rxbufidx;
-    unsigned char binaryread;
-    unsigned char buffered;
+    uint16_t binaryread;
+    uint16_t binarytotal;
+    uint16_t binaryoffset;
     uint8_t readingsub;
-#ifdef FILTER_OK
-    uint8_t outstanding_ok;
-    void incOKreq(void);
-#endif
+    void msgdeliver(void);
+    void rxdiscard(void);
+    void rxresync(void);
 
-    uint8_t clkslppin;
-    uint8_t clkslppol;
-    uint8_t hstwkpin;
-    uint8_t hstwkpol;
+    /* Incremental classifier state for the line being received */
+    uint16_t urcmatch;
+    uint8_t urctype ESEYE_BITS(4);
+    uint8_t urcfield ESEYE_BITS(2);
+    uint8_t urcneg ESEYE_BITS(2);
+    boolean urcdigits ESEYE_BITS(1);
+    /* Bytes were lost - skipping to the end of the line or the next URC */
+    boolean rxskip ESEYE_BITS(1);
+    uint16_t urcval[2];
+    void urcreset(void);
+    boolean urcactive(void);
+    void urcbyte(char c, uint8_t pos);
+    void promptreceived(void);
+    boolean urcdispatch(void);
 
-#ifdef TIMEOUT_RESPONSES
     boolean checkTimeout(void);
-#endif
-    bool interruptWakeUp(void);
-    void hwInternalSleep(unsigned long ms);
-
-enum period_t {
-	SLEEP_15MS,
-	SLEEP_30MS,
-	SLEEP_60MS,
-	SLEEP_120MS,
-	SLEEP_250MS,
-	SLEEP_500MS,
-	SLEEP_1S,
-	SLEEP_2S,
-	SLEEP_4S,
-	SLEEP_8S,
-	SLEEP_FOREVER
+    void slotfailed(uint8_t slot, int8_t result);
+    void recoverarm(uint8_t slot);
+    void recoverpoll(void);
 };
 
-    void hwPowerDown(period_t period);
+#include "eseyeaws_impl.h"
 
-};
-#endif // ESEYEAWS_H
+/* The default configuration */
+typedef eseyeAWSBasic<eseyeAWSDefaults> eseyeAWS;
 
+#endif // ESEYEAWS_H
@@ -0,0 +1,150 @@
+/***************************************************************************
+  eseyeaws library - uart capture
+
+  Records of the bytes received from and sent to the modem, each behind a
+  header of two varints: the ms since the previous record and the length
+  shifted up over the direction bit
+
+      'E' 'C' <version>
+      <delta><len << 1 | dir><bytes>
+      ...
+
+  so a run of bytes a few ms after the last costs two header bytes. The
+  host replay driver (extras/host/tracereplay.h) reads the same format.
+
+ ***************************************************************************/
+
+#include "eseyeaws.h"
+
+uint8_t eseyeCaptureSink::varint(uint8_t *buf, unsigned long n){
+  uint8_t len = 0;
+  while(n >= 0x80){
+    buf[len++] = (n & 0x7f) | 0x80;
+    n >>= 7;
+  }
+  buf[len++] = n;
+  return len;
+}
+
+uint8_t eseyeCaptureSink::head(uint8_t *hdr, uint8_t dir, unsigned long ms, uint16_t len){
+  uint8_t n = varint(hdr, ms - this->lastms);
+  this->lastms = ms;
+  return n + varint(&hdr[n], ((unsigned long)len << 1) | dir);
+}
+
+void eseyeCaptureSink::start(Print *out){
+  uint8_t magic[3] = { 'E', 'C', ESEYE_CAPTURE_VERSION };
+  out->write(magic, sizeof(magic));
+}
+
+void eseyeCapturePrint::record(uint8_t dir, unsigned long ms, const uint8_t *data, uint16_t len){
+  uint8_t hdr[ESEYE_CAPTURE_HDRMAX];
+  if(this->started == false){
+    start(this->out);
+    this->started = true;
+  }
+  this->out->write(hdr, this->head(hdr, dir, ms, len));
+  this->out->write(data, len);
+}
+
+eseyeCaptureRing::eseyeCaptureRing(uint8_t *buf, uint16_t size) : buf(buf), size(size){
+  this->clear();
+}
+
+void eseyeCaptureRing::clear(void){
+  this->first = 0;
+  this->used = 0;
+  this->held = 0;
+  this->basems = 0;
+  this->drops = 0;
+  this->lastms = 0;
+}
+
+/* Append at the end of the ring - the room has been made */
+void eseyeCaptureRing::put(const uint8_t *data, uint16_t len){
+  uint16_t off = (this->first + this->used) % this->size;
+  uint16_t n;
+  this->used += len;
+  while(len > 0){
+    n = this->size - off;
+    if(n > len)
+      n = len;
+    memcpy(&this->buf[off], data, n);
+    data += n;
+    len -= n;
+    off = 0;
+  }
+}
+
+unsigned long eseyeCaptureRing::getvarint(uint16_t *off){
+  unsigned long n = 0;
+  uint8_t shift = 0;
+  uint8_t b;
+  do{
+    b = this->buf[*off];
+    *off = (*off + 1) % this->size;
+    n |= (unsigned long)(b & 0x7f) << shift;
+    shift += 7;
+  }while(b & 0x80);
+  return n;
+}
+
+/* Remove the oldest record, moving the base time up to it */
+void eseyeCaptureRing::drop(void){
+  uint16_t off = this->first;
+  uint16_t len;
+  this->basems += this->getvarint(&off);
+  len = this->getvarint(&off) >> 1;
+  off = (off + len) % this->size;
+  this->used -= (off + this->size - this->first) % this->size;
+  if(this->used == 0)
+    off = 0;
+  this->first = off;
+  this->held--;
+  this->drops++;
+}
+
+void eseyeCaptureRing::record(uint8_t dir, unsigned long ms, const uint8_t *data, uint16_t len){
+  uint8_t hdr[ESEYE_CAPTURE_HDRMAX];
+  uint8_t n;
+  if(this->size <= ESEYE_CAPTURE_HDRMAX)
+    return;
+  if(len > this->size - ESEYE_CAPTURE_HDRMAX){
+    data += len - (this->size - ESEYE_CAPTURE_HDRMAX);
+    len = this->size - ESEYE_CAPTURE_HDRMAX;
+    this->drops++;
+  }
+  n = this->head(hdr, dir, ms, len);
+  while(this->size - this->used < n + len)
+    this->drop();
+  this->put(hdr, n);
+  this->put(data, len);
+  this->held++;
+}
+
+/* The oldest record's delta is rewritten against the base time so the dump
+ * reads as a capture which started with it */
+void eseyeCaptureRing::dump(Print *out){
+  uint8_t hdr[ESEYE_CAPTURE_HDRMAX];
+  uint16_t off = this->first;
+  uint16_t left = this->used;
+  uint16_t n;
+  unsigned long delta, lendir;
+  start(out);
+  if(this->held == 0)
+    return;
+  delta = this->basems + this->getvarint(&off);
+  lendir = this->getvarint(&off);
+  n = varint(hdr, delta);
+  n += varint(&hdr[n], lendir);
+  out->write(hdr, n);
+  left -= (off + this->size - this->first) % this->size;
+  while(left > 0){
+    n = this->size - off;
+    if(n > left)
+      n = left;
+    out->write(&this->buf[off], n);
+    left -= n;
+    off = (off + n) % this->size;
+  }
+}
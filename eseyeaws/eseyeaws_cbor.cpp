@@ -0,0 +1,409 @@
+/***************************************************************************
+  eseyeaws library - compact CBOR payloads
+
+  Encoder and in-place decoder for the subset of CBOR (RFC 8949) used for
+  sensor reports: definite length maps, arrays and strings, integers up
+  to the width of long, floats and true/false/null.
+
+ ***************************************************************************/
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#endif
+#include <limits.h>
+
+#include "eseyeaws_cbor.h"
+
+/* Initial bytes of the fixed width floats */
+#define CBOR_HALF   0xf9
+#define CBOR_SINGLE 0xfa
+#define CBOR_DOUBLE 0xfb
+
+static uint32_t floatbits(float f){
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+static float bitsfloat(uint32_t bits){
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+/* The half precision float equal to a float - false if it can't be exact */
+static bool tohalf(uint32_t bits, uint16_t *half){
+  uint16_t sign = (bits >> 16) & 0x8000;
+  int16_t exp = (bits >> 23) & 0xff;
+  uint32_t man = bits & 0x7fffff;
+  uint8_t shift;
+  if(exp == 0xff){
+    /* Infinity or NaN */
+    *half = sign | 0x7c00 | (man != 0 ? 0x200 : 0);
+    return true;
+  }
+  if(exp == 0 && man == 0){
+    *half = sign;
+    return true;
+  }
+  exp -= 127;
+  if(exp >= -14 && exp <= 15){
+    if((man & 0x1fff) != 0)
+      return false;
+    *half = sign | ((exp + 15) << 10) | (man >> 13);
+    return true;
+  }
+  if(exp >= -24 && exp < -14){
+    /* Subnormal half */
+    man |= 0x800000;
+    shift = -1 - exp;
+    if((man & ((1UL << shift) - 1)) != 0)
+      return false;
+    *half = sign | (man >> shift);
+    return true;
+  }
+  return false;
+}
+
+static float fromhalf(uint16_t half){
+  uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+  int16_t exp = (half >> 10) & 0x1f;
+  uint32_t man = half & 0x3ff;
+  if(exp == 0x1f)
+    return bitsfloat(sign | 0x7f800000UL | (man << 13));
+  if(exp == 0){
+    if(man == 0)
+      return bitsfloat(sign);
+    /* Subnormal - normalise it */
+    exp = 1;
+    while((man & 0x400) == 0){
+      man <<= 1;
+      exp--;
+    }
+    man &= 0x3ff;
+  }
+  return bitsfloat(sign | ((uint32_t)(exp - 15 + 127) << 23) | (man << 13));
+}
+
+/* Narrow a double (AVR has no 64 bit floats) - the mantissa is truncated,
+ * values beyond float range become infinity and tiny ones 0 */
+static float fromdouble(uint32_t hi, uint32_t lo){
+  uint32_t sign = hi & 0x80000000UL;
+  int16_t exp = (hi >> 20) & 0x7ff;
+  uint32_t man = ((hi & 0xfffff) << 3) | (lo >> 29);
+  if(exp == 0x7ff)
+    return bitsfloat(sign | 0x7f800000UL | (man != 0 || lo != 0 ? 0x400000UL : 0));
+  exp = exp - 1023 + 127;
+  if(exp >= 0xff)
+    return bitsfloat(sign | 0x7f800000UL);
+  if(exp <= 0)
+    return bitsfloat(sign);
+  return bitsfloat(sign | ((uint32_t)exp << 23) | man);
+}
+
+/* Encoder */
+
+void eseyeCBOR::put(const uint8_t *data, uint16_t n){
+  this->len += n;
+  if(this->out != NULL)
+    this->out->write(data, n);
+}
+
+/* Item head with its argument in the fewest bytes */
+void eseyeCBOR::head(uint8_t major, unsigned long arg){
+  uint8_t buf[9];
+  uint8_t n, i;
+  if(arg < 24){
+    buf[0] = (major << 5) | arg;
+    this->put(buf, 1);
+    return;
+  }
+  if(arg <= 0xff)
+    n = 1;
+  else if(arg <= 0xffff)
+    n = 2;
+  else if(((arg >> 16) >> 16) == 0)
+    n = 4;
+  else
+    n = 8;
+  buf[0] = (major << 5) | (n == 1 ? 24 : n == 2 ? 25 : n == 4 ? 26 : 27);
+  for(i = n; i > 0; i--){
+    buf[i] = arg & 0xff;
+    arg >>= 8;
+  }
+  this->put(buf, n + 1);
+}
+
+void eseyeCBOR::simple(uint8_t val){
+  this->head(CBOR_SIMPLE, val);
+}
+
+void eseyeCBOR::map(uint16_t pairs){
+  this->head(CBOR_MAP, pairs);
+}
+
+void eseyeCBOR::array(uint16_t items){
+  this->head(CBOR_ARRAY, items);
+}
+
+void eseyeCBOR::text(const char *str){
+  this->text(str, strlen(str));
+}
+
+void eseyeCBOR::text(const char *str, uint16_t length){
+  this->head(CBOR_TEXT, length);
+  this->put((const uint8_t *)str, length);
+}
+
+/* Flash strings are copied out a few bytes at a time */
+void eseyeCBOR::text(const __FlashStringHelper *str){
+  const char *p = (const char *)str;
+  uint16_t length = strlen_P(p);
+  uint8_t buf[16];
+  uint8_t n;
+  this->head(CBOR_TEXT, length);
+  while(length > 0){
+    n = length < sizeof(buf) ? length : sizeof(buf);
+    memcpy_P(buf, p, n);
+    this->put(buf, n);
+    p += n;
+    length -= n;
+  }
+}
+
+void eseyeCBOR::bytes(const uint8_t *data, uint16_t length){
+  this->head(CBOR_BYTES, length);
+  this->put(data, length);
+}
+
+void eseyeCBOR::number(long n){
+  if(n < 0)
+    this->head(CBOR_NEGINT, (unsigned long)(-(n + 1)));
+  else
+    this->head(CBOR_UINT, n);
+}
+
+void eseyeCBOR::number(unsigned long n){
+  this->head(CBOR_UINT, n);
+}
+
+/* Half precision if that holds it exactly, otherwise single */
+void eseyeCBOR::number(float f){
+  uint32_t bits = floatbits(f);
+  uint16_t half;
+  uint8_t buf[5];
+  if(tohalf(bits, &half)){
+    buf[0] = CBOR_HALF;
+    buf[1] = half >> 8;
+    buf[2] = half & 0xff;
+    this->put(buf, 3);
+    return;
+  }
+  buf[0] = CBOR_SINGLE;
+  buf[1] = bits >> 24;
+  buf[2] = (bits >> 16) & 0xff;
+  buf[3] = (bits >> 8) & 0xff;
+  buf[4] = bits & 0xff;
+  this->put(buf, 5);
+}
+
+/* Decoder */
+
+uint8_t eseyeCBORReader::peek(void){
+  if(this->failed || this->data >= this->end)
+    return CBOR_END;
+  return *this->data >> 5;
+}
+
+/* Read an item head - arguments wider than long are an error, as are
+ * indefinite lengths */
+bool eseyeCBORReader::head(uint8_t *major, unsigned long *arg){
+  uint8_t ai, n, i;
+  if(this->failed || this->data >= this->end)
+    return this->fail();
+  *major = *this->data >> 5;
+  ai = *this->data & 0x1f;
+  this->data++;
+  if(ai < 24){
+    *arg = ai;
+    return true;
+  }
+  if(ai > 27)
+    return this->fail();
+  n = 1 << (ai - 24);
+  if(this->end - this->data < n)
+    return this->fail();
+  *arg = 0;
+  for(i = 0; i < n; i++){
+    if(n > sizeof(long) && i < n - sizeof(long) && this->data[i] != 0)
+      return this->fail();
+    *arg = (*arg << 8) | this->data[i];
+  }
+  this->data += n;
+  return true;
+}
+
+bool eseyeCBORReader::map(uint16_t *pairs){
+  uint8_t major;
+  unsigned long arg;
+  if(this->head(&major, &arg) == false || major != CBOR_MAP || arg > 0xffff)
+    return this->fail();
+  *pairs = arg;
+  return true;
+}
+
+bool eseyeCBORReader::array(uint16_t *items){
+  uint8_t major;
+  unsigned long arg;
+  if(this->head(&major, &arg) == false || major != CBOR_ARRAY || arg > 0xffff)
+    return this->fail();
+  *items = arg;
+  return true;
+}
+
+bool eseyeCBORReader::bytes(const uint8_t **data, uint16_t *length){
+  uint8_t major;
+  unsigned long arg;
+  if(this->head(&major, &arg) == false || (major != CBOR_BYTES && major != CBOR_TEXT) ||
+     arg > (unsigned long)(this->end - this->data))
+    return this->fail();
+  *data = this->data;
+  *length = arg;
+  this->data += arg;
+  return true;
+}
+
+bool eseyeCBORReader::text(const char **str, uint16_t *length){
+  if(this->peek() != CBOR_TEXT)
+    return this->fail();
+  return this->bytes((const uint8_t **)str, length);
+}
+
+bool eseyeCBORReader::number(unsigned long *n){
+  uint8_t major;
+  unsigned long arg;
+  if(this->head(&major, &arg) == false || major != CBOR_UINT)
+    return this->fail();
+  *n = arg;
+  return true;
+}
+
+bool eseyeCBORReader::number(long *n){
+  uint8_t major;
+  unsigned long arg;
+  if(this->head(&major, &arg) == false || (major != CBOR_UINT && major != CBOR_NEGINT) ||
+     arg > (unsigned long)LONG_MAX)
+    return this->fail();
+  *n = major == CBOR_UINT ? (long)arg : -1 - (long)arg;
+  return true;
+}
+
+bool eseyeCBORReader::number(float *f){
+  const uint8_t *p = this->data;
+  long n;
+  if(this->failed || p >= this->end)
+    return this->fail();
+  if(*p == CBOR_HALF && this->end - p >= 3){
+    *f = fromhalf(((uint16_t)p[1] << 8) | p[2]);
+    this->data += 3;
+  }else if(*p == CBOR_SINGLE && this->end - p >= 5){
+    *f = bitsfloat(((uint32_t)p[1] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 8) | p[4]);
+    this->data += 5;
+  }else if(*p == CBOR_DOUBLE && this->end - p >= 9){
+    *f = fromdouble(((uint32_t)p[1] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 8) | p[4],
+                    ((uint32_t)p[5] << 24) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 8) | p[8]);
+    this->data += 9;
+  }else{
+    if(this->number(&n) == false)
+      return false;
+    *f = n;
+  }
+  return true;
+}
+
+bool eseyeCBORReader::flag(bool *b){
+  uint8_t major;
+  unsigned long arg;
+  if(this->head(&major, &arg) == false || major != CBOR_SIMPLE || (arg != 20 && arg != 21))
+    return this->fail();
+  *b = arg == 21;
+  return true;
+}
+
+bool eseyeCBORReader::null(void){
+  uint8_t major;
+  unsigned long arg;
+  if(this->head(&major, &arg) == false || major != CBOR_SIMPLE || arg != 22)
+    return this->fail();
+  return true;
+}
+
+/* A key that doesn't match is left to be read */
+bool eseyeCBORReader::key(const char *str){
+  const uint8_t *p = this->data;
+  const char *k;
+  uint16_t len;
+  if(this->peek() != CBOR_TEXT || this->text(&k, &len) == false)
+    return false;
+  if(len == strlen(str) && memcmp(k, str, len) == 0)
+    return true;
+  this->data = p;
+  return false;
+}
+
+bool eseyeCBORReader::key(const __FlashStringHelper *str){
+  const uint8_t *p = this->data;
+  const char *k;
+  uint16_t len;
+  if(this->peek() != CBOR_TEXT || this->text(&k, &len) == false)
+    return false;
+  if(len == strlen_P((const char *)str) && strncmp_P(k, (const char *)str, len) == 0)
+    return true;
+  this->data = p;
+  return false;
+}
+
+/* Items inside containers are counted off rather than recursed into.
+ * Integers, floats, simple values and tag numbers are stepped over without
+ * reading their argument, which may not fit a long (a double, or a 64 bit
+ * integer on AVR) */
+bool eseyeCBORReader::skip(void){
+  unsigned long pending = 1;
+  uint8_t major, ai, n;
+  unsigned long arg;
+  while(pending > 0){
+    pending--;
+    if(this->failed || this->data >= this->end)
+      return this->fail();
+    major = *this->data >> 5;
+    if(major == CBOR_UINT || major == CBOR_NEGINT || major == CBOR_TAG || major == CBOR_SIMPLE){
+      ai = *this->data & 0x1f;
+      if(ai > 27)
+        return this->fail();
+      n = ai < 24 ? 0 : 1 << (ai - 24);
+      if(this->end - this->data <= n)
+        return this->fail();
+      this->data += 1 + n;
+      if(major == CBOR_TAG)
+        pending++;
+      continue;
+    }
+    if(this->head(&major, &arg) == false)
+      return false;
+    switch(major){
+      case CBOR_BYTES:
+      case CBOR_TEXT:
+        if(arg > (unsigned long)(this->end - this->data))
+          return this->fail();
+        this->data += arg;
+        break;
+      case CBOR_ARRAY:
+        pending += arg;
+        break;
+      case CBOR_MAP:
+        pending += 2 * arg;
+        break;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,135 @@
+/***************************************************************************
+  eseyeaws library - compact CBOR payloads
+
+  eseyeCBOR encodes maps, arrays, integers, floats and strings (RFC 8949
+  CBOR) straight to a Print - at the '>' prompt that is the modem uart, so
+  a report needs no buffer at all. publishcbor() runs the application's
+  encode function twice: once with no output to size the payload for the
+  PUBLISH=<idx>,<len> command and again at the prompt to write it.
+
+      static void report(eseyeCBOR &cbor, void *ctx){
+        struct reading *r = (struct reading *)ctx;
+        cbor.map(2);
+        cbor.key(F("Humidity")); cbor.number(r->humidity);
+        cbor.key(F("Temp"));     cbor.number(r->temp);
+      }
+      ...
+      publishcbor<report>(&myAWS, pubidx, &latest);
+
+  Floats are sent in the shortest form which holds them exactly (a half
+  precision 21.5 is 3 bytes). eseyeCBORReader walks a received message in
+  place for subscription callbacks.
+
+ ***************************************************************************/
+
+#ifndef ESEYEAWS_CBOR_H__
+#define ESEYEAWS_CBOR_H__
+
+#include "eseyeaws.h"
+
+/* CBOR major types */
+#define CBOR_UINT   0
+#define CBOR_NEGINT 1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+#define CBOR_TAG    6
+#define CBOR_SIMPLE 7
+#define CBOR_END    0xff
+
+/* Encoder - with no output it only counts the bytes it would write */
+class eseyeCBOR
+{
+public:
+    eseyeCBOR(Print *out = NULL) : out(out), len(0) {}
+
+    /* Containers - give the number of items (pairs for a map) to follow */
+    void map(uint16_t pairs);
+    void array(uint16_t items);
+
+    void key(const char *str) { this->text(str); }
+    void key(const __FlashStringHelper *str) { this->text(str); }
+    void text(const char *str);
+    void text(const char *str, uint16_t length);
+    void text(const __FlashStringHelper *str);
+    void bytes(const uint8_t *data, uint16_t length);
+
+    void number(long n);
+    void number(unsigned long n);
+    void number(int n) { this->number((long)n); }
+    void number(unsigned int n) { this->number((unsigned long)n); }
+    void number(float f);
+    void number(double d) { this->number((float)d); }
+    void flag(bool b) { this->simple(b ? 21 : 20); }
+    void null(void) { this->simple(22); }
+
+    /* Bytes written (or that would have been) so far */
+    uint16_t length(void) { return this->len; }
+
+private:
+    void head(uint8_t major, unsigned long arg);
+    void simple(uint8_t val);
+    void put(const uint8_t *data, uint16_t n);
+
+    Print *out;
+    uint16_t len;
+};
+
+/* Decoder - items are read in order from a message held in memory. Any
+ * malformed or unexpected item sets error() and stops the reader */
+class eseyeCBORReader
+{
+public:
+    eseyeCBORReader(const uint8_t *data, uint16_t length) : data(data), end(data + length), failed(false) {}
+
+    /* Major type of the next item, CBOR_END at the end or after an error */
+    uint8_t peek(void);
+    bool error(void) { return this->failed; }
+
+    bool map(uint16_t *pairs);
+    bool array(uint16_t *items);
+    /* Text and byte strings are returned in place (not NUL terminated) */
+    bool text(const char **str, uint16_t *length);
+    bool bytes(const uint8_t **data, uint16_t *length);
+    bool number(long *n);
+    bool number(unsigned long *n);
+    /* Any float width or an integer */
+    bool number(float *f);
+    bool flag(bool *b);
+    bool null(void);
+    /* Consume the next item if it is the text key */
+    bool key(const char *str);
+    bool key(const __FlashStringHelper *str);
+    /* Skip the next item (and everything inside it) */
+    bool skip(void);
+
+private:
+    bool head(uint8_t *major, unsigned long *arg);
+    bool fail(void) { this->failed = true; return false; }
+
+    const uint8_t *data;
+    const uint8_t *end;
+    bool failed;
+};
+
+/* Writer for publishwriter() which encodes at the prompt */
+template<void (*ENCODE)(eseyeCBOR &, void *)>
+void eseyeCBORWriter(Print *out, uint16_t datalen, void *ctx){
+  eseyeCBOR cbor(out);
+  (void)datalen;
+  ENCODE(cbor, ctx);
+}
+
+/* Publish what ENCODE writes - it is run now to size the payload and again
+ * when the modem is ready for it, so it must write the same bytes both times:
+ * keep what ctx points at unchanged until the publish callback. Returns the
+ * publish id or -1 */
+template<void (*ENCODE)(eseyeCBOR &, void *), class AWS>
+int publishcbor(AWS *aws, int tpcidx, void *ctx = NULL){
+  eseyeCBOR count;
+  ENCODE(count, ctx);
+  return aws->publishwriter(tpcidx, count.length(), eseyeCBORWriter<ENCODE>, ctx);
+}
+
+#endif // ESEYEAWS_CBOR_H__
@@ -0,0 +1,1714 @@
+/***************************************************************************
+  eseyeaws library - eseyeAWSBasic implementation
+
+  eseyeAWSBasic is a template on its configuration so its member functions
+  are defined here and compiled into the sketch with the configuration it
+  uses. Only included by eseyeaws.h.
+
+ ***************************************************************************/
+
+#ifndef ESEYEAWS_IMPL_H__
+#define ESEYEAWS_IMPL_H__
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#endif
+
+/* Trace goes through the trace policy, which is empty if tracing is disabled */
+#define UARTDEBUG(x)   this->trcprint(x)
+#define UARTDEBUGLN(x) this->trcprintln(x)
+
+/* All protocol literals live in flash - FLASHSTR() lets them be printed directly */
+#define FLASHSTR(s) ((const __FlashStringHelper *)(s))
+
+/* Flash strings and the URC keyword table (eseyeaws.cpp) */
+extern const char aws_start[] PROGMEM;
+extern const char aws_sub[] PROGMEM;
+extern const char aws_subcl[] PROGMEM;
+extern const char aws_pub[] PROGMEM;
+extern const char aws_pubcl[] PROGMEM;
+extern const char aws_publish[] PROGMEM;
+extern const char crlf_msg[] PROGMEM;
+
+/* The position in urc_keywords is the URC type. Types up to URC_PUBCLOSE
+ * are followed by <idx>,<len|err> fields which are parsed as they arrive */
+#define URC_MSG       0
+#define URC_SUBOPEN   1
+#define URC_SUBCLOSE  2
+#define URC_PUBOPEN   3
+#define URC_PUBCLOSE  4
+#define URC_SENDOK    5
+#define URC_SENDFAIL  6
+#define URC_OK        7
+#define URC_ERROR     8
+#define URC_CRLF      9
+#define URC_RESTART   10
+#define URC_CMEERROR  11
+#define URC_NONE      0x0f
+#define URC_KEYWORDS  ESEYE_URC_TYPES
+#define URC_MATCH_ALL ((1U << URC_KEYWORDS) - 1)
+
+extern const char *const urc_keywords[URC_KEYWORDS] PROGMEM;
+
+/* Subscribe topic API */
+
+#define TOPIC_NOT_SUBSCRIBED 0
+#define TOPIC_SUBSCRIBING    1
+#define TOPIC_SUBSCRIBED     2
+
+/* Subscribe to a topic - returns the subscription index or -1
+ * done (if given) is called from poll() once the topic is open or has failed
+ * to open. Every call which doesn't return -1 gets exactly one done call,
+ * and one which is given done returns -1 if PENDING_OPS are already waiting */
+template<class CFG>
+int eseyeAWSBasic<CFG>::subscribe(char *topic, _msgcb callback, _donecb done, void *donectx){
+  return this->subopen(topic, callback, NULL, done, donectx);
+}
+
+/* Subscribe to a topic and receive messages in chunks as they arrive
+ * The callback gets each chunk with its offset and the total message length
+ * so messages of any size can be handled with a small modemrxbuf */
+template<class CFG>
+int eseyeAWSBasic<CFG>::subscribestream(char *topic, _msgchunkcb callback, _donecb done, void *donectx){
+  return this->subopen(topic, NULL, callback, done, donectx);
+}
+
+/* Subscribe - a topic which is already subscribed (or subscribing) shares its
+ * slot rather than opening another one. Returns the subscription index */
+template<class CFG>
+int eseyeAWSBasic<CFG>::subopen(char *topic, _msgcb callback, _msgchunkcb chunkcallback, _donecb done, void *donectx){
+  int topiccount = 0;
+  int handle = 0;
+  this->checkTimeout();
+  if(done != NULL && this->opfree() == false)
+    return -1;
+  while(handle < SUB_HANDLERS && this->subhandlers[handle].slot != 0xff){
+    handle++;
+  }
+  if(handle == SUB_HANDLERS)
+    return -1;
+  /* A topic being recovered is shared as well */
+  while(topiccount < CFG::maxSubTopics &&
+        !((this->subtopics[topiccount].substate == SUB_TOPIC_SUBSCRIBING || this->subtopics[topiccount].substate == SUB_TOPIC_SUBSCRIBED ||
+           (this->subtopics[topiccount].substate == SUB_TOPIC_ERROR && this->rtretrying(SLOT_SUB + topiccount))) &&
+          this->tpis(SLOT_SUB + topiccount, topic))){
+    topiccount++;
+  }
+  if(topiccount == CFG::maxSubTopics){
+    /* Not subscribed yet - use the first available topic index, taking one
+     * which is being recovered only if there is nothing else */
+    topiccount = 0;
+    while(topiccount < CFG::maxSubTopics && this->subtopics[topiccount].substate != SUB_TOPIC_NOT_IN_USE &&
+          (this->subtopics[topiccount].substate != SUB_TOPIC_ERROR || this->rtretrying(SLOT_SUB + topiccount))){
+      topiccount++;
+    }
+    if(topiccount == CFG::maxSubTopics){
+      topiccount = 0;
+      while(topiccount < CFG::maxSubTopics && this->subtopics[topiccount].substate != SUB_TOPIC_ERROR){
+        topiccount++;
+      }
+    }
+    if(topiccount == CFG::maxSubTopics)
+      return -1;
+    if(this->awscmd(SLOT_SUB + topiccount, aws_sub, topiccount, topic, -1) < 0)
+      return -1;
+    /* Subscriptions left on an errored slot lose it now */
+    this->subclear(topiccount);
+    this->rtstop(SLOT_SUB + topiccount, false);
+    this->subtopics[topiccount].substate = SUB_TOPIC_SUBSCRIBING;
+    this->tpset(SLOT_SUB + topiccount, topic);
+    this->dlarm(SLOT_SUB + topiccount, CFG::timeoutPolicy::subtimeout);
+  }
+  this->subhandlers[handle].slot = topiccount;
+  this->subhandlers[handle].messagecb = callback;
+  this->subhandlers[handle].chunkcb = chunkcallback;
+  this->opadd(ESEYE_OP_SUBSCRIBE, handle,
+              this->subtopics[topiccount].substate == SUB_TOPIC_SUBSCRIBED ? 0 : ESEYE_OP_PENDING, done, donectx);
+  return handle;
+}
+
+/* Have we successfully subscribed */
+template<class CFG>
+tsubTopicState eseyeAWSBasic<CFG>::substate(int idx){
+  this->checkTimeout();
+  if(idx < 0 || idx >= SUB_HANDLERS || this->subhandlers[idx].slot == 0xff)
+    return SUB_TOPIC_NOT_IN_USE;
+  return (tsubTopicState)this->subtopics[this->subhandlers[idx].slot].substate;
+}
+
+/* Unsubscribe - the topic is only closed on the modem once no other
+ * subscription shares it (done is called once it has been) */
+template<class CFG>
+int eseyeAWSBasic<CFG>::unsubscribe(int idx, _donecb done, void *donectx){
+  uint8_t slot;
+  this->checkTimeout();
+  if(idx < 0 || idx >= SUB_HANDLERS || this->subhandlers[idx].slot == 0xff)
+    return -1;
+  if(done != NULL && this->opfree() == false)
+    return -1;
+  slot = this->subhandlers[idx].slot;
+  if(this->subusers(slot) > 1 || this->subtopics[slot].substate == SUB_TOPIC_ERROR){
+    /* Still wanted by others or there is nothing to close */
+    this->opsettle(ESEYE_OP_SUBSCRIBE, idx, ESEYE_DROPPED);
+    this->subhandlers[idx].slot = 0xff;
+    this->opadd(ESEYE_OP_UNSUBSCRIBE, idx, 0, done, donectx);
+    return 0;
+  }
+  if(this->subtopics[slot].substate == SUB_TOPIC_SUBSCRIBED){
+    if(this->awscmd(SLOT_SUB + slot, aws_subcl, slot, NULL, -1) < 0)
+      return -1;
+    this->subtopics[slot].substate = SUB_TOPIC_UNSUBSCRIBING;
+    this->dlarm(SLOT_SUB + slot, CFG::timeoutPolicy::subtimeout);
+    /* The subscription is released when the close completes */
+    this->subhandlers[idx].messagecb = NULL;
+    this->subhandlers[idx].chunkcb = NULL;
+    this->opadd(ESEYE_OP_UNSUBSCRIBE, idx, ESEYE_OP_PENDING, done, donectx);
+    return 0;
+  }
+  return -1;
+}
+
+/* Number of subscriptions using a slot */
+template<class CFG>
+uint8_t eseyeAWSBasic<CFG>::subusers(uint8_t slot){
+  uint8_t i, users = 0;
+  for(i = 0; i < SUB_HANDLERS; i++){
+    if(this->subhandlers[i].slot == slot)
+      users++;
+  }
+  return users;
+}
+
+/* Release every subscription using a slot - any still waiting for it to
+ * open won't see it now */
+template<class CFG>
+void eseyeAWSBasic<CFG>::subclear(uint8_t slot){
+  uint8_t i;
+  for(i = 0; i < SUB_HANDLERS; i++){
+    if(this->subhandlers[i].slot == slot){
+      this->opsettle(ESEYE_OP_SUBSCRIBE, i, ESEYE_DROPPED);
+      this->subhandlers[i].slot = 0xff;
+    }
+  }
+}
+
+/* Settle op for every subscription using a slot */
+template<class CFG>
+void eseyeAWSBasic<CFG>::subsettle(uint8_t slot, uint8_t op, int8_t result){
+  uint8_t i;
+  for(i = 0; i < SUB_HANDLERS; i++){
+    if(this->subhandlers[i].slot == slot)
+      this->opsettle(op, i, result);
+  }
+}
+
+/* Publish topic API */
+
+#define TOPIC_NOT_REGISTERED 0
+#define TOPIC_REGISTERING    1
+#define TOPIC_REGISTERED     2
+
+/* Register a publish topic - a topic which is already registered (or
+ * registering) returns the same index. done is called once it is registered
+ * or has failed to be */
+template<class CFG>
+int eseyeAWSBasic<CFG>::pubreg(char *topic, _donecb done, void *donectx){
+  int topiccount = 0;
+  this->checkTimeout();
+  if(done != NULL && this->opfree() == false)
+    return -1;
+  /* A topic being recovered is shared as well */
+  while(topiccount < CFG::maxPubTopics){
+    if((this->pubtopics[topiccount].pubstate == PUB_TOPIC_REGISTERING || this->pubtopics[topiccount].pubstate == PUB_TOPIC_REGISTERED ||
+        (this->pubtopics[topiccount].pubstate == PUB_TOPIC_ERROR && this->rtretrying(SLOT_PUB + topiccount))) &&
+       this->pubtopics[topiccount].refs < 15 && this->tpis(SLOT_PUB + topiccount, topic)){
+      this->pubtopics[topiccount].refs++;
+      this->opadd(ESEYE_OP_PUBREG, topiccount,
+                  this->pubtopics[topiccount].pubstate == PUB_TOPIC_REGISTERED ? 0 : ESEYE_OP_PENDING, done, donectx);
+      return topiccount;
+    }
+    topiccount++;
+  }
+  /* Leave topics which are being recovered to last */
+  topiccount = 0;
+  while(topiccount < CFG::maxPubTopics && this->pubtopics[topiccount].pubstate != PUB_TOPIC_NOT_IN_USE &&
+        (this->pubtopics[topiccount].pubstate != PUB_TOPIC_ERROR || this->rtretrying(SLOT_PUB + topiccount))){
+    topiccount++;
+  }
+  if(topiccount == CFG::maxPubTopics){
+    topiccount = 0;
+    while(topiccount < CFG::maxPubTopics && this->pubtopics[topiccount].pubstate != PUB_TOPIC_ERROR){
+      topiccount++;
+    }
+  }
+  if(topiccount == CFG::maxPubTopics)
+    return -1;
+  if(this->awscmd(SLOT_PUB + topiccount, aws_pub, topiccount, topic, -1) < 0)
+    return -1;
+  /* Registrations left waiting on an errored index lose it now */
+  this->opsettle(ESEYE_OP_PUBREG, topiccount, ESEYE_DROPPED);
+  this->rtstop(SLOT_PUB + topiccount, false);
+  this->pubtopics[topiccount].pubstate = PUB_TOPIC_REGISTERING;
+  this->pubtopics[topiccount].refs = 1;
+  this->tpset(SLOT_PUB + topiccount, topic);
+  this->dlarm(SLOT_PUB + topiccount, CFG::timeoutPolicy::pubtimeout);
+  this->opadd(ESEYE_OP_PUBREG, topiccount, ESEYE_OP_PENDING, done, donectx);
+  return topiccount;
+}
+
+/* Check if publish topic is registered */
+template<class CFG>
+tpubTopicState eseyeAWSBasic<CFG>::pubstate(int idx){
+  this->checkTimeout();
+  return (tpubTopicState)this->pubtopics[idx].pubstate;
+}
+
+/* Unregister a publish topic - it is closed when the last pubreg() of it is
+ * undone (done is called once it has been). An errored topic has nothing to
+ * close so it is just released */
+template<class CFG>
+int eseyeAWSBasic<CFG>::pubunreg(int idx, _donecb done, void *donectx){
+  this->checkTimeout();
+  if(idx < 0 || idx >= CFG::maxPubTopics)
+    return -1;
+  if(done != NULL && this->opfree() == false)
+    return -1;
+  if(this->pubtopics[idx].pubstate == PUB_TOPIC_ERROR && this->pubtopics[idx].refs > 0){
+    if(--this->pubtopics[idx].refs == 0){
+      this->opsettle(ESEYE_OP_PUBREG, idx, ESEYE_DROPPED);
+      this->pubtopics[idx].pubstate = PUB_TOPIC_NOT_IN_USE;
+      this->tpfree(SLOT_PUB + idx);
+      this->btfree(idx);
+      this->rtstop(SLOT_PUB + idx, false);
+    }
+    this->opadd(ESEYE_OP_PUBUNREG, idx, 0, done, donectx);
+    return 0;
+  }
+  if(this->pubtopics[idx].pubstate == PUB_TOPIC_REGISTERED){
+    if(this->pubtopics[idx].refs > 1){
+      this->pubtopics[idx].refs--;
+      this->opadd(ESEYE_OP_PUBUNREG, idx, 0, done, donectx);
+      return 0;
+    }
+    if(this->awscmd(SLOT_PUB + idx, aws_pubcl, idx, NULL, -1) < 0)
+      return -1;
+    this->pubtopics[idx].pubstate = PUB_TOPIC_UNREGISTERING; 
+    this->dlarm(SLOT_PUB + idx, CFG::timeoutPolicy::pubtimeout);
+    this->opadd(ESEYE_OP_PUBUNREG, idx, ESEYE_OP_PENDING, done, donectx);
+    return 0;
+  }
+  return -1;
+}
+
+/* Publish queue states for the entry at the head of the queue */
+#define PUBQ_IDLE         0
+#define PUBQ_WAIT_PROMPT  1
+#define PUBQ_SENDING      2
+#define PUBQ_WAIT_RESULT  3
+
+/* Publish a message to a topic by index
+ * The message is copied and queued to be sent from poll() - returns the
+ * publish id which is passed to the publish callback on completion or -1 if
+ * it can't be queued. With FILTER_OK a publish the modem answers with ERROR
+ * fails with ESEYE_CMD_ERROR, without it only a timeout ends it. With a journal a topic which is errored or still
+ * registering keeps the message there and returns ESEYE_JOURNALED
+ * done (if given) is called with the result as well, or with
+ * ESEYE_JOURNALED from the next poll() if that is where the message went */
+template<class CFG>
+int eseyeAWSBasic<CFG>::publish(int tpcidx, uint8_t *data, uint8_t datalen, _donecb done, void *donectx){
+  struct pubqentry *entry;
+  int offset;
+  this->checkTimeout();
+  if(done != NULL && this->opfree() == false)
+    return -1;
+  entry = this->pubenqueue(tpcidx, datalen);
+  if(entry == NULL)
+    return this->journalkeep(tpcidx, data, datalen, NULL, NULL, done, donectx);
+  offset = this->txalloc(datalen);
+  if(offset < 0)
+    return -1;
+  if(CFG::txBufSize > 0)
+    memcpy(&this->txdata()[offset], data, datalen);
+  entry->type = PUBQ_COPY;
+  entry->src.offset = offset;
+  return this->pubcommit(entry, done, donectx);
+}
+
+/* Publish a message without copying it - data must remain valid and unchanged
+ * until the publish callback reports completion for the returned id */
+template<class CFG>
+int eseyeAWSBasic<CFG>::publishref(int tpcidx, const uint8_t *data, uint16_t datalen, _donecb done, void *donectx){
+  struct pubqentry *entry;
+  this->checkTimeout();
+  if(done != NULL && this->opfree() == false)
+    return -1;
+  entry = this->pubenqueue(tpcidx, datalen);
+  if(entry == NULL)
+    return this->journalkeep(tpcidx, data, datalen, NULL, NULL, done, donectx);
+  entry->type = PUBQ_REF;
+  entry->src.data = data;
+  return this->pubcommit(entry, done, donectx);
+}
+
+/* Publish datalen bytes produced by writer when the modem is ready for them
+ * The writer streams straight to the modem uart so no buffer is needed (if
+ * the payload is journaled instead the writer is run now to write it there) */
+template<class CFG>
+int eseyeAWSBasic<CFG>::publishwriter(int tpcidx, uint16_t datalen, _pubwriter writer, void *ctx, _donecb done, void *donectx){
+  struct pubqentry *entry;
+  this->checkTimeout();
+  if(writer == NULL || (done != NULL && this->opfree() == false))
+    return -1;
+  entry = this->pubenqueue(tpcidx, datalen);
+  if(entry == NULL)
+    return this->journalkeep(tpcidx, NULL, datalen, writer, ctx, done, donectx);
+  entry->type = PUBQ_WRITER;
+  entry->src.w.writer = writer;
+  entry->src.w.ctx = ctx;
+  return this->pubcommit(entry, done, donectx);
+}
+
+/* Check a publish can be queued and return the queue entry to fill in */
+template<class CFG>
+struct pubqentry *eseyeAWSBasic<CFG>::pubenqueue(int tpcidx, uint16_t datalen){
+  struct pubqentry *entry;
+  if(tpcidx < 0 || tpcidx >= CFG::maxPubTopics || this->pubtopics[tpcidx].pubstate != PUB_TOPIC_REGISTERED)
+    return NULL;
+  if(datalen == 0 || this->pubqcount == CFG::pubQueueLen)
+    return NULL;
+  entry = &this->pubq[(this->pubqhead + this->pubqcount) % CFG::pubQueueLen];
+  entry->tpcidx = tpcidx;
+  entry->len = datalen;
+  return entry;
+}
+
+/* Add a filled in entry to the publish queue and start it if the modem is free */
+template<class CFG>
+int eseyeAWSBasic<CFG>::pubcommit(struct pubqentry *entry, _donecb done, void *donectx){
+  uint8_t id = this->pubqnextid++;
+  entry->id = id;
+  this->opadd(ESEYE_OP_PUBLISH, id, ESEYE_OP_PENDING, done, donectx);
+  this->pubqcount++;
+  this->pubkick();
+  return id;
+}
+
+/* Check if all queued publishes are complete */
+template<class CFG>
+boolean eseyeAWSBasic<CFG>::pubdone(void){
+  if(this->pubqcount == 0)
+    return true;
+  return false;
+}
+
+/* Number of publishes queued or in progress */
+template<class CFG>
+uint8_t eseyeAWSBasic<CFG>::pubqueued(void){
+  return this->pubqcount;
+}
+
+/* Register a callback for publish completion (SEND OK/SEND FAIL) */
+template<class CFG>
+void eseyeAWSBasic<CFG>::pubcallback(_pubcb callback){
+  this->pubdonecb = callback;
+}
+
+/* Publish batching API */
+
+/* Batch the records appended to a publish index with pubappend() - they are
+ * published together once maxbytes (0 = as many as fit) are batched or the
+ * oldest has waited maxdelayms (0 = no limit). Records are separated by
+ * separator, or each preceded by its length byte if separator is 0 */
+template<class CFG>
+int eseyeAWSBasic<CFG>::pubbatch(int tpcidx, unsigned long maxdelayms, uint8_t maxbytes, uint8_t separator){
+  struct pubbatch *b;
+  if(tpcidx < 0 || tpcidx >= CFG::maxPubTopics || this->pubtopics[tpcidx].pubstate == PUB_TOPIC_NOT_IN_USE)
+    return -1;
+  b = this->btfind(tpcidx, true);
+  if(b == NULL)
+    return -1;
+  /* Records already batched keep the framing they were added with */
+  if(b->len > 0 && b->sep != separator && this->batchsend(b) < 0)
+    return -1;
+  b->sep = separator;
+  b->limit = (maxbytes == 0 || maxbytes > CFG::pubBatchSize) ? CFG::pubBatchSize : maxbytes;
+  b->maxdelay = maxdelayms;
+  if(b->len == 0)
+    b->due = millis() + maxdelayms;
+  return 0;
+}
+
+/* Stop batching a publish index - anything batched is published first */
+template<class CFG>
+int eseyeAWSBasic<CFG>::pubunbatch(int tpcidx){
+  struct pubbatch *b;
+  if(tpcidx < 0 || tpcidx >= CFG::maxPubTopics)
+    return -1;
+  b = this->btfind(tpcidx, false);
+  if(b == NULL || (b->len > 0 && this->batchsend(b) < 0))
+    return -1;
+  this->btfree(tpcidx);
+  return 0;
+}
+
+/* Add a record to the batch of a publish index - a full batch is published
+ * to make room. Returns -1 if the record can't be batched */
+template<class CFG>
+int eseyeAWSBasic<CFG>::pubappend(int tpcidx, const uint8_t *data, uint8_t datalen){
+  struct pubbatch *b;
+  unsigned long now = millis();
+  this->checkTimeout();
+  if(tpcidx < 0 || tpcidx >= CFG::maxPubTopics || datalen == 0)
+    return -1;
+  b = this->btfind(tpcidx, false);
+  if(b == NULL)
+    return -1;
+  if(this->btadd(b, data, datalen, now) == false){
+    if(b->len == 0 || this->batchsend(b) < 0 || this->btadd(b, data, datalen, now) == false)
+      return -1;
+  }
+  /* If it can't be queued now poll() tries again */
+  if(b->len >= b->limit)
+    this->batchsend(b);
+  return 0;
+}
+
+/* Publish what is batched for an index now - returns the publish id or -1
+ * if there is nothing batched or it can't be queued */
+template<class CFG>
+int eseyeAWSBasic<CFG>::pubflush(int tpcidx){
+  struct pubbatch *b;
+  if(tpcidx < 0 || tpcidx >= CFG::maxPubTopics)
+    return -1;
+  b = this->btfind(tpcidx, false);
+  if(b == NULL || b->len == 0)
+    return -1;
+  return this->batchsend(b);
+}
+
+/* Queue a batch as one publish and start a new one */
+template<class CFG>
+int eseyeAWSBasic<CFG>::batchsend(struct pubbatch *b){
+  int id = this->publish(b->tpcidx, this->btdata(b), b->len);
+  if(id >= 0)
+    b->len = 0;
+  return id;
+}
+
+/* Publish batches which are full or whose oldest record is due */
+template<class CFG>
+void eseyeAWSBasic<CFG>::batchpoll(void){
+  struct pubbatch *b;
+  if(CFG::pubBatches == 0)
+    return;
+  while((b = this->btdue(millis())) != NULL){
+    if(this->batchsend(b) < 0)
+      return;
+  }
+}
+
+/* Publish journal API */
+
+/* Keep publishes which can't be sent in store and replay them (at most one
+ * every replayms) once their topic is registered. Records already in the
+ * store from before a reset are kept - publish indices are stored with them
+ * so topics should be registered in the same order after a restart */
+template<class CFG>
+void eseyeAWSBasic<CFG>::journal(eseyeJournalStore *store, unsigned long replayms){
+  this->jnattach(store, replayms);
+}
+
+template<class CFG>
+void eseyeAWSBasic<CFG>::journalcounts(struct eseyeJournalCounts *counts){
+  this->jncounts(counts);
+}
+
+/* Journal a publish which couldn't be queued because its topic is errored or
+ * still registering - returns ESEYE_JOURNALED, or -1 if it isn't kept */
+template<class CFG>
+int eseyeAWSBasic<CFG>::journalkeep(int tpcidx, const uint8_t *data, uint16_t datalen, _pubwriter writer, void *ctx, _donecb done, void *donectx){
+  boolean kept;
+  if(tpcidx < 0 || tpcidx >= CFG::maxPubTopics || datalen == 0)
+    return -1;
+  if(this->pubtopics[tpcidx].pubstate != PUB_TOPIC_ERROR && this->pubtopics[tpcidx].pubstate != PUB_TOPIC_REGISTERING)
+    return -1;
+  if(writer != NULL)
+    kept = this->jnwrite(tpcidx, datalen, writer, ctx);
+  else
+    kept = this->jnkeep(tpcidx, data, datalen);
+  if(kept == false)
+    return -1;
+  /* Settled now - it has no id to be answered for */
+  this->opadd(ESEYE_OP_PUBLISH, 0, ESEYE_JOURNALED, done, donectx);
+  return ESEYE_JOURNALED;
+}
+
+/* The oldest journal record if its topic is registered */
+template<class CFG>
+boolean eseyeAWSBasic<CFG>::journalready(uint8_t *tpcidx, uint16_t *len){
+  if(this->jnhead(tpcidx, len) == false)
+    return false;
+  return *tpcidx < CFG::maxPubTopics && this->pubtopics[*tpcidx].pubstate == PUB_TOPIC_REGISTERED;
+}
+
+/* Replay the oldest journal record when it is due - it goes through the
+ * publish queue like any other publish, read from the store at the prompt */
+template<class CFG>
+void eseyeAWSBasic<CFG>::journalpoll(void){
+  uint8_t tpcidx;
+  uint16_t len;
+  int id;
+  if(this->jnhead(&tpcidx, &len) == false)
+    return;
+  if(tpcidx >= CFG::maxPubTopics){
+    /* From a configuration with more publish indices */
+    this->jndiscard();
+    return;
+  }
+  if(this->pubtopics[tpcidx].pubstate != PUB_TOPIC_REGISTERED || this->jnwait(millis()) > 0)
+    return;
+  id = this->publishwriter(tpcidx, len, this->jnreplay, this->jnctx());
+  if(id >= 0)
+    this->jnsent(id);
+}
+
+/* Find room for len bytes in txbuf - copied payloads are kept contiguous
+ * and in queue order so the free space is either side of the used region */
+template<class CFG>
+int eseyeAWSBasic<CFG>::txalloc(uint16_t len){
+  struct pubqentry *first = NULL, *last = NULL, *entry;
+  uint8_t i;
+  int end;
+  if(len > CFG::txBufSize)
+    return -1;
+  for(i = 0; i < this->pubqcount; i++){
+    entry = &this->pubq[(this->pubqhead + i) % CFG::pubQueueLen];
+    if(entry->type != PUBQ_COPY)
+      continue;
+    if(first == NULL)
+      first = entry;
+    last = entry;
+  }
+  if(first == NULL)
+    return 0;
+  end = last->src.offset + last->len;
+  if(last->src.offset >= first->src.offset){
+    if(end + len <= CFG::txBufSize)
+      return end;
+    if(len <= first->src.offset)
+      return 0;
+  }else if(end + len <= first->src.offset){
+    return end;
+  }
+  return -1;
+}
+
+/* Send the publish command for the head of the queue if the modem is free */
+template<class CFG>
+void eseyeAWSBasic<CFG>::pubkick(void){
+  struct pubqentry *entry;
+  int behind;
+  while(this->pubqcount > 0 && this->pubqstate == PUBQ_IDLE){
+    entry = &this->pubq[this->pubqhead];
+    if(this->pubtopics[entry->tpcidx].pubstate != PUB_TOPIC_REGISTERED){
+      /* Topic was unregistered or errored while we were queued */
+      this->pubcomplete(ESEYE_DROPPED);
+      continue;
+    }
+    /* Nothing after the publish command can go out until the payload has,
+     * so hold everything while it is queued (it can overtake commands) */
+    this->pubqstate = PUBQ_WAIT_PROMPT;
+    this->cmdhold = 0;
+    behind = this->awscmd(SLOT_PUBQ, aws_publish, entry->tpcidx, NULL, entry->len, ESEYE_PRIO_PUBLISH);
+    if(behind < 0){
+      /* Wait for room in the staging buffer if it's full - poll() retries */
+      this->pubqstate = PUBQ_IDLE;
+      return;
+    }
+    this->mtpubstart();
+    this->cmdhold = this->cmdend - this->cmdstart - behind;
+    this->txpump();
+    this->dlarm(SLOT_PUBQ, CFG::timeoutPolicy::pubtimeout);
+  }
+}
+
+/* Retire the head of the publish queue and report the result (0 if it was
+ * sent). A failed publish is journaled (if there is a journal) before its
+ * payload is released, a replayed one is settled with the journal and not
+ * reported */
+template<class CFG>
+void eseyeAWSBasic<CFG>::pubcomplete(int8_t result){
+  struct pubqentry *entry = &this->pubq[this->pubqhead];
+  uint8_t id = entry->id;
+  boolean success = result == 0;
+  boolean replay = this->jndone(id, success);
+  boolean kept = false;
+  if(success == false && replay == false){
+    if(entry->type == PUBQ_WRITER)
+      kept = this->jnwrite(entry->tpcidx, entry->len, entry->src.w.writer, entry->src.w.ctx);
+    else if(entry->type == PUBQ_REF)
+      kept = this->jnkeep(entry->tpcidx, entry->src.data, entry->len);
+    else if(CFG::txBufSize > 0)
+      kept = this->jnkeep(entry->tpcidx, &this->txdata()[entry->src.offset], entry->len);
+  }
+  this->pubqhead = (this->pubqhead + 1) % CFG::pubQueueLen;
+  this->pubqcount--;
+  this->pubqstate = PUBQ_IDLE;
+  this->dldisarm(SLOT_PUBQ);
+  this->opsettle(ESEYE_OP_PUBLISH, id, kept ? ESEYE_JOURNALED : result);
+  if(replay == false && this->pubdonecb != NULL)
+    this->pubdonecb(id, success);
+}
+
+/* Polling loop - the work is done here
+ * A budget limits how many received bytes are handled in one call so a busy
+ * modem can't hold up the rest of loop() (or other instances) */
+template<class CFG>
+void eseyeAWSBasic<CFG>::poll(uint16_t budget){
+  uint8_t chunk[CFG::rxChunkSize];
+  uint16_t handled = 0;
+  int avail, c;
+  uint8_t n, i;
+  this->checkTimeout();
+  /* Resume anything the uart didn't have room for last time */
+  this->txpump();
+  this->recoverpoll();
+  this->pubkick();
+  this->batchpoll();
+  this->journalpoll();
+  for(;;){
+    /* A receive ring stops short of any bytes it lost until told it has
+     * been read up to them */
+    if(this->rxring != NULL && this->rxring->gap())
+      this->rxresync();
+    if((avail = this->atuart->available()) <= 0 || (budget != 0 && handled >= budget))
+      break;
+    /* Take a block of no more than available() says is there. The core's
+     * Stream::readBytes() isn't virtual and times every byte, so a uart is
+     * read a byte at a time - a receive ring is copied from in one go */
+    n = avail < CFG::rxChunkSize ? avail : CFG::rxChunkSize;
+    if(budget != 0 && n > budget - handled)
+      n = budget - handled;
+    if(this->rxring != NULL){
+      n = this->rxring->readBytes((char *)chunk, n);
+    }else{
+      for(i = 0; i < n && (c = this->atuart->read()) >= 0; i++)
+        chunk[i] = c;
+      n = i;
+    }
+    if(n == 0)
+      break;
+    handled += n;
+    this->ingest(chunk, n);
+  }
+  this->opdeliver();
+}
+
+/* The '>' publish prompt - send the payload of the queued publish */
+template<class CFG>
+void eseyeAWSBasic<CFG>::promptreceived(void){
+  if(this->pubqstate == PUBQ_WAIT_PROMPT){
+    struct pubqentry *entry = &this->pubq[this->pubqhead];
+    if(entry->type == PUBQ_WRITER){
+      /* Writers can't be resumed so they always write in one go */
+      eseyePubOut out(this->cpout(this->atuart), entry->len);
+      entry->src.w.writer(&out, entry->len, entry->src.w.ctx);
+      out.pad();
+      this->mtout(entry->len);
+      this->pubqstate = PUBQ_WAIT_RESULT;
+    }else{
+      this->payloadoff = 0;
+      this->pubqstate = PUBQ_SENDING;
+    }
+    this->txpump();
+  }
+}
+
+/* Handle received bytes
+ * Message data is copied into modemrxbuf a run at a time. Other lines are
+ * copied up to the next '\n' (found with memchr) and only fed to the
+ * classifier until it has what it needs */
+template<class CFG>
+void eseyeAWSBasic<CFG>::ingest(const uint8_t *data, uint16_t len){
+  const uint8_t *nl, *urc;
+  uint16_t pos = 0, n, seg;
+  uint8_t i, room;
+  this->mtin(len);
+  this->cprx(data, len);
+  while(pos < len){
+    if(this->rxskip){
+      /* Bytes were lost - resume after the line they cut into, or at a URC
+       * before its end (message data has no line end of its own) */
+      nl = (const uint8_t *)memchr(&data[pos], '\n', len - pos);
+      urc = (const uint8_t *)memchr(&data[pos], '+', nl != NULL ? nl - &data[pos] : len - pos);
+      if(urc != NULL)
+        pos = urc - data;
+      else if(nl != NULL)
+        pos = nl - data + 1;
+      else
+        break;
+      this->rxskip = false;
+      continue;
+    }
+    if(this->binaryread > 0){
+      /* Binary message data - keep what fits in modemrxbuf, streaming
+       * subscribers are handed each full buffer as a chunk */
+      n = len - pos;
+      if(n > this->binaryread)
+        n = this->binaryread;
+      room = CFG::rxBufSize - this->rxbufidx;
+      if(room > 0){
+        if(n > room)
+          n = room;
+        memcpy(&this->modemrxbuf[this->rxbufidx], &data[pos], n);
+        this->rxbufidx += n;
+      }
+      this->binaryread -= n;
+      pos += n;
+      if(this->binaryread == 0 || this->rxbufidx == CFG::rxBufSize)
+        this->msgdeliver();
+      continue;
+    }
+    if(this->rxbufidx == 0 && data[pos] == '>'){
+      this->promptreceived();
+      pos++;
+      continue;
+    }
+    nl = (const uint8_t *)memchr(&data[pos], '\n', len - pos);
+    seg = nl != NULL ? nl - &data[pos] + 1 : len - pos;
+    while(seg > 0){
+      n = CFG::rxBufSize - this->rxbufidx;
+      if(n > seg)
+        n = seg;
+      memcpy(&this->modemrxbuf[this->rxbufidx], &data[pos], n);
+      for(i = this->rxbufidx; i < this->rxbufidx + n && this->urcactive(); i++)
+        this->urcbyte(this->modemrxbuf[i], i);
+      this->rxbufidx += n;
+      pos += n;
+      seg -= n;
+      /* An over-long line wraps round rather than overflowing */
+      if(this->rxbufidx >= CFG::rxBufSize && (seg > 0 || nl == NULL)){
+        this->rxbufidx = 0;
+        this->mtwrap();
+      }
+    }
+    this->modemrxbuf[this->rxbufidx] = 0;
+    if(nl != NULL){
+      /* This is the end of a response - it was classified as it arrived */
+      if(this->urcdispatch() == false){
+        this->mtline(this->atcallback != NULL);
+        if(this->atcallback != NULL){
+          //UARTDEBUG(F("Forwarding "));
+          //UARTDEBUGLN((char *)this->modemrxbuf);
+          this->atcallback((char *)this->modemrxbuf);
+        }else{
+          UARTDEBUG(F("Discarding "));
+          UARTDEBUGLN((char *)this->modemrxbuf);
+        }
+      }
+      this->urcreset();
+      this->rxbufidx = 0;
+      /* Start the next queued publish once the last one has completed */
+      this->pubkick();
+    }
+  }
+}
+
+/* Start classifying a new line */
+template<class CFG>
+void eseyeAWSBasic<CFG>::urcreset(void){
+  this->urcmatch = URC_MATCH_ALL;
+  this->urctype = URC_NONE;
+  this->urcfield = 0;
+  this->urcneg = 0;
+  this->urcdigits = false;
+  this->urcval[0] = 0;
+  this->urcval[1] = 0;
+}
+
+/* Whether the classifier still wants bytes of this line */
+template<class CFG>
+boolean eseyeAWSBasic<CFG>::urcactive(void){
+  return this->urcmatch != 0 || (this->urctype <= URC_PUBCLOSE && this->urcfield <= 1);
+}
+
+/* Classify the line one byte at a time (pos is its offset in the line)
+ * Candidate keywords are dropped as soon as they mismatch so most lines are
+ * resolved in a few bytes. Once a keyword with fields has matched the
+ * numeric fields are accumulated directly, any non-digit ends a field */
+template<class CFG>
+void eseyeAWSBasic<CFG>::urcbyte(char c, uint8_t pos){
+  uint8_t i;
+  if(this->urcmatch != 0){
+    for(i = 0; i < URC_KEYWORDS; i++){
+      if((this->urcmatch & (1U << i)) == 0)
+        continue;
+      const char *keyword = (const char *)pgm_read_ptr(&urc_keywords[i]);
+      if(pgm_read_byte(&keyword[pos]) != c){
+        this->urcmatch &= ~(1U << i);
+      }else if(pgm_read_byte(&keyword[pos + 1]) == 0){
+        this->urctype = i;
+        this->urcmatch = 0;
+        return;
+      }
+    }
+    return;
+  }
+  if(this->urctype > URC_PUBCLOSE || this->urcfield > 1)
+    return;
+  if(c >= '0' && c <= '9'){
+    this->urcval[this->urcfield] = this->urcval[this->urcfield] * 10 + (c - '0');
+    this->urcdigits = true;
+  }else if(c == '-' && this->urcdigits == false){
+    this->urcneg |= 1 << this->urcfield;
+  }else if(this->urcdigits == true){
+    this->urcfield++;
+    this->urcdigits = false;
+  }
+}
+
+/* Act on a classified line - returns false if the line wasn't for us */
+template<class CFG>
+boolean eseyeAWSBasic<CFG>::urcdispatch(void){
+  uint8_t idx = (this->urcneg & 1) ? 0xff : this->urcval[0];
+  int8_t err = (this->urcneg & 2) ? -(int8_t)this->urcval[1] : (int8_t)this->urcval[1];
+  uint8_t slot;
+  int8_t result;
+  boolean handled;
+  this->mturc(this->urctype);
+  switch(this->urctype){
+    case URC_MSG:
+      /* This is a published message to which we are subscribed */
+      this->readingsub = idx;
+      this->binaryread = this->urcval[1];
+      this->binarytotal = this->urcval[1];
+      this->binaryoffset = 0;
+      return true;
+    case URC_SUBOPEN:
+      UARTDEBUG(F("subscribe "));
+      UARTDEBUG(idx);
+      UARTDEBUG(F(" err "));
+      UARTDEBUGLN(err);
+      if(idx < CFG::maxSubTopics){
+        this->dldisarm(SLOT_SUB + idx);
+        /* If we get an already subscribed error assume it was us from before a reboot */
+        if(err == 0 || err == -2){
+          this->subtopics[idx].substate = SUB_TOPIC_SUBSCRIBED;
+          this->rtstop(SLOT_SUB + idx, true);
+          this->subsettle(idx, ESEYE_OP_SUBSCRIBE, 0);
+        }else{
+          this->subtopics[idx].substate = SUB_TOPIC_ERROR;
+          this->recoverarm(SLOT_SUB + idx);
+          this->subsettle(idx, ESEYE_OP_SUBSCRIBE, err);
+        }
+      }
+      return true;
+    case URC_PUBOPEN:
+      UARTDEBUG(F("pubreg "));
+      UARTDEBUG(idx);
+      UARTDEBUG(F(" err "));
+      UARTDEBUGLN(err);
+      if(idx < CFG::maxPubTopics){
+        this->dldisarm(SLOT_PUB + idx);
+        /* If we get an already registered error assume it was us from before a reboot */
+        if(err == 0 || err == -2){
+          this->pubtopics[idx].pubstate = PUB_TOPIC_REGISTERED;
+          this->rtstop(SLOT_PUB + idx, true);
+          this->opsettle(ESEYE_OP_PUBREG, idx, 0);
+        }else{
+          this->pubtopics[idx].pubstate = PUB_TOPIC_ERROR;
+          this->recoverarm(SLOT_PUB + idx);
+          this->opsettle(ESEYE_OP_PUBREG, idx, err);
+        }
+      }
+      return true;
+    case URC_SUBCLOSE:
+      UARTDEBUG(F("unsubscribe "));
+      UARTDEBUG(idx);
+      UARTDEBUG(F(" err "));
+      UARTDEBUGLN(err);
+      if(idx < CFG::maxSubTopics){
+        this->dldisarm(SLOT_SUB + idx);
+        this->subsettle(idx, ESEYE_OP_UNSUBSCRIBE, err);
+        this->subtopics[idx].substate = SUB_TOPIC_NOT_IN_USE;
+        this->subclear(idx);
+        this->tpfree(SLOT_SUB + idx);
+      }
+      return true;
+    case URC_PUBCLOSE:
+      UARTDEBUG(F("pubunreg "));
+      UARTDEBUG(idx);
+      UARTDEBUG(F(" err "));
+      UARTDEBUGLN(err);
+      if(idx < CFG::maxPubTopics){
+        this->dldisarm(SLOT_PUB + idx);
+        this->opsettle(ESEYE_OP_PUBUNREG, idx, err);
+        this->pubtopics[idx].pubstate = PUB_TOPIC_NOT_IN_USE;
+        this->tpfree(SLOT_PUB + idx);
+        this->btfree(idx);
+      }
+      return true;
+    case URC_SENDOK:
+      UARTDEBUGLN(F("Send OK"));
+      if(this->pubqstate == PUBQ_WAIT_RESULT){
+        this->mtpubdone(true);
+        this->pubcomplete(0);
+      }
+      return true;
+    case URC_SENDFAIL:
+      UARTDEBUGLN(F("Send Fail"));
+      if(this->pubqstate == PUBQ_WAIT_RESULT){
+        this->mtpubdone(false);
+        this->pubcomplete(ESEYE_SENDFAIL);
+      }
+      return true;
+    case URC_OK:
+    case URC_ERROR:
+    case URC_CMEERROR:
+      /* The final result for the oldest command in flight */
+      result = this->urctype == URC_OK ? 0 : ESEYE_CMD_ERROR;
+      handled = this->cqresult((char *)this->modemrxbuf, result, &slot);
+      this->cmdfailed(slot, result);
+      this->cmdsettled();
+      if(handled)
+        return true;
+      this->mtappresult();
+      break;
+    case URC_CRLF:
+      if(this->cqowed())
+        return true;
+      break;
+    case URC_RESTART:
+      /* Handled, but the application may want to know too */
+      this->modemrestarted();
+      break;
+    default:
+      /* Part of the reply to the oldest command */
+      return this->cqline((char *)this->modemrxbuf);
+  }
+  return false;
+}
+
+/* Hand buffered message data to the subscriptions on its slot
+ * If any are streaming every full buffer is handed out as a chunk and the
+ * others get the first buffer, otherwise they get the first rxBufSize bytes
+ * of the message once it is complete */
+template<class CFG>
+void eseyeAWSBasic<CFG>::msgdeliver(void){
+  struct subhandler *h;
+  boolean stream = false, delivered = false;
+  uint8_t i;
+  for(i = 0; i < SUB_HANDLERS; i++){
+    h = &this->subhandlers[i];
+    if(h->slot == this->readingsub && h->chunkcb != NULL)
+      stream = true;
+  }
+  if(stream == true || this->binaryread == 0){
+    this->modemrxbuf[this->rxbufidx] = 0;
+    for(i = 0; i < SUB_HANDLERS; i++){
+      h = &this->subhandlers[i];
+      if(h->slot != this->readingsub)
+        continue;
+      if(h->chunkcb != NULL){
+        h->chunkcb(this->modemrxbuf, this->rxbufidx, this->binaryoffset, this->binarytotal);
+        delivered = true;
+      }else if(h->messagecb != NULL && this->binaryoffset == 0){
+        h->messagecb(this->modemrxbuf, this->rxbufidx);
+        delivered = true;
+      }
+    }
+    if(delivered == false && this->binaryoffset == 0)
+      UARTDEBUGLN(F("Message dropped"));
+  }
+  if(stream == true){
+    this->binaryoffset += this->rxbufidx;
+    this->rxbufidx = 0;
+  }
+  if(this->binaryread == 0){
+    this->rxbufidx = 0;
+    this->readingsub = 0xff;
+  }
+}
+
+/* Forget the line or message being received */
+template<class CFG>
+void eseyeAWSBasic<CFG>::rxdiscard(void){
+  this->binaryread = 0;
+  this->readingsub = 0xff;
+  this->rxbufidx = 0;
+  this->rxskip = false;
+  this->urcreset();
+}
+
+/* The receive ring lost bytes here - what was being received is incomplete,
+ * as is the rest of the line the loss cut into (up to a URC), so both are
+ * dropped. Any answer still owed may have been lost too and would be waited
+ * for for ever, so commands waiting for their result, the publish waiting
+ * for its prompt or result and topics waiting for their URC are given up on
+ * now with ESEYE_DROPPED. A publish whose payload is going out can't have been
+ * answered yet so it carries on */
+template<class CFG>
+void eseyeAWSBasic<CFG>::rxresync(void){
+  uint8_t slot, n;
+  UARTDEBUGLN(F("Receive overrun"));
+  this->mtoverrun();
+  this->rxdiscard();
+  this->rxskip = true;
+  if(this->pubqstate != PUBQ_SENDING){
+    /* Only those owed now - failing one may start the next publish */
+    n = this->cqwaiting();
+    while(n-- > 0)
+      this->cmdfailed(this->cqexpire(ESEYE_DROPPED), ESEYE_DROPPED);
+    if(CFG::okPolicy::enabled == false &&
+       (this->pubqstate == PUBQ_WAIT_RESULT || (this->pubqstate == PUBQ_WAIT_PROMPT && this->cmdhold == 0)))
+      this->slotfailed(SLOT_PUBQ, ESEYE_DROPPED);
+  }
+  for(slot = SLOT_SUB; slot < SLOT_PUBQ; slot++){
+    if(this->cqholds(slot) == false)
+      this->slotfailed(slot, ESEYE_DROPPED);
+  }
+  this->cmdsettled();
+}
+
+/* Send an AT command - it is queued behind any library commands and those
+ * of prio or higher, returns -1 if it can't be. With FILTER_OK response (if
+ * given) is called with each line of the reply and then its final result
+ * instead of them going to the AT command callback */
+template<class CFG>
+int eseyeAWSBasic<CFG>::sendAT(char *atcmd, _atrespcb response, void *ctx, uint8_t prio){
+    size_t len = strlen(atcmd);
+    this->checkTimeout();
+    if((response != NULL && CFG::okPolicy::enabled == false) || this->cqroom() == false)
+        return -1;
+    if(this->cmdreserve(len) == true){
+        memcpy(&this->cmdbuf[this->cmdend], atcmd, len);
+        this->cmdend += len;
+        this->cmdpromote(len, this->cqadd(len, prio, 0xff, response, ctx));
+    }else if(this->txidle() == true){
+        /* Too big for the staging buffer - write it directly */
+        this->cpout(this->atuart)->print(atcmd);
+        this->mtout(len);
+        if(this->cqdirect(0xff, response, ctx))
+            this->dlarm(SLOT_CMD, CFG::timeoutPolicy::cmdtimeout);
+    }else{
+        return -1;
+    }
+    if(response == NULL)
+        this->mtappcmd();
+    this->txpump();
+    return 0;
+}
+
+/* Write staged commands to the uart without blocking the loop if enabled
+ * (only use on uarts which implement availableForWrite()) */
+template<class CFG>
+void eseyeAWSBasic<CFG>::txnonblocking(boolean enable){
+    this->txnonblock = enable;
+}
+
+/* Baud rate negotiation */
+
+/* Send cmd and wait up to BAUD_WAIT_MS for its result - 0 for OK. One left
+ * unanswered is given up on so a late result can't answer the next */
+template<class CFG>
+int8_t eseyeAWSBasic<CFG>::baudcmd(char *cmd){
+  unsigned long start = millis();
+  this->baudresult = ESEYE_OP_PENDING;
+  if(this->sendAT(cmd, baudreply, this) < 0)
+    return ESEYE_CMD_ERROR;
+  while(this->baudresult == ESEYE_OP_PENDING && millis() - start < BAUD_WAIT_MS){
+    delay(1);
+    this->poll();
+  }
+  while(this->baudresult == ESEYE_OP_PENDING && this->cqbusy())
+    this->cmdfailed(this->cqexpire(ESEYE_TIMEDOUT), ESEYE_TIMEDOUT);
+  this->cmdsettled();
+  return this->baudresult;
+}
+
+/* Is the modem answering at the current rate */
+template<class CFG>
+boolean eseyeAWSBasic<CFG>::baudprobe(void){
+  char at[] = "AT\r\n";
+  uint8_t i;
+  for(i = 0; i < BAUD_PROBES; i++){
+    if(this->baudcmd(at) == 0)
+      return true;
+  }
+  return false;
+}
+
+/* Run the uart at baud once what was written has gone - anything received
+ * until then was at the other rate */
+template<class CFG>
+void eseyeAWSBasic<CFG>::baudswitch(unsigned long baud, _baudcb setbaud, void *ctx){
+  this->atuart->flush();
+  setbaud(baud, ctx);
+  if(this->rxring != NULL)
+    this->rxring->clear();
+  this->rxdiscard();
+}
+
+/* Ask the modem to move to baud */
+template<class CFG>
+int8_t eseyeAWSBasic<CFG>::baudipr(unsigned long baud){
+  char cmd[20] = "AT+IPR=";
+  char digits[10];
+  uint8_t n = 0, len = 7;
+  do{
+    digits[n++] = '0' + baud % 10;
+    baud /= 10;
+  }while(baud > 0);
+  while(n > 0)
+    cmd[len++] = digits[--n];
+  memcpy(&cmd[len], "\r\n", 3);
+  return this->baudcmd(cmd);
+}
+
+/* The modem is asked for the new rate with AT+IPR (not saved, so a modem
+ * restart brings back the old one) and has to answer AT at it. If it doesn't
+ * it is asked to go back and the uart returns to from. A modem already at
+ * to is left there. Returns the rate in use, 0 if the modem answered at
+ * neither. Blocks for a few BAUD_WAIT_MS - call it from setup() before
+ * anything else is sent */
+template<class CFG>
+unsigned long eseyeAWSBasic<CFG>::baudup(unsigned long from, unsigned long to, _baudcb setbaud, void *ctx){
+  int8_t result;
+  if(CFG::okPolicy::enabled == false)
+    return from;
+  if(this->baudprobe() == false){
+    this->baudswitch(to, setbaud, ctx);
+    if(this->baudprobe() == true)
+      return to;
+    this->baudswitch(from, setbaud, ctx);
+    return 0;
+  }
+  result = this->baudipr(to);
+  /* Refused - still at from. Unanswered it may have switched anyway */
+  if(result != 0 && result != ESEYE_TIMEDOUT)
+    return from;
+  this->baudswitch(to, setbaud, ctx);
+  if(this->baudprobe() == true)
+    return to;
+  UARTDEBUGLN(F("No answer at the new rate"));
+  /* The modem may still hear us - ask it to go back */
+  this->baudipr(from);
+  this->baudswitch(from, setbaud, ctx);
+  return this->baudprobe() == true ? from : 0;
+}
+
+/* Command staging */
+
+/* Number of decimal digits in n */
+template<class CFG>
+uint8_t eseyeAWSBasic<CFG>::numlen(uint16_t n){
+  uint8_t len = 1;
+  while(n >= 10){
+    n /= 10;
+    len++;
+  }
+  return len;
+}
+
+/* Nothing is staged or waiting behind a publish */
+template<class CFG>
+boolean eseyeAWSBasic<CFG>::txidle(void){
+  return this->cmdstart == this->cmdend && this->pubqstate != PUBQ_WAIT_PROMPT && this->pubqstate != PUBQ_SENDING;
+}
+
+/* Make room for len bytes at the end of the staging buffer */
+template<class CFG>
+boolean eseyeAWSBasic<CFG>::cmdreserve(size_t len){
+  if(len > CFG::cmdBufSize)
+    return false;
+  if((size_t)(CFG::cmdBufSize - this->cmdend) >= len)
+    return true;
+  this->txpump();
+  if(this->cmdstart > 0){
+    memmove(this->cmdbuf, &this->cmdbuf[this->cmdstart], this->cmdend - this->cmdstart);
+    this->cmdend -= this->cmdstart;
+    this->cmdstart = 0;
+  }
+  return (size_t)(CFG::cmdBufSize - this->cmdend) >= len;
+}
+
+template<class CFG>
+void eseyeAWSBasic<CFG>::cmdappend_P(const char *str){
+  size_t len = strlen_P(str);
+  memcpy_P(&this->cmdbuf[this->cmdend], str, len);
+  this->cmdend += len;
+}
+
+template<class CFG>
+void eseyeAWSBasic<CFG>::cmdappendnum(uint16_t n){
+  uint8_t len = numlen(n);
+  uint8_t i = len;
+  while(i-- > 0){
+    this->cmdbuf[this->cmdend + i] = '0' + (n % 10);
+    n /= 10;
+  }
+  this->cmdend += len;
+}
+
+/* The last len staged bytes go ahead of the behind bytes before them */
+template<class CFG>
+void eseyeAWSBasic<CFG>::cmdpromote(uint8_t len, uint8_t behind){
+  uint8_t *p = &this->cmdbuf[this->cmdend - len - behind];
+  uint8_t i, j, c;
+  if(behind == 0)
+    return;
+  /* Rotate in place by reversing both parts and then the whole */
+  for(i = 0, j = behind - 1; i < j; i++, j--){
+    c = p[i]; p[i] = p[j]; p[j] = c;
+  }
+  for(i = behind, j = behind + len - 1; i < j; i++, j--){
+    c = p[i]; p[i] = p[j]; p[j] = c;
+  }
+  for(i = 0, j = behind + len - 1; i < j; i++, j--){
+    c = p[i]; p[i] = p[j]; p[j] = c;
+  }
+}
+
+/* Format AT+AWS<verb><idx>[,"topic"|,<num>]\r\n for slot into the staging
+ * buffer and start it on its way - returns how many staged bytes are queued
+ * after it (it goes ahead of commands with a lower prio) or -1 if it can't
+ * be queued right now */
+template<class CFG>
+int eseyeAWSBasic<CFG>::awscmd(uint8_t slot, const char *verb, uint8_t idx, const char *topic, int num, uint8_t prio){
+  size_t topiclen = topic != NULL ? strlen(topic) : 0;
+  size_t len = strlen_P(aws_start) + strlen_P(verb) + numlen(idx) + 2;
+  uint8_t behind;
+  if(topic != NULL)
+    len += topiclen + 3;
+  else if(num >= 0)
+    len += 1 + numlen(num);
+  if(this->cqroom() == false)
+    return -1;
+  if(this->cmdreserve(len) == false){
+    if(len <= CFG::cmdBufSize || this->txidle() == false)
+      return -1;
+    /* Too big for the staging buffer - write it directly */
+    Print *out = this->cpout(this->atuart);
+    out->print(FLASHSTR(aws_start));
+    out->print(FLASHSTR(verb));
+    out->print(idx);
+    out->print(F(",\""));
+    out->write(topic);
+    out->print(F("\"\r\n"));
+    this->mtout(len);
+    if(this->cqdirect(slot, NULL, NULL))
+      this->dlarm(SLOT_CMD, CFG::timeoutPolicy::cmdtimeout);
+    return 0;
+  }
+  this->cmdappend_P(aws_start);
+  this->cmdappend_P(verb);
+  this->cmdappendnum(idx);
+  if(topic != NULL){
+    this->cmdbuf[this->cmdend++] = ',';
+    this->cmdbuf[this->cmdend++] = '"';
+    memcpy(&this->cmdbuf[this->cmdend], topic, topiclen);
+    this->cmdend += topiclen;
+    this->cmdbuf[this->cmdend++] = '"';
+  }else if(num >= 0){
+    this->cmdbuf[this->cmdend++] = ',';
+    this->cmdappendnum(num);
+  }
+  this->cmdappend_P(crlf_msg);
+  behind = this->cqadd(len, prio, slot, NULL, NULL);
+  this->cmdpromote(len, behind);
+  this->txpump();
+  return behind;
+}
+
+/* Write as much as the uart will take - a publish payload first, then staged
+ * commands (held back while the modem is waiting for a payload, and beyond
+ * the command window) */
+template<class CFG>
+void eseyeAWSBasic<CFG>::txpump(void){
+  size_t n;
+  int room;
+  if(this->pubqstate == PUBQ_SENDING){
+    struct pubqentry *entry = &this->pubq[this->pubqhead];
+    const uint8_t *data = entry->src.data;
+    if(CFG::txBufSize > 0 && entry->type == PUBQ_COPY)
+      data = &this->txdata()[entry->src.offset];
+    n = entry->len - this->payloadoff;
+    if(this->txnonblock == true){
+      room = this->atuart->availableForWrite();
+      if(room < 0)
+        room = 0;
+      if((size_t)room < n)
+        n = room;
+    }
+    if(n > 0){
+      this->atuart->write(&data[this->payloadoff], n);
+      this->cptx(&data[this->payloadoff], n);
+      this->payloadoff += n;
+      this->mtout(n);
+    }
+    if(this->payloadoff < entry->len)
+      return;
+    this->pubqstate = PUBQ_WAIT_RESULT;
+  }
+  n = this->cmdend - this->cmdstart;
+  if(this->pubqstate == PUBQ_WAIT_PROMPT && n > this->cmdhold)
+    n = this->cmdhold;
+  n = this->cqallow(n);
+  if(this->txnonblock == true){
+    room = this->atuart->availableForWrite();
+    if(room < 0)
+      room = 0;
+    if((size_t)room < n)
+      n = room;
+  }
+  if(n == 0)
+    return;
+  this->atuart->write(&this->cmdbuf[this->cmdstart], n);
+  this->cptx(&this->cmdbuf[this->cmdstart], n);
+  this->cmdstart += n;
+  this->mtout(n);
+  if(this->pubqstate == PUBQ_WAIT_PROMPT)
+    this->cmdhold -= n;
+  if(this->cmdstart == this->cmdend)
+    this->cmdstart = this->cmdend = 0;
+  if(this->cqwrote(n))
+    this->dlarm(SLOT_CMD, CFG::timeoutPolicy::cmdtimeout);
+}
+
+/* The oldest command has been answered or given up on - time the one after
+ * it and send what the window now lets through */
+template<class CFG>
+void eseyeAWSBasic<CFG>::cmdsettled(void){
+  if(this->cqbusy())
+    this->dlarm(SLOT_CMD, CFG::timeoutPolicy::cmdtimeout);
+  else
+    this->dldisarm(SLOT_CMD);
+  this->txpump();
+}
+
+/* A library command was answered with result (0 is OK) - one which was
+ * refused or given up on fails what was waiting on it, as its URC will
+ * never come (so done is still called exactly once). The
+ * head publish fails on its own command whether or not its prompt came
+ * first, but not on one for a publish which has already finished (there is
+ * another publish command queued after that) */
+template<class CFG>
+void eseyeAWSBasic<CFG>::cmdfailed(uint8_t slot, int8_t result){
+  if(result == 0 || slot == 0xff)
+    return;
+  if(slot == SLOT_PUBQ && (this->pubqstate == PUBQ_IDLE || this->cqholds(SLOT_PUBQ)))
+    return;
+  this->slotfailed(slot, result);
+}
+
+/* Create and initialise API */
+
+template<class CFG>
+eseyeAWSBasic<CFG>::eseyeAWSBasic(Stream *uart) : eseyeAWSCore(uart){
+    this->pubqnextid = 0;
+    this->txnonblock = false;
+}
+
+template<class CFG>
+eseyeAWSBasic<CFG>::eseyeAWSBasic(eseyeRxRing *ring) : eseyeAWSCore(ring){
+    this->pubqnextid = 0;
+    this->txnonblock = false;
+}
+
+template<class CFG>
+void eseyeAWSBasic<CFG>::init(_atcb urccallback, Stream *trcuart) {
+    int i;
+    for(i = 0; i < CFG::maxSubTopics; i++){
+        this->subtopics[i].substate = SUB_TOPIC_NOT_IN_USE;
+    }
+    for(i = 0; i < SUB_HANDLERS; i++){
+        this->subhandlers[i].messagecb = NULL;
+        this->subhandlers[i].chunkcb = NULL;
+        this->subhandlers[i].slot = 0xff;
+    }
+    for(i = 0; i < CFG::maxPubTopics; i++){
+        this->pubtopics[i].pubstate = PUB_TOPIC_NOT_IN_USE;
+        this->pubtopics[i].refs = 0;
+    }
+    this->tpreset();
+    this->btreset();
+    this->jnreset();
+    this->rtreset();
+    this->mtreset();
+    this->cpreset();
+    this->opreset();
+
+    this->atcallback = urccallback;
+    this->traceuart(trcuart);
+
+    this->pubqhead = 0;
+    this->pubqcount = 0;
+    this->pubqstate = PUBQ_IDLE;
+    this->pubdonecb = NULL;
+    this->cmdstart = 0;
+    this->cmdend = 0;
+    this->cmdhold = 0;
+    this->rxbufidx = 0;
+    this->binaryread = 0;
+    this->binarytotal = 0;
+    this->binaryoffset = 0;
+    this->readingsub = 0xff;
+    this->rxskip = false;
+    this->urcreset();
+    this->cqreset();
+    this->dlreset();
+}
+
+/* Check pending pub/sub requests etc. - returns true if any are still waiting
+ * Deadlines are kept in order so when nothing has expired this is one compare */
+template<class CFG>
+boolean eseyeAWSBasic<CFG>::checkTimeout(void){
+    uint8_t slot;
+    unsigned long now;
+    if(this->dlpending() == false)
+        return false;
+    now = millis();
+    while((slot = this->dlexpired(now)) != 0xff){
+        if(slot == SLOT_CMD){
+            /* The oldest command never got its final result */
+            UARTDEBUGLN(F("Command timed out"));
+            this->cmdfailed(this->cqexpire(ESEYE_TIMEDOUT), ESEYE_TIMEDOUT);
+            this->cmdsettled();
+        }else{
+            UARTDEBUG(F("Slot "));
+            UARTDEBUG(slot);
+            UARTDEBUGLN(F(" timed out"));
+            this->slotfailed(slot, ESEYE_TIMEDOUT);
+        }
+    }
+    return this->dlpending();
+}
+
+/* A topic open or close, or the head publish, won't be answered - the topic
+ * is errored (an open is tried again) and the publish completed with result */
+template<class CFG>
+void eseyeAWSBasic<CFG>::slotfailed(uint8_t slot, int8_t result){
+    if(slot < SLOT_PUB){
+        if(this->subtopics[slot - SLOT_SUB].substate == SUB_TOPIC_SUBSCRIBING){
+            this->recoverarm(slot);
+            this->subsettle(slot - SLOT_SUB, ESEYE_OP_SUBSCRIBE, result);
+        }else if(this->subtopics[slot - SLOT_SUB].substate == SUB_TOPIC_UNSUBSCRIBING){
+            this->subsettle(slot - SLOT_SUB, ESEYE_OP_UNSUBSCRIBE, result);
+        }else{
+            return;
+        }
+        this->dldisarm(slot);
+        this->subtopics[slot - SLOT_SUB].substate = SUB_TOPIC_ERROR;
+    }else if(slot < SLOT_PUBQ){
+        if(this->pubtopics[slot - SLOT_PUB].pubstate == PUB_TOPIC_REGISTERING){
+            this->recoverarm(slot);
+            this->opsettle(ESEYE_OP_PUBREG, slot - SLOT_PUB, result);
+        }else if(this->pubtopics[slot - SLOT_PUB].pubstate == PUB_TOPIC_UNREGISTERING){
+            this->opsettle(ESEYE_OP_PUBUNREG, slot - SLOT_PUB, result);
+        }else{
+            return;
+        }
+        this->dldisarm(slot);
+        this->pubtopics[slot - SLOT_PUB].pubstate = PUB_TOPIC_ERROR;
+    }else if(slot == SLOT_PUBQ && this->pubqstate != PUBQ_IDLE){
+        /* Commands held behind the publish can go now */
+        this->cmdhold = 0;
+        this->pubcomplete(result);
+        this->pubkick();
+    }
+}
+
+/* Time in ms until the next pub/sub/publish response times out, publish
+ * batch is due, topic is retried, journal record can be replayed or
+ * completion can be reported - 0 if one is due now or ESEYE_NO_DEADLINE if
+ * there is none */
+template<class CFG>
+unsigned long eseyeAWSBasic<CFG>::nextDeadline(void){
+    unsigned long next = ESEYE_NO_DEADLINE, other;
+    unsigned long now = millis();
+    uint8_t tpcidx;
+    uint16_t len;
+    if(this->dlpending() == true)
+        next = this->dlnext(now);
+    other = this->btnext(now);
+    if(other < next)
+        next = other;
+    other = this->rtnext(now);
+    if(other < next)
+        next = other;
+    if(this->journalready(&tpcidx, &len) == true){
+        other = this->jnwait(now);
+        if(other < next)
+            next = other;
+    }
+    /* Completions are reported from poll() */
+    if(this->opready() == true)
+        next = 0;
+    return next;
+}
+
+/* Topic recovery API */
+
+/* The modem has restarted (it sent RDY, or the application found out some
+ * other way) - it has forgotten every topic and won't answer anything which
+ * was outstanding. Open topics are recovered, ones being closed are closed */
+template<class CFG>
+void eseyeAWSBasic<CFG>::modemrestarted(void){
+    uint8_t i;
+    UARTDEBUGLN(F("Modem restarted"));
+    for(i = 0; i < CFG::maxSubTopics; i++){
+        if(this->subtopics[i].substate == SUB_TOPIC_SUBSCRIBED || this->subtopics[i].substate == SUB_TOPIC_SUBSCRIBING){
+            this->dldisarm(SLOT_SUB + i);
+            this->subsettle(i, ESEYE_OP_SUBSCRIBE, ESEYE_RESTARTED);
+            this->subtopics[i].substate = SUB_TOPIC_ERROR;
+            this->recoverarm(SLOT_SUB + i);
+        }else if(this->subtopics[i].substate == SUB_TOPIC_UNSUBSCRIBING){
+            /* The modem has forgotten it, which is as good as closed */
+            this->dldisarm(SLOT_SUB + i);
+            this->subsettle(i, ESEYE_OP_UNSUBSCRIBE, 0);
+            this->subtopics[i].substate = SUB_TOPIC_NOT_IN_USE;
+            this->subclear(i);
+            this->tpfree(SLOT_SUB + i);
+        }
+    }
+    for(i = 0; i < CFG::maxPubTopics; i++){
+        if(this->pubtopics[i].pubstate == PUB_TOPIC_REGISTERED || this->pubtopics[i].pubstate == PUB_TOPIC_REGISTERING){
+            this->dldisarm(SLOT_PUB + i);
+            this->opsettle(ESEYE_OP_PUBREG, i, ESEYE_RESTARTED);
+            this->pubtopics[i].pubstate = PUB_TOPIC_ERROR;
+            this->recoverarm(SLOT_PUB + i);
+        }else if(this->pubtopics[i].pubstate == PUB_TOPIC_UNREGISTERING){
+            this->dldisarm(SLOT_PUB + i);
+            this->opsettle(ESEYE_OP_PUBUNREG, i, 0);
+            this->pubtopics[i].pubstate = PUB_TOPIC_NOT_IN_USE;
+            this->tpfree(SLOT_PUB + i);
+            this->btfree(i);
+        }
+    }
+    this->cqrestart();
+    if(this->pubqstate != PUBQ_IDLE){
+        /* Commands held behind the publish can go now */
+        this->cmdhold = 0;
+        this->pubcomplete(ESEYE_RESTARTED);
+    }
+    this->cmdsettled();
+}
+
+/* Topics are still being recovered */
+template<class CFG>
+boolean eseyeAWSBasic<CFG>::recovering(void){
+    return this->rtpending();
+}
+
+/* How long (ms) the last recovery took, from the first topic erroring until
+ * every one was open again - 0 if there hasn't been one */
+template<class CFG>
+unsigned long eseyeAWSBasic<CFG>::recoverytime(void){
+    return this->rtrecovery();
+}
+
+/* Schedule another attempt at reopening a topic slot (if its name is known) */
+template<class CFG>
+void eseyeAWSBasic<CFG>::recoverarm(uint8_t slot){
+    if(this->tpname(slot) != NULL)
+        this->rtarm(slot, CFG::recoveryPolicy::minms, CFG::recoveryPolicy::maxms);
+}
+
+/* Reopen topics whose retry is due - one still waiting for its answer after
+ * the longest backoff is asked again, one nobody wants any more is dropped */
+template<class CFG>
+void eseyeAWSBasic<CFG>::recoverpoll(void){
+    uint8_t slot, idx;
+    const char *topic;
+    while((slot = this->rtdue(millis())) != 0xff){
+        topic = this->tpname(slot);
+        if(slot < SLOT_PUB){
+            idx = slot - SLOT_SUB;
+            if((this->subtopics[idx].substate != SUB_TOPIC_ERROR && this->subtopics[idx].substate != SUB_TOPIC_SUBSCRIBING) ||
+               this->subusers(idx) == 0 || topic == NULL){
+                this->rtstop(slot, false);
+                continue;
+            }
+            if(this->awscmd(slot, aws_sub, idx, topic, -1) < 0)
+                return;
+            this->subtopics[idx].substate = SUB_TOPIC_SUBSCRIBING;
+            this->dlarm(slot, CFG::timeoutPolicy::subtimeout);
+        }else{
+            idx = slot - SLOT_PUB;
+            if((this->pubtopics[idx].pubstate != PUB_TOPIC_ERROR && this->pubtopics[idx].pubstate != PUB_TOPIC_REGISTERING) ||
+               this->pubtopics[idx].refs == 0 || topic == NULL){
+                this->rtstop(slot, false);
+                continue;
+            }
+            if(this->awscmd(slot, aws_pub, idx, topic, -1) < 0)
+                return;
+            this->pubtopics[idx].pubstate = PUB_TOPIC_REGISTERING;
+            this->dlarm(slot, CFG::timeoutPolicy::pubtimeout);
+        }
+        UARTDEBUG(F("Reopening "));
+        UARTDEBUGLN(topic);
+        this->rtwait(slot, CFG::recoveryPolicy::maxms);
+    }
+}
+
+/* Everything that can be sent has been (commands held back for a '>'
+ * prompt can wait) and nothing is half received or waiting to be read - the
+ * uart can't receive while the host is powered down */
+template<class CFG>
+boolean eseyeAWSBasic<CFG>::sleepready(void){
+    if(this->pubqstate == PUBQ_SENDING)
+        return false;
+    if(this->cmdstart != this->cmdend && (this->pubqstate != PUBQ_WAIT_PROMPT || this->cmdhold > 0))
+        return false;
+    return this->rxbufidx == 0 && this->binaryread == 0 && this->atuart->available() <= 0;
+}
+
+/* Sleep for the duration specified (0 = until woken) - signal to the click board our desire for it to power down
+ * Wake on signal from click board, timeout or external interrupt (if specified)
+ * The sleep is tickless: it is cut short to the next response or batch deadline, which
+ * is reported as WAKE_DEADLINE, and millis() is corrected for the time slept */
+template<class CFG>
+twakeReason eseyeAWSBasic<CFG>::sleep(unsigned long duration_mS, int additionalWakeGpio, int additionalWakeGpioPolarity){
+    twakeReason wkreason;
+    unsigned long deadline;
+    boolean fordeadline = false;
+    /* Wake in time to time out anything still waiting for a response */
+    this->checkTimeout();
+    this->txpump();
+    if(this->sleepready() == false)
+        return TRY_AGAIN_SHORTLY;
+    deadline = this->nextDeadline();
+    if(deadline == 0)
+        return TRY_AGAIN_SHORTLY;
+    if(deadline != ESEYE_NO_DEADLINE && (duration_mS == 0 || deadline < duration_mS)){
+        duration_mS = deadline;
+        fordeadline = true;
+    }
+    /* Flush the trace uart, the modem uart is flushed by hostSleep() */
+    this->trcflush();
+    wkreason = this->pinSleep(duration_mS, additionalWakeGpio, additionalWakeGpioPolarity);
+    if(wkreason == WAKE_TIMER && fordeadline == true)
+        wkreason = WAKE_DEADLINE;
+    this->checkTimeout();
+    return wkreason;
+}
+
+/* Copy out the link metrics - reset starts counting again from now */
+template<class CFG>
+void eseyeAWSBasic<CFG>::metrics(struct eseyeMetricCounts *counts, boolean reset){
+    this->mtsnapshot(counts, reset);
+}
+
+/* Record modem traffic to sink from now on - NULL stops capturing */
+template<class CFG>
+void eseyeAWSBasic<CFG>::capture(eseyeCaptureSink *sink){
+    this->cpattach(sink, this->atuart);
+}
+
+/* RAM used by each eseyeAWS instance */
+template<class CFG>
+size_t eseyeAWSBasic<CFG>::instanceram(void){
+    return sizeof(*this);
+}
+
+#endif // ESEYEAWS_IMPL_H__
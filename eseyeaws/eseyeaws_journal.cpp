@@ -0,0 +1,265 @@
+/***************************************************************************
+  eseyeaws library - publish journal
+
+  Store-and-forward for publishes which couldn't be sent. The journal is a
+  ring of records on an eseyeJournalStore (EEPROM on AVR, a mapped file on
+  the host) behind a header giving the oldest record and how much is held:
+
+      0  'E' 'J'
+      2  offset of the oldest record (from byte 8)
+      4  bytes held
+      6  records held
+
+  A record's bytes are written before the header which takes it in, so a
+  reset while one is being added loses only that record.
+
+ ***************************************************************************/
+
+#ifdef __AVR__
+#include <avr/eeprom.h>
+#endif
+
+#include "eseyeaws.h"
+
+#define JN_MAGIC0  'E'
+#define JN_MAGIC1  'J'
+#define JN_HDRSIZE 8
+/* <len lo><len hi><tpcidx> */
+#define JN_RECHDR  3
+
+#ifdef __AVR__
+void eseyeEEPROMStore::read(uint16_t addr, uint8_t *data, uint16_t len){
+  eeprom_read_block(data, (const void *)(uintptr_t)(this->base + addr), len);
+}
+
+void eseyeEEPROMStore::write(uint16_t addr, const uint8_t *data, uint16_t len){
+  eeprom_update_block(data, (void *)(uintptr_t)(this->base + addr), len);
+}
+#endif
+
+/* Print which appends to the record being added - wrapped in an
+ * eseyePubOut so writers are held to the record length */
+class eseyeJournalOut : public Print
+{
+public:
+  eseyeJournalOut(eseyeJournal *jn) : jn(jn) {}
+  virtual size_t write(uint8_t c) {
+    this->jn->jnput(&c, 1);
+    return 1;
+  }
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    this->jn->jnput(buffer, size);
+    return size;
+  }
+  using Print::write;
+private:
+  eseyeJournal *jn;
+};
+
+void eseyeJournal::jnreset(void){
+  this->jnstore = NULL;
+  this->jnbusy = false;
+  this->journaled = 0;
+  this->replayed = 0;
+  this->evicted = 0;
+}
+
+/* Pick up the records already in store - anything not carrying a valid
+ * header is formatted as an empty journal */
+void eseyeJournal::jnattach(eseyeJournalStore *store, unsigned long replayms){
+  uint8_t hdr[JN_HDRSIZE];
+  uint16_t span;
+  this->jnstore = NULL;
+  this->jninterval = replayms;
+  this->jnlast = millis() - replayms;
+  if(store == NULL || store->size() <= JN_HDRSIZE + JN_RECHDR)
+    return;
+  this->jnstore = store;
+  span = this->jnspan();
+  store->read(0, hdr, sizeof(hdr));
+  this->jnfirst = hdr[2] | (hdr[3] << 8);
+  this->jnused = hdr[4] | (hdr[5] << 8);
+  this->jnrecords = hdr[6] | (hdr[7] << 8);
+  if(hdr[0] != JN_MAGIC0 || hdr[1] != JN_MAGIC1 || this->jnfirst >= span || this->jnused > span ||
+     (unsigned long)this->jnrecords * JN_RECHDR > this->jnused || (this->jnrecords == 0) != (this->jnused == 0)){
+    this->jnfirst = 0;
+    this->jnused = 0;
+    this->jnrecords = 0;
+    this->jnsave();
+  }
+}
+
+/* Bytes of the store the ring can use */
+uint16_t eseyeJournal::jnspan(void){
+  return this->jnstore->size() - JN_HDRSIZE;
+}
+
+/* Read or write len bytes at ring offset off, wrapping at the end */
+void eseyeJournal::jnio(uint16_t off, uint8_t *data, uint16_t len, boolean write){
+  uint16_t span = this->jnspan();
+  uint16_t n;
+  while(len > 0){
+    n = span - off;
+    if(n > len)
+      n = len;
+    if(write)
+      this->jnstore->write(JN_HDRSIZE + off, data, n);
+    else
+      this->jnstore->read(JN_HDRSIZE + off, data, n);
+    data += n;
+    len -= n;
+    off = 0;
+  }
+}
+
+void eseyeJournal::jnsave(void){
+  uint8_t hdr[JN_HDRSIZE] = {
+    JN_MAGIC0, JN_MAGIC1,
+    (uint8_t)(this->jnfirst & 0xff), (uint8_t)(this->jnfirst >> 8),
+    (uint8_t)(this->jnused & 0xff), (uint8_t)(this->jnused >> 8),
+    (uint8_t)(this->jnrecords & 0xff), (uint8_t)(this->jnrecords >> 8)
+  };
+  this->jnstore->write(0, hdr, sizeof(hdr));
+  this->jnstore->commit();
+}
+
+/* Start a record of len bytes, dropping the oldest records to make room -
+ * false if it can't fit (the record being replayed can't be dropped) */
+boolean eseyeJournal::jnbegin(uint8_t tpcidx, uint16_t len){
+  uint8_t hdr[JN_RECHDR];
+  unsigned long need = (unsigned long)len + JN_RECHDR;
+  uint16_t span;
+  if(this->jnstore == NULL)
+    return false;
+  span = this->jnspan();
+  if(need > span){
+    this->evicted++;
+    return false;
+  }
+  while((unsigned long)(span - this->jnused) < need){
+    if(this->jnbusy){
+      this->evicted++;
+      return false;
+    }
+    this->jndrop();
+    this->evicted++;
+  }
+  hdr[0] = len & 0xff;
+  hdr[1] = len >> 8;
+  hdr[2] = tpcidx;
+  this->jnwr = (this->jnfirst + this->jnused) % span;
+  this->jnio(this->jnwr, hdr, JN_RECHDR, true);
+  this->jnwr = (this->jnwr + JN_RECHDR) % span;
+  this->jnadding = need;
+  return true;
+}
+
+void eseyeJournal::jnput(const uint8_t *data, uint16_t len){
+  this->jnio(this->jnwr, (uint8_t *)data, len, true);
+  this->jnwr = (this->jnwr + len) % this->jnspan();
+}
+
+/* Take the record added into the journal */
+void eseyeJournal::jnend(void){
+  this->jnused += this->jnadding;
+  this->jnrecords++;
+  this->jnsave();
+  this->journaled++;
+}
+
+/* Remove the oldest record */
+void eseyeJournal::jndrop(void){
+  uint8_t hdr[JN_RECHDR];
+  uint16_t size;
+  this->jnio(this->jnfirst, hdr, JN_RECHDR, false);
+  size = JN_RECHDR + (hdr[0] | (hdr[1] << 8));
+  this->jnfirst = (this->jnfirst + size) % this->jnspan();
+  this->jnused -= size;
+  this->jnrecords--;
+  if(this->jnrecords == 0){
+    this->jnfirst = 0;
+    this->jnused = 0;
+  }
+  this->jnsave();
+}
+
+boolean eseyeJournal::jnkeep(uint8_t tpcidx, const uint8_t *data, uint16_t len){
+  if(this->jnbegin(tpcidx, len) == false)
+    return false;
+  this->jnput(data, len);
+  this->jnend();
+  return true;
+}
+
+boolean eseyeJournal::jnwrite(uint8_t tpcidx, uint16_t len, _pubwriter writer, void *ctx){
+  if(this->jnbegin(tpcidx, len) == false)
+    return false;
+  eseyeJournalOut jout(this);
+  eseyePubOut out(&jout, len);
+  writer(&out, len, ctx);
+  out.pad();
+  this->jnend();
+  return true;
+}
+
+boolean eseyeJournal::jnhead(uint8_t *tpcidx, uint16_t *len){
+  uint8_t hdr[JN_RECHDR];
+  if(this->jnstore == NULL || this->jnrecords == 0 || this->jnbusy)
+    return false;
+  this->jnio(this->jnfirst, hdr, JN_RECHDR, false);
+  *len = hdr[0] | (hdr[1] << 8);
+  *tpcidx = hdr[2];
+  return true;
+}
+
+unsigned long eseyeJournal::jnwait(unsigned long now){
+  if(now - this->jnlast >= this->jninterval)
+    return 0;
+  return this->jninterval - (now - this->jnlast);
+}
+
+void eseyeJournal::jnsent(uint8_t id){
+  this->jnbusy = true;
+  this->jnid = id;
+  this->jnlast = millis();
+}
+
+boolean eseyeJournal::jndone(uint8_t id, boolean success){
+  if(this->jnbusy == false || id != this->jnid)
+    return false;
+  this->jnbusy = false;
+  if(success){
+    this->jndrop();
+    this->replayed++;
+  }
+  return true;
+}
+
+void eseyeJournal::jndiscard(void){
+  if(this->jnstore == NULL || this->jnrecords == 0 || this->jnbusy)
+    return;
+  this->jndrop();
+  this->evicted++;
+}
+
+void eseyeJournal::jncounts(struct eseyeJournalCounts *counts){
+  counts->journaled = this->journaled;
+  counts->replayed = this->replayed;
+  counts->evicted = this->evicted;
+  counts->records = this->jnstore != NULL ? this->jnrecords : 0;
+}
+
+/* Copy the oldest record's payload from the store to the modem */
+void eseyeJournal::jnreplay(Print *out, uint16_t datalen, void *ctx){
+  eseyeJournal *jn = (eseyeJournal *)ctx;
+  uint8_t buf[16];
+  uint16_t off = (jn->jnfirst + JN_RECHDR) % jn->jnspan();
+  uint16_t n;
+  while(datalen > 0){
+    n = datalen < sizeof(buf) ? datalen : sizeof(buf);
+    jn->jnio(off, buf, n, false);
+    out->write(buf, n);
+    off = (off + n) % jn->jnspan();
+    datalen -= n;
+  }
+}
@@ -0,0 +1,152 @@
+/***************************************************************************
+  eseyeaws library - multiple modem poller
+
+  eseyeAWSPoller drives several eseyeAWS instances (of any configuration)
+  from one loop(). Each poll() visits every instance once, starting one
+  further round each time, with a byte budget per instance so one busy
+  modem can't starve the others. publish()/publishref() spread messages
+  across the modems by putting each one on the instance with the shortest
+  publish queue.
+
+ ***************************************************************************/
+
+#ifndef ESEYEAWS_POLLER_H__
+#define ESEYEAWS_POLLER_H__
+
+#include "eseyeaws.h"
+
+/* An instance as seen by the poller - it is called through functions made
+ * for its configuration so eseyeAWSBasic doesn't need a vtable */
+struct eseyelink{
+  void *aws;
+  void (*poll)(void *aws, uint16_t budget);
+  uint8_t (*queued)(void *aws);
+  int (*publish)(void *aws, int tpcidx, uint8_t *data, uint8_t datalen);
+  int (*publishref)(void *aws, int tpcidx, const uint8_t *data, uint16_t datalen);
+};
+
+template<uint8_t N>
+class eseyeAWSPoller
+{
+public:
+    eseyeAWSPoller() : links(0), pollfirst(0), pubfirst(0) {}
+
+    /* Add an instance - returns its link number or -1 if full */
+    template<class AWS> int add(AWS *aws);
+    uint8_t count(void) { return this->links; }
+
+    /* Poll every instance once, each handling up to budget received bytes
+     * (0 = all available) */
+    void poll(uint16_t budget = 0);
+
+    /* Publish on the link with the fewest queued publishes - tpcidx[link] is
+     * the topic's pubreg() index on each link (-1 where it isn't registered).
+     * Returns the publish id and sets *used to the link used, or -1 if no
+     * link could take it */
+    int publish(const int *tpcidx, uint8_t *data, uint8_t datalen, uint8_t *used = NULL);
+    int publishref(const int *tpcidx, const uint8_t *data, uint16_t datalen, uint8_t *used = NULL);
+
+private:
+    static_assert(N > 0 && N <= 16, "eseyeAWSPoller handles 1 to 16 instances");
+
+    template<class AWS> static void linkpoll(void *aws, uint16_t budget) { ((AWS *)aws)->poll(budget); }
+    template<class AWS> static uint8_t linkqueued(void *aws) { return ((AWS *)aws)->pubqueued(); }
+    template<class AWS> static int linkpublish(void *aws, int tpcidx, uint8_t *data, uint8_t datalen) {
+      return ((AWS *)aws)->publish(tpcidx, data, datalen);
+    }
+    template<class AWS> static int linkpublishref(void *aws, int tpcidx, const uint8_t *data, uint16_t datalen) {
+      return ((AWS *)aws)->publishref(tpcidx, data, datalen);
+    }
+    int leastqueued(const int *tpcidx, uint16_t tried);
+
+    struct eseyelink link[N];
+    uint8_t links;
+    uint8_t pollfirst;
+    uint8_t pubfirst;
+};
+
+template<uint8_t N>
+template<class AWS>
+int eseyeAWSPoller<N>::add(AWS *aws){
+  if(this->links == N || aws == NULL)
+    return -1;
+  this->link[this->links].aws = aws;
+  this->link[this->links].poll = linkpoll<AWS>;
+  this->link[this->links].queued = linkqueued<AWS>;
+  this->link[this->links].publish = linkpublish<AWS>;
+  this->link[this->links].publishref = linkpublishref<AWS>;
+  return this->links++;
+}
+
+template<uint8_t N>
+void eseyeAWSPoller<N>::poll(uint16_t budget){
+  uint8_t i, l;
+  if(this->links == 0)
+    return;
+  l = this->pollfirst;
+  for(i = 0; i < this->links; i++){
+    this->link[l].poll(this->link[l].aws, budget);
+    if(++l == this->links)
+      l = 0;
+  }
+  /* Whoever went first goes last next time */
+  if(++this->pollfirst >= this->links)
+    this->pollfirst = 0;
+}
+
+/* The untried link with a registered topic and the shortest queue - ties go
+ * round-robin so idle links share the load */
+template<uint8_t N>
+int eseyeAWSPoller<N>::leastqueued(const int *tpcidx, uint16_t tried){
+  uint8_t i, l, queued, best = 0xff;
+  int found = -1;
+  l = this->pubfirst;
+  for(i = 0; i < this->links; i++){
+    if((tried & (1U << l)) == 0 && tpcidx[l] >= 0){
+      queued = this->link[l].queued(this->link[l].aws);
+      if(found < 0 || queued < best){
+        found = l;
+        best = queued;
+      }
+    }
+    if(++l == this->links)
+      l = 0;
+  }
+  return found;
+}
+
+template<uint8_t N>
+int eseyeAWSPoller<N>::publish(const int *tpcidx, uint8_t *data, uint8_t datalen, uint8_t *used){
+  uint16_t tried = 0;
+  int l, id;
+  while((l = this->leastqueued(tpcidx, tried)) >= 0){
+    id = this->link[l].publish(this->link[l].aws, tpcidx[l], data, datalen);
+    if(id >= 0){
+      if(used != NULL)
+        *used = l;
+      this->pubfirst = l + 1 < this->links ? l + 1 : 0;
+      return id;
+    }
+    tried |= 1U << l;
+  }
+  return -1;
+}
+
+template<uint8_t N>
+int eseyeAWSPoller<N>::publishref(const int *tpcidx, const uint8_t *data, uint16_t datalen, uint8_t *used){
+  uint16_t tried = 0;
+  int l, id;
+  while((l = this->leastqueued(tpcidx, tried)) >= 0){
+    id = this->link[l].publishref(this->link[l].aws, tpcidx[l], data, datalen);
+    if(id >= 0){
+      if(used != NULL)
+        *used = l;
+      this->pubfirst = l + 1 < this->links ? l + 1 : 0;
+      return id;
+    }
+    tried |= 1U << l;
+  }
+  return -1;
+}
+
+#endif // ESEYEAWS_POLLER_H__
@@ -0,0 +1,250 @@
+/***************************************************************************
+  eseyeaws library - receive ring
+
+  A ring of received bytes filled from a uart receive interrupt and read as
+  the modem Stream. head only moves in the interrupt and tail only in the
+  reader, so the only shared state the reader has to take with interrupts
+  off is the 16 bit indices and the loss marker.
+
+  A loss (a byte which found the ring full, or the uart reporting its own
+  overrun) leaves a marker where the missing bytes would have been. The
+  reader sees no bytes past it until gap() has been called there, so a
+  line or message can't silently run on into bytes from after the loss. A
+  second loss before the first is reported drops everything received after
+  the first, which merges them into one.
+
+  On AVR, defining ESEYEAWS_RX_USART as a USART number makes begin() run
+  that USART with its receive interrupt calling put(), and writes go
+  straight to its data register.
+
+ ***************************************************************************/
+
+#include "eseyeaws.h"
+
+eseyeRxRing::eseyeRxRing(uint8_t *buf, uint16_t size, Print *out) : buf(buf), out(out){
+  uint16_t pow2 = 1;
+  /* The largest power of two that fits */
+  while(pow2 <= size / 2 && pow2 < 0x8000)
+    pow2 <<= 1;
+  this->mask = pow2 - 1;
+  this->head = 0;
+  this->tail = 0;
+  this->gapat = 0;
+  this->gapped = false;
+  this->losing = false;
+  memset(&this->rc, 0, sizeof(this->rc));
+}
+
+/* Receive interrupt side */
+
+void eseyeRxRing::put(uint8_t c){
+  uint16_t h = this->head;
+  uint16_t used = h - this->tail;
+  if(used > this->mask){
+    this->lost();
+    return;
+  }
+  this->buf[h & this->mask] = c;
+  this->head = h + 1;
+  this->losing = false;
+  this->rc.received++;
+  if(used + 1 > this->rc.highwater)
+    this->rc.highwater = used + 1;
+}
+
+void eseyeRxRing::lost(void){
+  this->rc.dropped++;
+  if(this->losing)
+    return;
+  this->losing = true;
+  this->rc.overruns++;
+  if(this->gapped){
+    /* The reader hasn't reached the last loss - what came after it goes too */
+    this->rc.dropped += (uint16_t)(this->head - this->gapat);
+    this->head = this->gapat;
+  }else{
+    this->gapat = this->head;
+    this->gapped = true;
+  }
+}
+
+/* Reader side */
+
+/* Bytes before the next loss */
+uint16_t eseyeRxRing::readable(void){
+  uint16_t end;
+  noInterrupts();
+  end = this->gapped ? this->gapat : this->head;
+  interrupts();
+  return end - this->tail;
+}
+
+int eseyeRxRing::available(void){
+  return this->readable();
+}
+
+int eseyeRxRing::peek(void){
+  if(this->readable() == 0)
+    return -1;
+  return this->buf[this->tail & this->mask];
+}
+
+int eseyeRxRing::read(void){
+  uint8_t c;
+  if(this->readable() == 0)
+    return -1;
+  c = this->buf[this->tail & this->mask];
+  noInterrupts();
+  this->tail++;
+  interrupts();
+  return c;
+}
+
+/* Never waits - copies what is there, in at most two runs */
+size_t eseyeRxRing::readBytes(char *buffer, size_t length){
+  uint16_t n = this->readable();
+  uint16_t off = this->tail & this->mask;
+  uint16_t first;
+  if(length < n)
+    n = length;
+  first = this->mask + 1 - off;
+  if(first > n)
+    first = n;
+  memcpy(buffer, &this->buf[off], first);
+  memcpy(&buffer[first], this->buf, n - first);
+  noInterrupts();
+  this->tail += n;
+  interrupts();
+  return n;
+}
+
+boolean eseyeRxRing::gap(void){
+  boolean hit;
+  noInterrupts();
+  hit = this->gapped && this->tail == this->gapat;
+  if(hit)
+    this->gapped = false;
+  interrupts();
+  return hit;
+}
+
+void eseyeRxRing::clear(void){
+  noInterrupts();
+  this->tail = this->head;
+  this->gapped = false;
+  interrupts();
+}
+
+void eseyeRxRing::counts(struct eseyeRxCounts *counts, boolean reset){
+  noInterrupts();
+  memcpy(counts, &this->rc, sizeof(*counts));
+  if(reset)
+    memset(&this->rc, 0, sizeof(this->rc));
+  interrupts();
+}
+
+#if defined(__AVR__) && defined(ESEYEAWS_RX_USART)
+
+#define ESEYE_USART_CAT_(a, b, c) a##b##c
+#define ESEYE_USART_CAT(a, b, c) ESEYE_USART_CAT_(a, b, c)
+#define ESEYE_UDR   ESEYE_USART_CAT(UDR, ESEYEAWS_RX_USART, )
+#define ESEYE_UCSRA ESEYE_USART_CAT(UCSR, ESEYEAWS_RX_USART, A)
+#define ESEYE_UCSRB ESEYE_USART_CAT(UCSR, ESEYEAWS_RX_USART, B)
+#define ESEYE_UCSRC ESEYE_USART_CAT(UCSR, ESEYEAWS_RX_USART, C)
+#define ESEYE_UBRR  ESEYE_USART_CAT(UBRR, ESEYEAWS_RX_USART, )
+/* Bit names carry the USART number too (a 32u4 only has the 1s) */
+#define ESEYE_USART_BIT(name) _BV(ESEYE_USART_CAT(name, ESEYEAWS_RX_USART, ))
+/* Parts with one USART call its vector USART_RX_vect */
+#if ESEYEAWS_RX_USART == 0 && defined(USART_RX_vect)
+#define ESEYE_USART_RX_VECT USART_RX_vect
+#else
+#define ESEYE_USART_RX_VECT ESEYE_USART_CAT(USART, ESEYEAWS_RX_USART, _RX_vect)
+#endif
+
+eseyeRxRing *eseyeRxRing::usartring;
+/* Something has been written since begin(), so TXC will be set */
+static volatile boolean usartsent;
+
+ISR(ESEYE_USART_RX_VECT){
+  /* The status has to be read before the data it describes */
+  uint8_t status = ESEYE_UCSRA;
+  uint8_t c = ESEYE_UDR;
+  if(eseyeRxRing::usartring == NULL)
+    return;
+  if(status & ESEYE_USART_BIT(DOR))
+    eseyeRxRing::usartring->lost();
+  eseyeRxRing::usartring->put(c);
+}
+
+/* Double speed unless the divisor doesn't fit without it, as the core does */
+void eseyeRxRing::begin(unsigned long baud){
+  uint16_t ubrr = (F_CPU / 4 / baud - 1) / 2;
+  uint8_t ucsra = ESEYE_USART_BIT(U2X);
+  if(ubrr > 4095){
+    ucsra = 0;
+    ubrr = (F_CPU / 8 / baud - 1) / 2;
+  }
+  ESEYE_UCSRB = 0;
+  usartring = this;
+  usartsent = false;
+  this->out = NULL;
+  ESEYE_UCSRA = ucsra;
+  ESEYE_UBRR = ubrr;
+  ESEYE_UCSRC = _BV(ESEYE_USART_CAT(UCSZ, ESEYEAWS_RX_USART, 1)) | _BV(ESEYE_USART_CAT(UCSZ, ESEYEAWS_RX_USART, 0));
+  ESEYE_UCSRB = ESEYE_USART_BIT(RXEN) | ESEYE_USART_BIT(TXEN) | ESEYE_USART_BIT(RXCIE);
+}
+
+size_t eseyeRxRing::write(uint8_t c){
+  if(this->out != NULL)
+    return this->out->write(c);
+  while(!(ESEYE_UCSRA & ESEYE_USART_BIT(UDRE)))
+    ;
+  ESEYE_UDR = c;
+  usartsent = true;
+  /* Clear TXC (by writing it) so flush() can wait for it */
+  ESEYE_UCSRA = (ESEYE_UCSRA & ESEYE_USART_BIT(U2X)) | ESEYE_USART_BIT(TXC);
+  return 1;
+}
+
+int eseyeRxRing::availableForWrite(void){
+  if(this->out != NULL)
+    return this->out->availableForWrite();
+  return (ESEYE_UCSRA & ESEYE_USART_BIT(UDRE)) ? 1 : 0;
+}
+
+void eseyeRxRing::flush(void){
+  if(this->out != NULL){
+    this->out->flush();
+    return;
+  }
+  /* Until the last byte has left the shift register */
+  if(usartsent)
+    while(!(ESEYE_UCSRA & ESEYE_USART_BIT(TXC)))
+      ;
+}
+
+#else
+
+size_t eseyeRxRing::write(uint8_t c){
+  return this->out != NULL ? this->out->write(c) : 0;
+}
+
+int eseyeRxRing::availableForWrite(void){
+  return this->out != NULL ? this->out->availableForWrite() : 0;
+}
+
+void eseyeRxRing::flush(void){
+  if(this->out != NULL)
+    this->out->flush();
+}
+
+#endif
+
+size_t eseyeRxRing::write(const uint8_t *buffer, size_t size){
+  size_t n = 0;
+  if(this->out != NULL)
+    return this->out->write(buffer, size);
+  while(n < size && this->write(buffer[n]) == 1)
+    n++;
+  return n;
+}
@@ -28,6 +28,8 @@ SoftwareSerial mySerial(RX_PIN, TX_PIN); // RX, TX
 #ifdef PROMICRO
 /* To use hardware serial (Serial1) */
 #define ATSerial Serial1
+/* Hardware serial keeps up with a faster link - setup() asks the modem for it */
+#define FAST_BAUD 57600
 #endif
 
 #ifndef ATSerial
@@ -81,10 +83,30 @@ static int teststate = STATE_NONE;
 void urccb(char *atresp){
   Serial.print("Got AT response data: ");
   Serial.println(atresp);
-  if(teststate == STATE_WAITICCID && strstr(atresp, "QCCID") != NULL)
-      teststate = STATE_GETAWSVER;
-  if(teststate == STATE_WAITAWSVER && strstr(atresp, "AWSVER") != NULL)
-      teststate = STATE_COMPLETE;
+}
+
+/* The replies to the ICCID and version queries come here rather than urccb -
+ * each line of the reply and then its final result */
+void iccidcb(char *line, int8_t result, void *ctx){
+  if(result == ESEYE_CMD_LINE){
+    Serial.print("ICCID reply: ");
+    Serial.println(line);
+  }else if(teststate == STATE_WAITICCID){
+    if(result != 0)
+      Serial.println("Failed to get ICCID");
+    teststate = STATE_GETAWSVER;
+  }
+}
+
+void awsvercb(char *line, int8_t result, void *ctx){
+  if(result == ESEYE_CMD_LINE){
+    Serial.print("AWSVER reply: ");
+    Serial.println(line);
+  }else if(teststate == STATE_WAITAWSVER){
+    if(result != 0)
+      Serial.println("Failed to get AWSVER");
+    teststate = STATE_COMPLETE;
+  }
 }
 
 void testcb(uint8_t *data, uint8_t length){
@@ -97,6 +119,12 @@ void mysubcb(uint8_t *data, uint8_t length){
   Serial.println((char *)data);    
 }
 
+#ifdef FAST_BAUD
+void setbaud(unsigned long baud, void *ctx){
+  ATSerial.begin(baud);
+}
+#endif
+
 void setup() {
   Serial.begin(115200);
 
@@ -106,6 +134,11 @@ void setup() {
 
   delay(2000);
 
+#ifdef FAST_BAUD
+  Serial.print("Modem link at ");
+  Serial.println(myAWS.baudup(9600, FAST_BAUD, setbaud));
+#endif
+
   lasttime = millis();
 
   myAWS.pubunreg(0);
@@ -309,7 +342,7 @@ void loop() {
     case STATE_GETICCID:
       if(timesince > 2000){
         lasttime = millis();
-        myAWS.sendAT("at+qccid\r\n");
+        myAWS.sendAT("at+qccid\r\n", iccidcb);
         teststate = STATE_WAITICCID;
       }
       break;
@@ -322,7 +355,7 @@ void loop() {
       break;
     case STATE_GETAWSVER:
         lasttime = millis();
-        myAWS.sendAT("at+awsver\r\n");
+        myAWS.sendAT("at+awsver\r\n", awsvercb);
         teststate = STATE_WAITAWSVER;
       break;
     case STATE_WAITAWSVER:  
@@ -0,0 +1,382 @@
+/***************************************************************************
+  Cycle counts for the eseyeaws library on an ATmega328P under simavr.
+
+  Runs the bench_avr firmware in simavr with the simulated modem (SimModem
+  from extras/host) on its uart. The firmware brackets each library call
+  with a marker in GPIOR0. The runner notes the cycle count at every marker,
+  so each span is exact and nothing is added to the code being measured.
+  In turn it subscribes and registers, sends a run of each kind of URC,
+  publishes, then unsubscribes, and reports:
+
+      call.<name>      cycles for subscribe(), pubreg(), publish() and
+                       unsubscribe() (the commands are written to the uart
+                       buffer, not sent)
+      poll.idle        cycles for a poll() with nothing received
+      urc.<type>       poll() cycles per URC of each type
+      byte.payload     extra poll() cycles per byte of message payload
+      poll.worst       the longest single poll()
+      ram.<area>       static data, stack high-water mark, heap and the
+                       eseyeAWS instance, in bytes
+
+  poll() spans include the uart receive and timer interrupts which land in
+  them, as they would on the part. The output is one "name value" line per
+  result, so runs can be kept and compared: --compare <file> reads an
+  earlier run, prints the change for each result and fails if any cycle
+  count grew by more than --tolerance percent (default 2) or any RAM figure
+  grew at all.
+
+  --baud must match the BENCH_BAUD the firmware was built with.
+
+  Unverified: neither this runner nor the bench_avr firmware has been built
+  or run yet, so there are no results to compare against.
+
+  usage: avr_bench <firmware.elf> [--mcu atmega328p] [--freq 16000000]
+                   [--baud 115200] [--count n] [--compare file]
+                   [--tolerance percent]
+
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "sim_irq.h"
+#include "avr_uart.h"
+
+#include "simmodem.h"
+#include "bench_avr/benchproto.h"
+
+/* Data space addresses of GPIOR0..2 on the ATmega328P */
+#define GPIOR0_ADDR 0x3e
+#define GPIOR1_ADDR 0x4a
+#define GPIOR2_ADDR 0x4b
+
+/* Cycles spent in one kind of span */
+struct spanstats
+{
+    unsigned long long total;
+    unsigned long long worst;
+    unsigned long count;
+};
+
+struct bench
+{
+    avr_t *avr;
+    SimModem modem;
+    avr_irq_t *uartin;
+    bool xon;
+    uint8_t open;
+    avr_cycle_count_t openedat;
+    bool ready;
+    /* Cycles a byte takes on the uart and when the last one went either way */
+    unsigned long bytecycles;
+    avr_cycle_count_t lastbyte;
+    std::map<uint8_t, struct spanstats> spans;
+    unsigned long long pollworst;
+    std::string report;
+    bool reported;
+};
+
+static struct bench b;
+
+static void markwrite(struct avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param){
+    (void)param;
+    avr->data[addr] = v;
+    if(v == MARK_READY){
+        b.ready = true;
+    }else if(v == MARK_END){
+        if(b.open != 0){
+            struct spanstats &s = b.spans[b.open];
+            unsigned long long span = avr->cycle - b.openedat;
+            s.total += span;
+            s.count++;
+            if(span > s.worst)
+                s.worst = span;
+            if((b.open == MARK_POLL || b.open == MARK_IDLE) && span > b.pollworst)
+                b.pollworst = span;
+        }
+        b.open = 0;
+    }else{
+        b.open = v;
+        b.openedat = avr->cycle;
+    }
+}
+
+static void reportwrite(struct avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param){
+    (void)param;
+    avr->data[addr] = v;
+    if(v == '\0')
+        b.reported = true;
+    else
+        b.report += (char)v;
+}
+
+/* Bytes the firmware writes to the uart go to the modem */
+static void uartout(struct avr_irq_t *irq, uint32_t value, void *param){
+    (void)irq;
+    (void)param;
+    b.modem.write((uint8_t)value);
+    b.lastbyte = b.avr->cycle;
+}
+
+static void uartxon(struct avr_irq_t *irq, uint32_t value, void *param){
+    (void)irq;
+    (void)value;
+    (void)param;
+    b.xon = true;
+}
+
+static void uartxoff(struct avr_irq_t *irq, uint32_t value, void *param){
+    (void)irq;
+    (void)value;
+    (void)param;
+    b.xon = false;
+}
+
+/* Run the part for a while - the modem's clock follows the cycle count and
+ * its output is fed to the uart as fast as the uart takes it */
+static bool step(void){
+    int state = avr_run(b.avr);
+    if(state == cpu_Done || state == cpu_Crashed){
+        fprintf(stderr, "avr_bench: the firmware stopped (state %d) at cycle %llu\n",
+                state, (unsigned long long)b.avr->cycle);
+        return false;
+    }
+    hostSetMillis(b.avr->cycle * 1000 / b.avr->frequency);
+    b.modem.tick();
+    while(b.xon && b.modem.available() > 0){
+        avr_raise_irq(b.uartin, b.modem.read());
+        b.lastbyte = b.avr->cycle;
+    }
+    return true;
+}
+
+/* Run until the uart has been quiet both ways for a few byte times (so
+ * nothing is still being shifted in or out) with the firmware idle */
+static bool settle(void){
+    unsigned long idles = b.spans[MARK_IDLE].count;
+    while(b.spans[MARK_IDLE].count < idles + 4 || b.modem.available() > 0 ||
+          b.avr->data[GPIOR1_ADDR] != CMD_NONE || b.avr->cycle - b.lastbyte < 4 * b.bytecycles){
+        if(!step())
+            return false;
+    }
+    return true;
+}
+
+static bool request(uint8_t cmd){
+    b.avr->data[GPIOR1_ADDR] = cmd;
+    return settle();
+}
+
+/* poll() cycles spent on what a step did - the busy polls since from */
+static unsigned long long pollcycles(const struct spanstats &from){
+    return b.spans[MARK_POLL].total - from.total;
+}
+
+static void result(std::vector<std::pair<std::string, double> > &results, const char *name, double value){
+    results.push_back(std::make_pair(std::string(name), value));
+    printf("%-16s %.1f\n", name, value);
+}
+
+/* Compare with an earlier run - returns false if anything regressed */
+static bool compare(const char *path, const std::vector<std::pair<std::string, double> > &results, double tolerance){
+    std::map<std::string, double> old;
+    char line[128], name[64];
+    double value;
+    bool ok = true;
+    int end;
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL){
+        perror(path);
+        return false;
+    }
+    /* Results are lines of exactly a name and a value - skip anything else */
+    while(fgets(line, sizeof(line), fp) != NULL){
+        end = 0;
+        if(line[0] != '#' && sscanf(line, "%63s %lf %n", name, &value, &end) == 2 && line[end] == '\0')
+            old[name] = value;
+    }
+    fclose(fp);
+    printf("\n%-16s %10s %10s %8s\n", "", "was", "now", "change");
+    for(size_t i = 0; i < results.size(); i++){
+        const std::string &key = results[i].first;
+        bool ram = key.compare(0, 4, "ram.") == 0;
+        double change;
+        if(old.find(key) == old.end() || old[key] == 0)
+            continue;
+        change = (results[i].second - old[key]) * 100 / old[key];
+        bool worse = ram ? results[i].second > old[key] : change > tolerance;
+        printf("%-16s %10.1f %10.1f %+7.1f%%%s\n", key.c_str(), old[key], results[i].second, change,
+               worse ? "  REGRESSED" : "");
+        if(worse)
+            ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char **argv){
+    static const struct { const char *name; const char *text; } lines[] = {
+        {"urc.line", "+CSQ: 17,99\r\n"},
+        {"urc.ok", "OK\r\n"},
+        {"urc.rdy", "RDY\r\n"},
+    };
+    std::vector<std::pair<std::string, double> > results;
+    const char *mcu = "atmega328p";
+    const char *baseline = NULL;
+    unsigned long freq = 16000000;
+    unsigned long baud = 115200;
+    unsigned long count = 200;
+    double tolerance = 2;
+    elf_firmware_t fw;
+    uint8_t payload[64];
+    struct spanstats from;
+    unsigned long long msg8, msg64;
+    uint32_t flags = 0;
+    int i;
+
+    if(argc < 2){
+        fprintf(stderr, "usage: %s <firmware.elf> [--mcu name] [--freq hz] [--baud rate] [--count n]\n"
+                        "       [--compare file] [--tolerance percent]\n", argv[0]);
+        return 2;
+    }
+    for(i = 2; i < argc; i++){
+        if(strcmp(argv[i], "--mcu") == 0 && i + 1 < argc)
+            mcu = argv[++i];
+        else if(strcmp(argv[i], "--freq") == 0 && i + 1 < argc)
+            freq = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+            baud = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+            count = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+            baseline = argv[++i];
+        else if(strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+    }
+    if(count == 0)
+        count = 1;
+    if(baud == 0)
+        baud = 115200;
+
+    memset(&fw, 0, sizeof(fw));
+    if(elf_read_firmware(argv[1], &fw) != 0){
+        fprintf(stderr, "avr_bench: can't read %s\n", argv[1]);
+        return 1;
+    }
+    b.avr = avr_make_mcu_by_name(mcu);
+    if(b.avr == NULL){
+        fprintf(stderr, "avr_bench: simavr doesn't know %s\n", mcu);
+        return 1;
+    }
+    avr_init(b.avr);
+    avr_load_firmware(b.avr, &fw);
+    /* After loading, which takes the frequency from the firmware if it has one */
+    b.avr->frequency = freq;
+    b.bytecycles = freq * 10 / baud;
+
+    /* The uart talks to the modem rather than simavr's stdio */
+    avr_ioctl(b.avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+    flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(b.avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+    b.uartin = avr_io_getirq(b.avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+    avr_irq_register_notify(avr_io_getirq(b.avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT), uartout, NULL);
+    avr_irq_register_notify(avr_io_getirq(b.avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUT_XON), uartxon, NULL);
+    avr_irq_register_notify(avr_io_getirq(b.avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUT_XOFF), uartxoff, NULL);
+    avr_register_io_write(b.avr, GPIOR0_ADDR, markwrite, NULL);
+    avr_register_io_write(b.avr, GPIOR2_ADDR, reportwrite, NULL);
+
+    hostUseSimClock(true);
+    hostSetMillis(0);
+    while(!b.ready){
+        if(!step())
+            return 1;
+    }
+    printf("# eseyeaws on %s at %lu Hz, %lu URCs of each type\n", mcu, freq, count);
+
+    if(!request(CMD_SUBSCRIBE) || !request(CMD_PUBREG))
+        return 1;
+    if(!settle())
+        return 1;
+    result(results, "call.subscribe", b.spans[MARK_SUBSCRIBE].total);
+    result(results, "call.pubreg", b.spans[MARK_PUBREG].total);
+
+    /* Messages - the payload cost is the difference between two sizes */
+    memset(payload, 'm', sizeof(payload));
+    from = b.spans[MARK_POLL];
+    for(unsigned long n = 0; n < count; n++){
+        b.modem.inject(0, payload, 8);
+        if(!settle())
+            return 1;
+    }
+    msg8 = pollcycles(from);
+    from = b.spans[MARK_POLL];
+    for(unsigned long n = 0; n < count; n++){
+        b.modem.inject(0, payload, sizeof(payload));
+        if(!settle())
+            return 1;
+    }
+    msg64 = pollcycles(from);
+    result(results, "urc.msg8", (double)msg8 / count);
+    result(results, "urc.msg64", (double)msg64 / count);
+    result(results, "byte.payload", (double)(msg64 - msg8) / count / (sizeof(payload) - 8));
+
+    /* Lines for the application, stray results and modem restarts */
+    for(i = 0; i < (int)(sizeof(lines) / sizeof(lines[0])); i++){
+        from = b.spans[MARK_POLL];
+        for(unsigned long n = 0; n < count; n++){
+            b.modem.injectRaw(lines[i].text);
+            if(!settle())
+                return 1;
+        }
+        result(results, lines[i].name, (double)pollcycles(from) / count);
+    }
+
+    /* Publishes - the prompt, payload and SEND OK */
+    from = b.spans[MARK_POLL];
+    for(unsigned long n = 0; n < count; n++){
+        if(!request(CMD_PUBLISH))
+            return 1;
+    }
+    result(results, "call.publish", (double)b.spans[MARK_PUBLISH].total / b.spans[MARK_PUBLISH].count);
+    result(results, "urc.publish", (double)pollcycles(from) / count);
+
+    if(!request(CMD_UNSUBSCRIBE))
+        return 1;
+    result(results, "call.unsubscribe", b.spans[MARK_UNSUBSCRIBE].total);
+    result(results, "poll.idle", (double)b.spans[MARK_IDLE].total / b.spans[MARK_IDLE].count);
+    result(results, "poll.worst", b.pollworst);
+
+    /* RAM, reported by the firmware */
+    b.avr->data[GPIOR1_ADDR] = CMD_REPORT;
+    while(!b.reported){
+        if(!step())
+            return 1;
+    }
+    {
+        char name[32];
+        unsigned long value, msgs = 0;
+        const char *p = b.report.c_str();
+        int n;
+        while(sscanf(p, "%31s %lu\n%n", name, &value, &n) == 2){
+            if(strcmp(name, "msgs") == 0)
+                msgs = value;
+            else if(strncmp(name, "ram.", 4) == 0)
+                result(results, name, value);
+            p += n;
+        }
+        if(msgs != 2 * count)
+            printf("# %lu of %lu messages arrived - the uart overran\n", msgs, 2 * count);
+    }
+    printf("# worst poll() %.1f us\n", b.pollworst * 1e6 / freq);
+
+    if(baseline != NULL && !compare(baseline, results, tolerance))
+        return 1;
+    return 0;
+}
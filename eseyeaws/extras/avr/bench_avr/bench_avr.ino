@@ -0,0 +1,135 @@
+/* Benchmark firmware for the eseyeaws library on an ATmega328P under simavr
+ *
+ * Built with arduino-cli and run by avr_bench (extras/avr/avr_bench.cpp),
+ * which plays the modem on the hardware uart. Every library call is
+ * bracketed by a marker written to GPIOR0 so the simulator can note the
+ * cycle count at each end, the runner asks for calls through GPIOR1 and
+ * the RAM report comes back a character at a time through GPIOR2. Nothing
+ * here changes timing the way a timer read or a debug print would.
+ *
+ * Not yet built for the part or run under simavr - unverified. */
+
+#include <avr/io.h>
+
+#include "eseyeaws.h"
+#include "benchproto.h"
+
+#ifndef BENCH_BAUD
+#define BENCH_BAUD 115200
+#endif
+
+#define MARK(m) (GPIOR0 = (m))
+
+/* Bytes below the stack are painted with this before main() runs */
+#define STACK_CANARY 0xc5
+
+extern uint8_t _end;
+extern uint8_t __stack;
+extern uint8_t __heap_start;
+extern uint8_t *__brkval;
+
+eseyeAWS aws(&Serial);
+
+static int subidx = -1;
+static int pubidx = -1;
+static uint16_t msgs;
+static uint16_t lines;
+static const char payload[] = "{\"Temp\":21.5}";
+
+/* Paint from the end of .bss to the top of RAM - runs from .init1, before
+ * the stack pointer and zero register are set up, so it is assembler */
+void stackpaint(void) __attribute__ ((naked)) __attribute__ ((section (".init1")));
+void stackpaint(void){
+  __asm volatile ("    ldi r30,lo8(_end)\n"
+                  "    ldi r31,hi8(_end)\n"
+                  "    ldi r24,lo8(0xc5)\n"
+                  "    ldi r25,hi8(__stack)\n"
+                  "    rjmp 2f\n"
+                  "1:\n"
+                  "    st Z+,r24\n"
+                  "2:\n"
+                  "    cpi r30,lo8(__stack)\n"
+                  "    cpc r31,r25\n"
+                  "    brlo 1b\n"
+                  "    breq 1b" ::);
+}
+
+static void msgcb(uint8_t *data, uint8_t length){
+  (void)data;
+  (void)length;
+  msgs++;
+}
+
+static void urccb(char *line){
+  (void)line;
+  lines++;
+}
+
+static void report(const char *key, unsigned long val){
+  char num[11];
+  const char *p;
+  for(p = key; *p != '\0'; p++)
+    GPIOR2 = *p;
+  GPIOR2 = ' ';
+  ultoa(val, num, 10);
+  for(p = num; *p != '\0'; p++)
+    GPIOR2 = *p;
+  GPIOR2 = '\n';
+}
+
+/* RAM use - static data, the deepest the stack has reached (the first byte
+ * from the heap up which isn't canary any more) and the heap */
+static void ramreport(void){
+  uint8_t *heapend = __brkval != NULL ? __brkval : &__heap_start;
+  uint8_t *p = heapend;
+  while(p <= &__stack && *p == STACK_CANARY)
+    p++;
+  report("ram.static", (unsigned long)(&__heap_start - (uint8_t *)RAMSTART));
+  report("ram.stack", (unsigned long)(&__stack - p + 1));
+  report("ram.heap", (unsigned long)(heapend - &__heap_start));
+  report("ram.instance", aws.instanceram());
+  report("msgs", msgs);
+  report("lines", lines);
+  GPIOR2 = '\0';
+}
+
+void setup(){
+  Serial.begin(BENCH_BAUD);
+  aws.init(urccb);
+  MARK(MARK_READY);
+}
+
+void loop(){
+  uint8_t cmd = GPIOR1;
+  if(cmd != CMD_NONE){
+    GPIOR1 = CMD_NONE;
+    switch(cmd){
+      case CMD_SUBSCRIBE:
+        MARK(MARK_SUBSCRIBE);
+        subidx = aws.subscribe((char *)"bench/sub", msgcb);
+        MARK(MARK_END);
+        break;
+      case CMD_UNSUBSCRIBE:
+        MARK(MARK_UNSUBSCRIBE);
+        aws.unsubscribe(subidx);
+        MARK(MARK_END);
+        break;
+      case CMD_PUBREG:
+        MARK(MARK_PUBREG);
+        pubidx = aws.pubreg((char *)"bench/pub");
+        MARK(MARK_END);
+        break;
+      case CMD_PUBLISH:
+        MARK(MARK_PUBLISH);
+        aws.publish(pubidx, (uint8_t *)payload, sizeof(payload) - 1);
+        MARK(MARK_END);
+        break;
+      case CMD_REPORT:
+        ramreport();
+        break;
+    }
+  }
+  MARK(Serial.available() > 0 ? MARK_POLL : MARK_IDLE);
+  aws.poll();
+  MARK(MARK_END);
+}
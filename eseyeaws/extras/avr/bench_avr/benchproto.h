@@ -0,0 +1,26 @@
+/* What bench_avr and the avr_bench runner say to each other through the
+ * general purpose I/O registers: GPIOR0 carries markers, GPIOR1 requests
+ * from the runner and GPIOR2 the report text */
+
+#ifndef BENCHPROTO_H__
+#define BENCHPROTO_H__
+
+/* Markers - each span starts with its kind and ends with MARK_END */
+#define MARK_END         1
+#define MARK_POLL        2
+#define MARK_IDLE        3
+#define MARK_SUBSCRIBE   4
+#define MARK_UNSUBSCRIBE 5
+#define MARK_PUBREG      6
+#define MARK_PUBLISH     7
+#define MARK_READY       8
+
+/* Requests from the runner */
+#define CMD_NONE        0
+#define CMD_SUBSCRIBE   1
+#define CMD_UNSUBSCRIBE 2
+#define CMD_PUBREG      3
+#define CMD_PUBLISH     4
+#define CMD_REPORT      5
+
+#endif // BENCHPROTO_H__
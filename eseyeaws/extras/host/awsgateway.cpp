@@ -0,0 +1,179 @@
+/***************************************************************************
+  Multi-threaded gateway mode for host (Linux) builds of the eseyeaws
+  library - the lock-free rings and queue and the subscription routes.
+
+ ***************************************************************************/
+
+#include <string.h>
+
+#include "awsgateway.h"
+
+uint64_t gatewayNanos(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t pow2(size_t n){
+    size_t p = 1;
+    while(p < n)
+        p <<= 1;
+    return p;
+}
+
+/* Record header - the payload follows, padded to GATEWAY_RING_ALIGN */
+struct ringhdr
+{
+    uint16_t len;
+    uint16_t tag;
+    uint64_t stampns;
+} __attribute__((packed));
+
+#define GATEWAY_RING_ALIGN 4
+
+static size_t recsize(uint16_t len){
+    return (sizeof(struct ringhdr) + len + GATEWAY_RING_ALIGN - 1) & ~(size_t)(GATEWAY_RING_ALIGN - 1);
+}
+
+GatewayRing::GatewayRing(size_t size) : buf(pow2(size < 64 ? 64 : size)), head(0), tail(0), drops(0){
+    this->mask = this->buf.size() - 1;
+}
+
+void GatewayRing::put(size_t pos, const void *data, size_t len){
+    size_t off = pos & this->mask;
+    size_t first = len < this->buf.size() - off ? len : this->buf.size() - off;
+    memcpy(&this->buf[off], data, first);
+    memcpy(&this->buf[0], (const uint8_t *)data + first, len - first);
+}
+
+void GatewayRing::get(size_t pos, void *data, size_t len){
+    size_t off = pos & this->mask;
+    size_t first = len < this->buf.size() - off ? len : this->buf.size() - off;
+    memcpy(data, &this->buf[off], first);
+    memcpy((uint8_t *)data + first, &this->buf[0], len - first);
+}
+
+bool GatewayRing::push(uint16_t tag, const uint8_t *data, uint16_t len, uint64_t stampns){
+    struct ringhdr h;
+    size_t head = this->head.load(std::memory_order_relaxed);
+    size_t need = recsize(len);
+    if(need > this->buf.size() - (head - this->tail.load(std::memory_order_acquire))){
+        this->drops.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    h.len = len;
+    h.tag = tag;
+    h.stampns = stampns;
+    this->put(head, &h, sizeof(h));
+    this->put(head + sizeof(h), data, len);
+    this->head.store(head + need, std::memory_order_release);
+    return true;
+}
+
+int GatewayRing::pop(uint8_t *buf, uint16_t size, uint16_t *tag, uint64_t *stampns){
+    struct ringhdr h;
+    size_t tail = this->tail.load(std::memory_order_relaxed);
+    if(tail == this->head.load(std::memory_order_acquire))
+        return -1;
+    this->get(tail, &h, sizeof(h));
+    this->get(tail + sizeof(h), buf, h.len < size ? h.len : size);
+    if(tag != NULL)
+        *tag = h.tag;
+    if(stampns != NULL)
+        *stampns = h.stampns;
+    this->tail.store(tail + recsize(h.len), std::memory_order_release);
+    return h.len;
+}
+
+PublishQueue::PublishQueue(size_t size) : slots(pow2(size < 2 ? 2 : size)), enqpos(0), deqpos(0){
+    this->mask = this->slots.size() - 1;
+    for(size_t i = 0; i < this->slots.size(); i++)
+        this->slots[i].seq.store(i, std::memory_order_relaxed);
+}
+
+/* A slot is free for position pos when its sequence is pos, and filled for
+ * the consumer at pos once it is pos + 1 */
+bool PublishQueue::push(int tpcidx, const uint8_t *data, uint8_t len, GatewayDone done, void *ctx){
+    GatewayRequest *r;
+    size_t pos = this->enqpos.load(std::memory_order_relaxed);
+    intptr_t dif;
+    for(;;){
+        r = &this->slots[pos & this->mask];
+        dif = (intptr_t)r->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+        if(dif == 0){
+            if(this->enqpos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }else if(dif < 0){
+            /* The consumer hasn't released this slot from the last lap */
+            return false;
+        }else{
+            pos = this->enqpos.load(std::memory_order_relaxed);
+        }
+    }
+    r->tpcidx = tpcidx;
+    r->len = len;
+    r->done = done;
+    r->ctx = ctx;
+    r->stampns = gatewayNanos();
+    memcpy(r->data, data, len);
+    r->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+GatewayRequest *PublishQueue::front(void){
+    GatewayRequest *r = &this->slots[this->deqpos & this->mask];
+    if(r->seq.load(std::memory_order_acquire) != this->deqpos + 1)
+        return NULL;
+    return r;
+}
+
+void PublishQueue::release(void){
+    GatewayRequest *r = &this->slots[this->deqpos & this->mask];
+    r->seq.store(this->deqpos + this->mask + 1, std::memory_order_release);
+    this->deqpos++;
+}
+
+struct GatewayRoute GatewayRoutes::routes[GATEWAY_MAX_ROUTES];
+
+template<uint8_t N> void GatewayRoutes::deliverN(uint8_t *data, uint8_t length){
+    deliver(N, data, length);
+}
+
+const _msgcb GatewayRoutes::trampolines[GATEWAY_MAX_ROUTES] = {
+    deliverN<0>, deliverN<1>, deliverN<2>, deliverN<3>, deliverN<4>, deliverN<5>, deliverN<6>, deliverN<7>,
+    deliverN<8>, deliverN<9>, deliverN<10>, deliverN<11>, deliverN<12>, deliverN<13>, deliverN<14>, deliverN<15>
+};
+
+void GatewayRoutes::deliver(uint8_t route, uint8_t *data, uint8_t length){
+    struct GatewayRoute *r = &routes[route];
+    if(r->ring == NULL)
+        return;
+    if(r->ring->push(r->tag, data, length, gatewayNanos()))
+        r->delivered->fetch_add(1, std::memory_order_relaxed);
+    else
+        r->overruns->fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Routes are only changed while no gateway thread is running */
+_msgcb GatewayRoutes::add(GatewayRing *ring, uint16_t tag, std::atomic<unsigned long> *delivered,
+                          std::atomic<unsigned long> *overruns){
+    uint8_t i;
+    for(i = 0; i < GATEWAY_MAX_ROUTES; i++){
+        if(routes[i].ring == NULL){
+            routes[i].ring = ring;
+            routes[i].tag = tag;
+            routes[i].delivered = delivered;
+            routes[i].overruns = overruns;
+            return trampolines[i];
+        }
+    }
+    return NULL;
+}
+
+void GatewayRoutes::remove(_msgcb cb){
+    uint8_t i;
+    for(i = 0; i < GATEWAY_MAX_ROUTES; i++){
+        if(trampolines[i] == cb)
+            routes[i].ring = NULL;
+    }
+}
@@ -0,0 +1,397 @@
+/***************************************************************************
+  Multi-threaded gateway mode for host (Linux) builds of the eseyeaws
+  library.
+
+  eseyeAWS isn't thread safe and runs its callbacks inside poll(), so
+  AWSGateway gives one I/O thread the instance and its uart and lets other
+  threads use it through lock-free queues:
+
+  - publish() from any thread copies the payload into a slot of a bounded
+    multi-producer queue (PublishQueue). The I/O thread moves requests into
+    the library as its publish queue has room, and the completion callback
+    given with the request is run on the I/O thread with the library's
+    result and how long the request took from publish() to SEND OK/FAIL.
+  - Each consumer thread owns a GatewayRing, a single-producer
+    single-consumer byte ring. Messages for the subscriptions routed to it
+    are copied in by the I/O thread, tagged and timestamped, and taken out
+    with pop(). A full ring drops the message and counts an overrun rather
+    than holding up the modem.
+
+  Topics are set up with pubreg()/subscribe() before start(), and before
+  any other gateway in the process is started as the routes from
+  subscriptions to rings are shared. The I/O thread spins while there is
+  work, then yields and finally sleeps for GATEWAY_IDLE_SLEEP_US at a time,
+  so producers never have to wake it.
+
+      AWSGateway<eseyeAWS> gw(aws);
+      GatewayRing ring(65536);
+      int pub = gw.pubreg("node/report");
+      gw.subscribe("node/cmd", &ring, 1);
+      gw.start();
+      ... producer threads: gw.publish(pub, data, len, donecb, ctx);
+      ... consumer thread:  n = ring.pop(buf, sizeof(buf), &tag);
+      gw.stop();
+
+ ***************************************************************************/
+
+#ifndef ESEYEAWS_AWSGATEWAY_H__
+#define ESEYEAWS_AWSGATEWAY_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "eseyeaws.h"
+
+/* Largest payload a request holds - publish() takes no more than the
+ * instance's txbuf either (AWSGateway::payloadmax), as the library copies
+ * it there */
+#define GATEWAY_PAYLOAD_MAX 255
+/* Subscriptions routed to rings, across every gateway in the process */
+#define GATEWAY_MAX_ROUTES 16
+/* Longest the I/O thread sleeps when there is nothing to do */
+#define GATEWAY_IDLE_SLEEP_US 50
+#define GATEWAY_CACHE_LINE 64
+
+/* Completion of a publish() - on the I/O thread, with the library's result
+ * (0 or ESEYE_*) and the ns from publish() to completion */
+typedef void (*GatewayDone)(void *ctx, int8_t result, uint64_t latencyns);
+
+uint64_t gatewayNanos(void);
+
+/* Single-producer single-consumer ring of messages - records are
+ * <len><tag><stamp><bytes> padded to 4 bytes and may wrap */
+class GatewayRing
+{
+public:
+    /* size is rounded up to a power of 2 */
+    GatewayRing(size_t size);
+
+    /* Producer - false (and an overrun counted) if the message doesn't fit */
+    bool push(uint16_t tag, const uint8_t *data, uint16_t len, uint64_t stampns);
+    /* Consumer - the message length (only size bytes are copied if it is
+     * longer), or -1 if the ring is empty */
+    int pop(uint8_t *buf, uint16_t size, uint16_t *tag = NULL, uint64_t *stampns = NULL);
+    bool empty(void) { return this->head.load(std::memory_order_acquire) == this->tail.load(std::memory_order_relaxed); }
+
+    unsigned long overruns(void) { return this->drops.load(std::memory_order_relaxed); }
+
+private:
+    void put(size_t pos, const void *data, size_t len);
+    void get(size_t pos, void *data, size_t len);
+
+    std::vector<uint8_t> buf;
+    size_t mask;
+    /* Written by the producer and consumer respectively, padded onto lines
+     * of their own (padding rather than alignas so rings can be new'd) */
+    std::atomic<size_t> head;
+    uint8_t headpad[GATEWAY_CACHE_LINE];
+    std::atomic<size_t> tail;
+    uint8_t tailpad[GATEWAY_CACHE_LINE];
+    std::atomic<unsigned long> drops;
+};
+
+/* A publish waiting for the I/O thread */
+struct GatewayRequest
+{
+    std::atomic<size_t> seq;
+    int tpcidx;
+    uint8_t len;
+    GatewayDone done;
+    void *ctx;
+    uint64_t stampns;
+    uint8_t data[GATEWAY_PAYLOAD_MAX];
+};
+
+/* Bounded multi-producer single-consumer queue of publishes - each slot's
+ * sequence number says whether it is free for the producer which claimed
+ * its position or filled for the consumer (Vyukov's bounded queue) */
+class PublishQueue
+{
+public:
+    /* size is rounded up to a power of 2 */
+    PublishQueue(size_t size);
+
+    /* Any thread - false if the queue is full */
+    bool push(int tpcidx, const uint8_t *data, uint8_t len, GatewayDone done, void *ctx);
+    /* I/O thread - the oldest request (NULL if there is none), which stays
+     * queued until release() */
+    GatewayRequest *front(void);
+    void release(void);
+
+private:
+    std::vector<GatewayRequest> slots;
+    size_t mask;
+    std::atomic<size_t> enqpos;
+    uint8_t enqpad[GATEWAY_CACHE_LINE];
+    size_t deqpos;
+};
+
+struct GatewayCounts
+{
+    /* publish() calls refused because the queue was full */
+    unsigned long queuefull;
+    /* Publishes completed with success, or with an error */
+    unsigned long sent;
+    unsigned long failed;
+    /* Messages copied into rings, and dropped because one was full */
+    unsigned long delivered;
+    unsigned long overruns;
+    unsigned long polls;
+};
+
+/* Which ring a subscription's messages go to - the library's message
+ * callback has no context so each route has its own trampoline */
+struct GatewayRoute
+{
+    GatewayRing *ring;
+    uint16_t tag;
+    std::atomic<unsigned long> *delivered;
+    std::atomic<unsigned long> *overruns;
+};
+
+class GatewayRoutes
+{
+public:
+    /* A free route to ring - its message callback, or NULL if none is free */
+    static _msgcb add(GatewayRing *ring, uint16_t tag, std::atomic<unsigned long> *delivered,
+                      std::atomic<unsigned long> *overruns);
+    static void remove(_msgcb cb);
+private:
+    template<uint8_t N> static void deliverN(uint8_t *data, uint8_t length);
+    static void deliver(uint8_t route, uint8_t *data, uint8_t length);
+    static struct GatewayRoute routes[GATEWAY_MAX_ROUTES];
+    static const _msgcb trampolines[GATEWAY_MAX_ROUTES];
+};
+
+template<class AWS>
+class AWSGateway
+{
+public:
+    AWSGateway(AWS &aws, size_t queuelen = 1024);
+    ~AWSGateway();
+
+    /* Topic setup - before start() */
+    int pubreg(const char *topic);
+    /* Messages on topic go to ring tagged with tag - returns the
+     * subscription index or -1 */
+    int subscribe(const char *topic, GatewayRing *ring, uint16_t tag);
+    /* Called on the I/O thread before each poll(), e.g. to drive a simulated
+     * modem */
+    void pollhook(void (*hook)(void *ctx), void *ctx) { this->hook = hook; this->hookctx = ctx; }
+
+    /* Run the I/O thread - stop() waits for the requests already queued to
+     * complete first */
+    void start(void);
+    void stop(void);
+
+    /* Any thread - queue a copy of data for publishing on tpcidx, false if
+     * the queue is full or the payload longer than payloadmax */
+    bool publish(int tpcidx, const uint8_t *data, uint16_t len, GatewayDone done = NULL, void *ctx = NULL);
+    static const uint16_t payloadmax = AWS::config::txBufSize < GATEWAY_PAYLOAD_MAX ? AWS::config::txBufSize : GATEWAY_PAYLOAD_MAX;
+
+    void counts(struct GatewayCounts *c);
+
+private:
+    /* A publish handed to the library, for its completion */
+    struct inflight {
+      AWSGateway *gw;
+      GatewayDone done;
+      void *ctx;
+      uint64_t stampns;
+      struct inflight *next;
+    };
+    static void pubdone(uint8_t op, int handle, int8_t result, void *ctx);
+    bool feed(void);
+    bool busy(void);
+    void run(void);
+
+    AWS &aws;
+    PublishQueue queue;
+    std::vector<struct inflight> slots;
+    struct inflight *freeslots;
+    unsigned inflights;
+    std::vector<_msgcb> routes;
+    void (*hook)(void *ctx);
+    void *hookctx;
+    std::thread io;
+    std::atomic<bool> running;
+    std::atomic<bool> draining;
+    std::atomic<unsigned long> queuefull;
+    std::atomic<unsigned long> sent;
+    std::atomic<unsigned long> failed;
+    std::atomic<unsigned long> delivered;
+    std::atomic<unsigned long> overruns;
+    std::atomic<unsigned long> polls;
+};
+
+template<class AWS>
+AWSGateway<AWS>::AWSGateway(AWS &aws, size_t queuelen)
+    : aws(aws), queue(queuelen), slots(AWS::config::pendingOps), freeslots(NULL), inflights(0),
+      hook(NULL), hookctx(NULL), running(false), draining(false), queuefull(0), sent(0), failed(0),
+      delivered(0), overruns(0), polls(0) {
+    for(size_t i = 0; i < this->slots.size(); i++){
+        this->slots[i].gw = this;
+        this->slots[i].next = this->freeslots;
+        this->freeslots = &this->slots[i];
+    }
+}
+
+template<class AWS>
+AWSGateway<AWS>::~AWSGateway(){
+    this->stop();
+    for(size_t i = 0; i < this->routes.size(); i++)
+        GatewayRoutes::remove(this->routes[i]);
+}
+
+template<class AWS>
+int AWSGateway<AWS>::pubreg(const char *topic){
+    if(this->running.load())
+        return -1;
+    return this->aws.pubreg((char *)topic);
+}
+
+template<class AWS>
+int AWSGateway<AWS>::subscribe(const char *topic, GatewayRing *ring, uint16_t tag){
+    _msgcb cb;
+    int idx;
+    if(this->running.load() || ring == NULL)
+        return -1;
+    cb = GatewayRoutes::add(ring, tag, &this->delivered, &this->overruns);
+    if(cb == NULL)
+        return -1;
+    idx = this->aws.subscribe((char *)topic, cb);
+    if(idx < 0){
+        GatewayRoutes::remove(cb);
+        return -1;
+    }
+    this->routes.push_back(cb);
+    return idx;
+}
+
+template<class AWS>
+void AWSGateway<AWS>::start(void){
+    if(this->running.exchange(true))
+        return;
+    this->draining = false;
+    this->io = std::thread(&AWSGateway::run, this);
+}
+
+template<class AWS>
+void AWSGateway<AWS>::stop(void){
+    if(this->running.load() == false)
+        return;
+    this->draining = true;
+    this->io.join();
+    this->running = false;
+}
+
+template<class AWS>
+bool AWSGateway<AWS>::publish(int tpcidx, const uint8_t *data, uint16_t len, GatewayDone done, void *ctx){
+    if(len == 0 || len > payloadmax)
+        return false;
+    if(this->queue.push(tpcidx, data, len, done, ctx))
+        return true;
+    this->queuefull.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+template<class AWS>
+void AWSGateway<AWS>::counts(struct GatewayCounts *c){
+    c->queuefull = this->queuefull.load(std::memory_order_relaxed);
+    c->sent = this->sent.load(std::memory_order_relaxed);
+    c->failed = this->failed.load(std::memory_order_relaxed);
+    c->delivered = this->delivered.load(std::memory_order_relaxed);
+    c->overruns = this->overruns.load(std::memory_order_relaxed);
+    c->polls = this->polls.load(std::memory_order_relaxed);
+}
+
+/* A publish has completed - on the I/O thread, from poll() */
+template<class AWS>
+void AWSGateway<AWS>::pubdone(uint8_t op, int handle, int8_t result, void *ctx){
+    struct inflight *f = (struct inflight *)ctx;
+    AWSGateway *gw = f->gw;
+    (void)op;
+    (void)handle;
+    if(result == 0)
+        gw->sent.fetch_add(1, std::memory_order_relaxed);
+    else
+        gw->failed.fetch_add(1, std::memory_order_relaxed);
+    if(f->done != NULL)
+        f->done(f->ctx, result, gatewayNanos() - f->stampns);
+    f->next = gw->freeslots;
+    gw->freeslots = f;
+    gw->inflights--;
+}
+
+/* Move queued requests into the library while it has room - returns true
+ * if any were. One the library refuses when it has nothing of ours queued
+ * never will be taken, so it fails rather than holding up the rest */
+template<class AWS>
+bool AWSGateway<AWS>::feed(void){
+    GatewayRequest *r;
+    struct inflight *f;
+    bool fed = false;
+    int id;
+    while(this->freeslots != NULL && (r = this->queue.front()) != NULL){
+        f = this->freeslots;
+        f->done = r->done;
+        f->ctx = r->ctx;
+        f->stampns = r->stampns;
+        id = this->aws.publish(r->tpcidx, r->data, r->len, pubdone, f);
+        if(id == -1 && this->aws.pubstate(r->tpcidx) == PUB_TOPIC_REGISTERED &&
+           (this->inflights > 0 || this->aws.pubdone() == false))
+            break;
+        this->queue.release();
+        fed = true;
+        if(id == -1){
+            /* Nowhere to send it, or it can't be sent */
+            this->failed.fetch_add(1, std::memory_order_relaxed);
+            if(f->done != NULL)
+                f->done(f->ctx, ESEYE_DROPPED, gatewayNanos() - f->stampns);
+            continue;
+        }
+        this->freeslots = f->next;
+        this->inflights++;
+    }
+    return fed;
+}
+
+/* Publishes queued or in the library */
+template<class AWS>
+bool AWSGateway<AWS>::busy(void){
+    return this->inflights > 0 || this->queue.front() != NULL;
+}
+
+template<class AWS>
+void AWSGateway<AWS>::run(void){
+    unsigned idle = 0;
+    unsigned long before;
+    bool worked;
+    while(this->draining.load(std::memory_order_relaxed) == false || this->busy()){
+        before = this->delivered.load(std::memory_order_relaxed) + this->sent.load(std::memory_order_relaxed) +
+                 this->failed.load(std::memory_order_relaxed);
+        worked = this->feed();
+        if(this->hook != NULL)
+            this->hook(this->hookctx);
+        this->aws.poll();
+        this->polls.fetch_add(1, std::memory_order_relaxed);
+        worked = worked || before != this->delivered.load(std::memory_order_relaxed) + this->sent.load(std::memory_order_relaxed) +
+                                     this->failed.load(std::memory_order_relaxed);
+        if(worked){
+            idle = 0;
+        }else if(++idle < 64){
+            /* Spin */
+        }else if(idle < 128){
+            std::this_thread::yield();
+        }else{
+            usleep(GATEWAY_IDLE_SLEEP_US);
+        }
+    }
+}
+
+#endif // ESEYEAWS_AWSGATEWAY_H__
@@ -0,0 +1,999 @@
+/***************************************************************************
+  poll() throughput benchmark for host builds of the eseyeaws library.
+
+  Drives an eseyeAWS instance against the simulated modem and reports
+  subscribed message throughput (messages/sec, bytes/sec, ns per URC)
+  through poll() and handed to ingest() in bulk,
+  publish round-trip rate, small records batched into one publish, CBOR against JSON reports,
+  failed publishes journaled to a file and replayed (also after a restart),
+  topic recovery after a modem restart and network outage, what the link
+  metrics report and cost, several modems behind one eseyeAWSPoller,
+  publishes driven by completion callbacks, replies routed to the commands
+  which asked for them, the cost of status polling with response
+  timeouts enabled and the CPU cost of a rate-driven URC stream. Lines whose
+  results are wrong are marked and the exit status is 1 (the checks which
+  measure nothing are in host_checks).
+
+  usage: bench_poll [messages]
+
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "eseyeaws.h"
+#include "eseyeaws_cbor.h"
+#include "eseyeaws_poller.h"
+#include "hostconfig.h"
+#include "journalfile.h"
+#include "simmodem.h"
+
+/* Battery node: one sub topic, no txbuf, no OK filtering, timeouts or trace */
+typedef eseyeAWSBasic<eseyeAWSConfig<1, 2, 0, 32, eseyeNoFilterOK, eseyeNoTimeouts, eseyeNoTrace, 0> > eseyeAWSTiny;
+/* Gateway: lots of topics, big buffers and response timeouts */
+typedef eseyeAWSBasic<eseyeAWSConfig<15, 15, 1024, 255, eseyeFilterOK, eseyeTimeouts<> > > eseyeAWSLarge;
+/* The host configuration without link metrics */
+struct eseyeNoMetricsConfig : eseyeAWSHostConfig
+{
+    typedef eseyeNoMetrics metricsPolicy;
+};
+typedef eseyeAWSBasic<eseyeNoMetricsConfig> eseyeAWSNoMetrics;
+
+static unsigned long rxmsgs;
+static unsigned long rxbytes;
+
+static void countcb(uint8_t *data, uint8_t length){
+    (void)data;
+    rxmsgs++;
+    rxbytes += length;
+}
+
+static void chunkcb(uint8_t *chunk, uint8_t chunklen, uint16_t offset, uint16_t total){
+    (void)chunk;
+    rxbytes += chunklen;
+    if(offset + chunklen == total)
+        rxmsgs++;
+}
+
+static double now_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Poll until the modem has nothing left for us */
+template<class AWS> static void drain(SimModem &modem, AWS &aws){
+    while(modem.available() > 0)
+        aws.poll();
+}
+
+static int setup_sub(SimModem &modem, eseyeAWSHost &aws, bool stream = false){
+    int idx;
+    if(stream)
+        idx = aws.subscribestream((char *)"bench/sub", chunkcb);
+    else
+        idx = aws.subscribe((char *)"bench/sub", countcb);
+    drain(modem, aws);
+    if(idx < 0 || aws.substate(idx) != SUB_TOPIC_SUBSCRIBED){
+        printf("subscribe failed\n");
+        return -1;
+    }
+    return idx;
+}
+
+/* Subscribed message throughput through poll() */
+static bool bench_urc(unsigned long count, uint16_t payloadlen, bool stream = false){
+    SimModem modem;
+    eseyeAWSHost aws(&modem);
+    aws.init();
+    int idx = setup_sub(modem, aws, stream);
+    if(idx < 0)
+        return false;
+
+    uint8_t payload[2048];
+    for(unsigned i = 0; i < payloadlen; i++)
+        payload[i] = 'a' + (i % 26);
+    for(unsigned long i = 0; i < count; i++)
+        modem.inject(idx, payload, payloadlen);
+    unsigned long wirebytes = modem.available();
+
+    rxmsgs = rxbytes = 0;
+    double start = now_s();
+    drain(modem, aws);
+    double elapsed = now_s() - start;
+    bool ok = rxmsgs == count && (!stream || rxbytes == count * payloadlen);
+
+    printf("%s payload %4u: %8lu msgs %10.0f msgs/s %12.0f bytes/s %8.1f ns/urc%s\n",
+           stream ? "urcchunk" : "urc     ", (unsigned)payloadlen, rxmsgs, rxmsgs / elapsed, wirebytes / elapsed,
+           elapsed * 1e9 / count, ok ? "" : "  (MISSING MESSAGES)");
+    return ok;
+}
+
+/* Subscribed messages handed to ingest() in large spans, as a transport
+ * with its own receive buffer would, instead of poll() reading the uart */
+static bool bench_ingest(unsigned long count, uint16_t payloadlen, uint16_t span){
+    SimModem modem;
+    eseyeAWSHost aws(&modem);
+    aws.init();
+    int idx = setup_sub(modem, aws);
+    if(idx < 0)
+        return false;
+
+    uint8_t payload[2048];
+    for(unsigned i = 0; i < payloadlen; i++)
+        payload[i] = 'a' + (i % 26);
+    for(unsigned long i = 0; i < count; i++)
+        modem.inject(idx, payload, payloadlen);
+    std::vector<uint8_t> wire(modem.available());
+    modem.readBytes((char *)wire.data(), wire.size());
+
+    rxmsgs = rxbytes = 0;
+    double start = now_s();
+    for(size_t off = 0; off < wire.size(); off += span)
+        aws.ingest(&wire[off], wire.size() - off < span ? wire.size() - off : span);
+    double elapsed = now_s() - start;
+
+    printf("ingest   payload %4u: %8lu msgs %10.0f msgs/s %12.0f bytes/s %8.1f ns/urc%s\n",
+           (unsigned)payloadlen, rxmsgs, rxmsgs / elapsed, wire.size() / elapsed,
+           elapsed * 1e9 / count, rxmsgs == count ? "" : "  (MISSING MESSAGES)");
+    return rxmsgs == count;
+}
+
+/* Publish round-trips: publish, wait for the '>' prompt and SEND OK */
+static bool bench_publish(unsigned long count, uint8_t payloadlen){
+    SimModem modem;
+    eseyeAWSHost aws(&modem);
+    aws.init();
+    int idx = aws.pubreg((char *)"bench/pub");
+    drain(modem, aws);
+    if(idx < 0 || aws.pubstate(idx) != PUB_TOPIC_REGISTERED){
+        printf("pubreg failed\n");
+        return false;
+    }
+
+    uint8_t payload[255];
+    for(unsigned i = 0; i < payloadlen; i++)
+        payload[i] = 'A' + (i % 26);
+
+    double start = now_s();
+    for(unsigned long i = 0; i < count; i++){
+        if(aws.publish(idx, payload, payloadlen) < 0){
+            printf("publish  payload %4u: doesn't fit this build's txbuf\n", (unsigned)payloadlen);
+            return true;
+        }
+        while(!aws.pubdone() || modem.available() > 0)
+            aws.poll();
+    }
+    double elapsed = now_s() - start;
+
+    printf("publish  payload %4u: %8lu msgs %10.0f msgs/s %12.0f bytes/s %8.1f ns/publish%s\n",
+           (unsigned)payloadlen, modem.publishes, modem.publishes / elapsed,
+           modem.publishbytes / elapsed, elapsed * 1e9 / count,
+           modem.publishes == count ? "" : "  (MISSING PUBLISHES)");
+    return modem.publishes == count;
+}
+
+/* Streaming publish writer - a counting pattern generated at the '>' prompt */
+static void patternwriter(Print *out, uint16_t datalen, void *ctx){
+    (void)ctx;
+    for(uint16_t i = 0; i < datalen; i++)
+        out->write((uint8_t)('A' + (i % 26)));
+}
+
+#define PUB_MODE_COPY   0
+#define PUB_MODE_REF    1
+#define PUB_MODE_WRITER 2
+static const char *pubmodename[] = {"pubqueue", "pubref  ", "pubwrite"};
+
+/* Queued publishes: keep the publish queue topped up */
+static bool bench_publish_queued(unsigned long count, uint16_t payloadlen, int mode){
+    SimModem modem;
+    eseyeAWSHost aws(&modem);
+    aws.init();
+    int idx = aws.pubreg((char *)"bench/pub");
+    drain(modem, aws);
+    if(idx < 0 || aws.pubstate(idx) != PUB_TOPIC_REGISTERED){
+        printf("pubreg failed\n");
+        return false;
+    }
+
+    uint8_t payload[2048];
+    for(unsigned i = 0; i < payloadlen; i++)
+        payload[i] = 'A' + (i % 26);
+
+    unsigned long queued = 0;
+    double start = now_s();
+    while(queued < count || !aws.pubdone() || modem.available() > 0){
+        while(queued < count){
+            int id;
+            if(mode == PUB_MODE_REF)
+                id = aws.publishref(idx, payload, payloadlen);
+            else if(mode == PUB_MODE_WRITER)
+                id = aws.publishwriter(idx, payloadlen, patternwriter);
+            else
+                id = aws.publish(idx, payload, (uint8_t)payloadlen);
+            if(id < 0 && aws.pubdone()){
+                printf("%s payload %4u: doesn't fit this build's txbuf\n", pubmodename[mode], (unsigned)payloadlen);
+                return true;
+            }
+            if(id < 0)
+                break;
+            queued++;
+        }
+        aws.poll();
+    }
+    double elapsed = now_s() - start;
+
+    printf("%s payload %4u: %8lu msgs %10.0f msgs/s %12.0f bytes/s %8.1f ns/publish%s\n",
+           pubmodename[mode], (unsigned)payloadlen, modem.publishes, modem.publishes / elapsed,
+           modem.publishbytes / elapsed, elapsed * 1e9 / count,
+           modem.publishes == count ? "" : "  (MISSING PUBLISHES)");
+    return modem.publishes == count;
+}
+
+/* Small records batched into full payloads - how many modem publishes they
+ * take and what each record costs */
+static bool bench_batch(unsigned long count, uint8_t reclen){
+    SimModem modem;
+    eseyeAWSHost aws(&modem);
+    aws.init();
+    int idx = aws.pubreg((char *)"bench/pub");
+    drain(modem, aws);
+    if(idx < 0 || aws.pubbatch(idx, 0) < 0){
+        printf("batch    record %4u: no batches in this build\n", (unsigned)reclen);
+        return true;
+    }
+
+    uint8_t record[255];
+    for(unsigned i = 0; i < reclen; i++)
+        record[i] = 'A' + (i % 26);
+
+    unsigned long appended = 0;
+    double start = now_s();
+    while(appended < count){
+        if(aws.pubappend(idx, record, reclen) == 0)
+            appended++;
+        else
+            aws.poll();
+    }
+    while(aws.pubflush(idx) < 0 && aws.pubqueued() > 0)
+        aws.poll();
+    while(!aws.pubdone() || modem.available() > 0)
+        aws.poll();
+    double elapsed = now_s() - start;
+    bool ok = modem.publishbytes == count * reclen + (count - modem.publishes);
+
+    printf("batch    record %4u: %8lu records in %lu publishes %10.0f records/s %8.1f ns/record%s\n",
+           (unsigned)reclen, count, modem.publishes, count / elapsed, elapsed * 1e9 / count,
+           ok ? "" : "  (MISSING RECORDS)");
+    return ok;
+}
+
+/* A DHT22 style report as CBOR against the example's sprintf() JSON - size
+ * and cost of each, and the CBOR one published through publishcbor() and
+ * decoded again */
+struct report{
+    float humidity;
+    float temp;
+};
+
+static void cborreport(eseyeCBOR &cbor, void *ctx){
+    struct report *r = (struct report *)ctx;
+    cbor.map(2);
+    cbor.key(F("Humidity"));
+    cbor.number(r->humidity);
+    cbor.key(F("Temp"));
+    cbor.number(r->temp);
+}
+
+static bool bench_cbor(unsigned long count){
+    struct report r = {45.5f, 21.7f};
+    char json[50];
+    int jsonlen = 0;
+    double start = now_s();
+    for(unsigned long i = 0; i < count; i++){
+        int humi = (int)r.humidity, tempi = (int)r.temp;
+        jsonlen = sprintf(json, "{\"Humidity\": \"%d.%d\", \"Temp\": \"%d.%d\"}",
+                          humi, (int)((r.humidity - humi) * 10), tempi, (int)((r.temp - tempi) * 10));
+    }
+    double jsontime = now_s() - start;
+
+    eseyeCBOR sizer;
+    start = now_s();
+    for(unsigned long i = 0; i < count; i++){
+        sizer = eseyeCBOR();
+        cborreport(sizer, &r);
+    }
+    double cbortime = now_s() - start;
+
+    SimModem modem;
+    eseyeAWSHost aws(&modem);
+    aws.init();
+    int idx = aws.pubreg((char *)"bench/pub");
+    drain(modem, aws);
+    int id = publishcbor<cborreport>(&aws, idx, &r);
+    while(!aws.pubdone() || modem.available() > 0)
+        aws.poll();
+
+    eseyeCBORReader rd(modem.lastpayload.data(), modem.lastpayload.size());
+    uint16_t pairs = 0;
+    float humidity = 0, temp = 0;
+    bool ok = id >= 0 && rd.map(&pairs) && pairs == 2 &&
+              rd.key(F("Humidity")) && rd.number(&humidity) && rd.key("Temp") && rd.number(&temp) &&
+              humidity == r.humidity && temp == r.temp && rd.peek() == CBOR_END;
+
+    printf("cbor     report: %u bytes (json %d) %8.1f ns/encode (sprintf %8.1f ns)%s\n",
+           (unsigned)sizer.length(), jsonlen, cbortime * 1e9 / count, jsontime * 1e9 / count,
+           ok ? "" : "  (DECODE FAILED)");
+    return ok;
+}
+
+/* Store-and-forward through a file backed journal: publishes made while the
+ * topic registers and every 4th one the modem fails are journaled and
+ * replayed, then a run with the topic closed on the modem is picked up from
+ * the file by a new instance. Every record must reach the modem once or be
+ * counted as evicted (replays only get the modem between live publishes so a
+ * long run fills the journal) */
+static bool bench_journal(unsigned long count){
+    char path[64];
+    JournalFile store;
+    SimModem modem;
+    struct eseyeJournalCounts jc = {0, 0, 0, 0};
+    unsigned long seq = 0, sent, journaled = 0;
+    bool ok;
+    uint8_t record[16];
+    snprintf(path, sizeof(path), "/tmp/bench_journal.%d", (int)getpid());
+    unlink(path);
+    if(store.open(path, 4096) == false){
+        printf("journal  %s: can't open\n", path);
+        return false;
+    }
+    {
+        eseyeAWSHost aws(&modem);
+        aws.init();
+        aws.journal(&store, 0);
+        int idx = aws.pubreg((char *)"bench/pub");
+        /* Not registered yet - these go straight to the journal */
+        for(int i = 0; i < 5; i++, seq++){
+            memset(record, 'a' + (seq % 26), sizeof(record));
+            if(aws.publish(idx, record, sizeof(record)) == ESEYE_JOURNALED)
+                journaled++;
+        }
+        if(journaled == 0){
+            printf("journal  no journal in this build\n");
+            store.close();
+            unlink(path);
+            return true;
+        }
+        drain(modem, aws);
+        modem.setPublishFailEvery(4);
+        double start = now_s();
+        while(seq < count){
+            memset(record, 'a' + (seq % 26), sizeof(record));
+            if(aws.publish(idx, record, sizeof(record)) >= 0)
+                seq++;
+            else
+                aws.poll();
+        }
+        aws.journalcounts(&jc);
+        while(!aws.pubdone() || modem.available() > 0 || jc.records > 0){
+            aws.poll();
+            aws.journalcounts(&jc);
+        }
+        double elapsed = now_s() - start;
+        sent = modem.publishes - modem.publishfails;
+        ok = sent + jc.evicted == count && journaled == 5;
+        printf("journal  %8lu publishes, %lu fails: %lu journaled %lu replayed %lu evicted %10.0f publishes/s%s\n",
+               count, modem.publishfails, jc.journaled, jc.replayed, jc.evicted, count / elapsed,
+               ok ? "" : "  (RECORDS LOST)");
+
+        /* The modem loses the topic - everything is kept for the next run
+         * (after one replay attempt, the next is an hour away) */
+        aws.journal(&store, 3600000UL);
+        modem.pubopen[idx] = false;
+        modem.setPublishFailEvery(0);
+        for(int i = 0; i < 20; i++, seq++){
+            memset(record, 'a' + (seq % 26), sizeof(record));
+            aws.publish(idx, record, sizeof(record));
+            while(!aws.pubdone())
+                aws.poll();
+        }
+        drain(modem, aws);
+        aws.journalcounts(&jc);
+    }
+    store.close();
+    uint16_t kept = jc.records;
+    if(store.open(path, 4096) == false)
+        return false;
+    eseyeAWSHost aws(&modem);
+    aws.init();
+    aws.journal(&store, 0);
+    unsigned long before = modem.publishes - modem.publishfails;
+    int idx = aws.pubreg((char *)"bench/pub");
+    do{
+        aws.poll();
+        aws.journalcounts(&jc);
+    }while(!aws.pubdone() || modem.available() > 0 || jc.records > 0);
+    sent = modem.publishes - modem.publishfails - before;
+    printf("journal  restart: %u records kept, %lu replayed to idx %d%s\n",
+           (unsigned)kept, sent, idx, kept == 20 && sent == 20 ? "" : "  (RECORDS LOST)");
+    store.close();
+    unlink(path);
+    return ok && kept == 20 && sent == 20;
+}
+
+/* CPU cost of servicing a paced URC stream on the simulated clock */
+static void bench_paced(double rate, uint16_t payloadlen, unsigned long seconds){
+    hostUseSimClock(true);
+    hostSetMillis(0);
+    {
+        SimModem modem;
+        eseyeAWSHost aws(&modem);
+        aws.init();
+        int idx = setup_sub(modem, aws);
+        if(idx >= 0){
+            modem.setMessageRate(idx, rate, payloadlen);
+            rxmsgs = rxbytes = 0;
+            double start = cpu_s();
+            for(unsigned long ms = 0; ms < seconds * 1000; ms++){
+                hostAdvanceMillis(1);
+                modem.tick();
+                aws.poll();
+            }
+            double elapsed = cpu_s() - start;
+            printf("paced    %6.0f msgs/s payload %4u: %8lu msgs %8.3f us cpu per simulated ms\n",
+                   rate, (unsigned)payloadlen, rxmsgs, elapsed * 1e6 / (seconds * 1000));
+        }
+    }
+    hostUseSimClock(false);
+}
+
+/* Topic recovery on the simulated clock: the modem restarts and refuses
+ * opens for outagems, then the library has to reopen two subscriptions and
+ * two publish topics on its own. Reports the opens it took and how long
+ * after the network came back the topics were open again */
+static bool bench_recover(unsigned long outagems){
+    bool ok;
+    hostUseSimClock(true);
+    hostSetMillis(0);
+    {
+        SimModem modem;
+        eseyeAWSHost aws(&modem);
+        aws.init();
+        randomSeed(1);
+        int sub1 = aws.subscribe((char *)"bench/sub", countcb);
+        int sub2 = aws.subscribe((char *)"bench/cmd", countcb);
+        int pub1 = aws.pubreg((char *)"bench/pub");
+        int pub2 = aws.pubreg((char *)"bench/status");
+        drain(modem, aws);
+        modem.setOpenFail(true);
+        modem.restart();
+        drain(modem, aws);
+        if(!aws.recovering()){
+            printf("recover  no topic recovery in this build\n");
+            hostUseSimClock(false);
+            return true;
+        }
+        unsigned long opens = modem.opens;
+        unsigned long start = millis();
+        bool up = false;
+        while(millis() - start < 3600000UL){
+            if(millis() - start >= outagems)
+                modem.setOpenFail(false);
+            aws.poll();
+            up = !aws.recovering() && aws.substate(sub1) == SUB_TOPIC_SUBSCRIBED && aws.substate(sub2) == SUB_TOPIC_SUBSCRIBED &&
+                 aws.pubstate(pub1) == PUB_TOPIC_REGISTERED && aws.pubstate(pub2) == PUB_TOPIC_REGISTERED;
+            if(up)
+                break;
+            hostAdvanceMillis(10);
+        }
+        /* The subscription callbacks survived */
+        rxmsgs = 0;
+        modem.inject(0, (const uint8_t *)"ping", 4);
+        modem.inject(1, (const uint8_t *)"ping", 4);
+        drain(modem, aws);
+        ok = up && rxmsgs == 2;
+        printf("recover  outage %6lu ms: %3lu opens, topics back %5lu ms after the network, recovery %6lu ms%s\n",
+               outagems, modem.opens - opens, millis() - start - outagems, aws.recoverytime(),
+               ok ? "" : "  (NOT RECOVERED)");
+    }
+    hostUseSimClock(false);
+    return ok;
+}
+
+/* Completion callbacks - each publish is made from the callback of the one
+ * before, so nothing polls for status */
+struct opsrun{
+    eseyeAWSHost *aws;
+    int pub;
+    unsigned long left;
+    unsigned long completions[ESEYE_OP_PUBLISH + 1];
+    unsigned long ok;
+    unsigned long failed;
+    unsigned long timedout;
+};
+
+static const uint8_t opspayload[] = "{\"Temp\":21.5}";
+
+static void opsdone(uint8_t op, int handle, int8_t result, void *ctx){
+    struct opsrun *run = (struct opsrun *)ctx;
+    (void)handle;
+    if(op <= ESEYE_OP_PUBLISH)
+        run->completions[op]++;
+    if(result == 0)
+        run->ok++;
+    else if(result == ESEYE_TIMEDOUT)
+        run->timedout++;
+    else
+        run->failed++;
+    if(op == ESEYE_OP_PUBLISH && run->aws != NULL && run->left > 0){
+        run->left--;
+        run->aws->publishref(run->pub, opspayload, sizeof(opspayload) - 1, opsdone, run);
+    }
+}
+
+/* A node driven by completion callbacks: subscribe and register, count
+ * publishes (every 7th answered SEND FAIL) and tear down again. Then with
+ * response timeouts and a modem which never answers, where every operation
+ * has to time out. Each must be reported exactly once */
+static bool bench_ops(unsigned long count){
+    struct opsrun run;
+    bool ok;
+    memset(&run, 0, sizeof(run));
+    {
+        SimModem modem;
+        eseyeAWSHost aws(&modem);
+        aws.init();
+        run.aws = &aws;
+        int sub = aws.subscribe((char *)"bench/sub", countcb, opsdone, &run);
+        run.pub = aws.pubreg((char *)"bench/pub", opsdone, &run);
+        if(sub < 0 || run.pub < 0){
+            printf("ops      no completion callbacks in this build\n");
+            return true;
+        }
+        drain(modem, aws);
+        modem.setPublishFailEvery(7);
+        run.left = count - 1;
+        double start = now_s();
+        aws.publishref(run.pub, opspayload, sizeof(opspayload) - 1, opsdone, &run);
+        drain(modem, aws);
+        double elapsed = now_s() - start;
+        aws.unsubscribe(sub, opsdone, &run);
+        aws.pubunreg(run.pub, opsdone, &run);
+        drain(modem, aws);
+        bool exact = run.completions[ESEYE_OP_SUBSCRIBE] == 1 && run.completions[ESEYE_OP_PUBREG] == 1 &&
+                     run.completions[ESEYE_OP_PUBLISH] == count && run.completions[ESEYE_OP_UNSUBSCRIBE] == 1 &&
+                     run.completions[ESEYE_OP_PUBUNREG] == 1 && run.failed == modem.publishfails;
+        printf("ops      %8lu publishes chained from callbacks: %lu ok, %lu failed, %.1f ns/publish%s\n",
+               count, run.completions[ESEYE_OP_PUBLISH] - run.failed, run.failed, elapsed * 1e9 / count, exact ? "" : "  (WRONG COMPLETIONS)");
+        ok = exact;
+    }
+    hostUseSimClock(true);
+    hostSetMillis(0);
+    memset(&run, 0, sizeof(run));
+    {
+        SimModem modem;
+        eseyeAWSLarge aws(&modem);
+        aws.init();
+        /* A call which can't be waited for (PENDING_OPS are) returns -1 -
+         * distinct topics so each is an open of its own rather than shared */
+        unsigned long accepted = 0;
+        accepted += aws.subscribe((char *)"bench/sub0", countcb, opsdone, &run) >= 0;
+        accepted += aws.subscribe((char *)"bench/sub1", countcb, opsdone, &run) >= 0;
+        accepted += aws.pubreg((char *)"bench/pub", opsdone, &run) >= 0;
+        while(modem.available() > 0)
+            modem.read();
+        unsigned long ms = 0;
+        while(run.timedout < accepted && ms < 10000){
+            aws.poll();
+            hostAdvanceMillis(1);
+            ms++;
+        }
+        bool exact = run.timedout == accepted && run.ok + run.failed == 0;
+        printf("ops      unanswered: %lu of %lu opens timed out after %lu ms%s\n",
+               run.timedout, accepted, ms, exact ? "" : "  (WRONG COMPLETIONS)");
+        ok = ok && exact;
+    }
+    hostUseSimClock(false);
+    return ok;
+}
+
+/* A command window of one with room to queue behind it */
+typedef eseyeAWSBasic<eseyeAWSConfig<MAX_SUB_TOPICS, MAX_PUB_TOPICS, MODEM_TX_BUFSIZE, MODEM_RX_BUFSIZE,
+                                     eseyeCmdQueue<6, 1> > > eseyeAWSSerial;
+
+struct cmdreply
+{
+    const char *expect;
+    unsigned lines;
+    unsigned matched;
+    unsigned results;
+    int8_t result;
+};
+
+static unsigned long atlines;
+
+static void atcount(char *data){
+    (void)data;
+    atlines++;
+}
+
+static void cmdreplycb(char *line, int8_t result, void *ctx){
+    struct cmdreply *r = (struct cmdreply *)ctx;
+    if(result == ESEYE_CMD_LINE){
+        r->lines++;
+        if(r->expect != NULL && strstr(line, r->expect) != NULL)
+            r->matched++;
+    }else{
+        r->results++;
+        r->result = result;
+    }
+}
+
+/* Order the commands (and the publish) of the priority check were answered in */
+static char cmdorder[16];
+static uint8_t cmdorderlen;
+
+static void ordercb(char *line, int8_t result, void *ctx){
+    (void)line;
+    if(result != ESEYE_CMD_LINE && cmdorderlen < sizeof(cmdorder) - 1)
+        cmdorder[cmdorderlen++] = *(const char *)ctx;
+}
+
+static void orderpubcb(uint8_t id, boolean success){
+    (void)id;
+    (void)success;
+    if(cmdorderlen < sizeof(cmdorder) - 1)
+        cmdorder[cmdorderlen++] = 'P';
+}
+
+/* Application commands with response callbacks sent among publishes and a
+ * subscribed message stream on the simulated clock - each reply (+QCCID,
+ * +AWSVER or ERROR for an unknown command) must reach the command which
+ * asked for it and nothing the AT command callback. Then housekeeping
+ * commands queued behind a window of one, which a publish overtakes */
+static bool bench_cmds(unsigned long count){
+    static const char *const cmds[] = {"AT+QCCID\r\n", "AT+AWSVER\r\n", "AT+BOGUS\r\n"};
+    static const char *const replies[] = {"+QCCID:", "+AWSVER:", NULL};
+    std::vector<struct cmdreply> r(count);
+    unsigned long sent = 0, refused = 0, correct = 0, publishes = 0;
+    bool ok;
+    hostUseSimClock(true);
+    hostSetMillis(0);
+    {
+        SimModem modem;
+        eseyeAWSHost aws(&modem);
+        atlines = 0;
+        aws.init(atcount);
+        int sub = aws.subscribe((char *)"bench/sub", countcb);
+        int pub = aws.pubreg((char *)"bench/pub");
+        drain(modem, aws);
+        if(aws.sendAT((char *)"AT\r\n", cmdreplycb, &r[0]) < 0){
+            printf("cmds     no command scheduling in this build\n");
+            hostUseSimClock(false);
+            return true;
+        }
+        drain(modem, aws);
+        memset(&r[0], 0, sizeof(r[0]));
+        modem.setMessageRate(sub, 200, 32);
+        modem.setPromptDelay(5);
+        while(sent < count){
+            if(aws.pubqueued() < 2 && aws.publish(pub, (uint8_t *)"{\"v\":1}", 7) >= 0)
+                publishes++;
+            r[sent].expect = replies[sent % 3];
+            if(aws.sendAT((char *)cmds[sent % 3], cmdreplycb, &r[sent]) == 0)
+                sent++;
+            else
+                refused++;
+            hostAdvanceMillis(1);
+            modem.tick();
+            aws.poll();
+        }
+        for(int i = 0; i < 100; i++){
+            hostAdvanceMillis(1);
+            aws.poll();
+        }
+        for(unsigned long i = 0; i < count; i++){
+            if(r[i].expect != NULL)
+                correct += r[i].lines == 1 && r[i].matched == 1 && r[i].results == 1 && r[i].result == 0;
+            else
+                correct += r[i].lines == 0 && r[i].results == 1 && r[i].result == ESEYE_CMD_ERROR;
+        }
+        printf("cmds     %8lu commands among %lu publishes and %lu msgs: %lu answered correctly, %lu lines to the AT callback, "
+               "%lu refused while full%s\n", count, publishes, modem.urcs, correct, atlines, refused,
+               correct == count && atlines == 0 ? "" : "  (MISATTRIBUTED)");
+        ok = correct == count && atlines == 0;
+    }
+    {
+        static const char tags[] = "ABCD";
+        SimModem modem;
+        eseyeAWSSerial aws(&modem);
+        aws.init();
+        aws.pubcallback(orderpubcb);
+        int pub = aws.pubreg((char *)"bench/pub");
+        drain(modem, aws);
+        cmdorderlen = 0;
+        unsigned long before = modem.commands;
+        for(int i = 0; i < 4; i++)
+            aws.sendAT((char *)"AT\r\n", ordercb, (void *)&tags[i]);
+        unsigned long written = modem.commands - before;
+        aws.publish(pub, (uint8_t *)"{\"v\":1}", 7);
+        for(int i = 0; i < 100; i++){
+            hostAdvanceMillis(1);
+            modem.tick();
+            aws.poll();
+        }
+        cmdorder[cmdorderlen] = 0;
+        bool ordered = written == 1 && strcmp(cmdorder, "APBCD") == 0;
+        printf("cmds     window 1: %lu of 4 commands sent before an answer, answered in order %s%s\n",
+               written, cmdorder, ordered ? "" : "  (WRONG ORDER)");
+        ok = ok && ordered;
+    }
+    hostUseSimClock(false);
+    return ok;
+}
+
+/* ns per 64 byte URC through poll() for a configuration */
+template<class AWS> static double urccost(unsigned long count){
+    SimModem modem;
+    AWS aws(&modem);
+    uint8_t payload[64];
+    aws.init();
+    int idx = aws.subscribe((char *)"bench/sub", countcb);
+    drain(modem, aws);
+    memset(payload, 'm', sizeof(payload));
+    for(unsigned long i = 0; i < count; i++)
+        modem.inject(idx, payload, sizeof(payload));
+    double start = now_s();
+    drain(modem, aws);
+    return (now_s() - start) * 1e9 / count;
+}
+
+/* Link metrics after a mixed workload on the simulated clock - messages
+ * received, AT commands, an over-long line, a stray OK and publishes whose
+ * prompt is delayed by different amounts - and their cost per URC */
+static bool bench_metrics(unsigned long count){
+    static const unsigned long promptdelays[] = {20, 150, 400, 1500};
+    struct eseyeMetricCounts m;
+    bool ok;
+    hostUseSimClock(true);
+    hostSetMillis(0);
+    {
+        SimModem modem;
+        eseyeAWSHost aws(&modem);
+        aws.init(NULL);
+        int sub = aws.subscribe((char *)"bench/sub", countcb);
+        int pub = aws.pubreg((char *)"bench/pub");
+        drain(modem, aws);
+        modem.setMessageRate(sub, 10, 32);
+        for(int i = 0; i < 40; i++){
+            modem.setPromptDelay(promptdelays[i % 4]);
+            aws.publish(pub, (uint8_t *)"{\"v\":1}", 7);
+            while(!aws.pubdone()){
+                hostAdvanceMillis(10);
+                modem.tick();
+                aws.poll();
+            }
+        }
+        aws.sendAT((char *)"AT+AWSVER\r\n");
+        modem.injectRaw("OK\r\n");
+        std::string longline(300, 'x');
+        longline += "\r\n";
+        modem.injectRaw(longline.c_str());
+        drain(modem, aws);
+        aws.metrics(&m, true);
+        if(m.bytesin == 0){
+            printf("metrics  no link metrics in this build\n");
+            hostUseSimClock(false);
+            return true;
+        }
+        printf("metrics  %lu ms: in %lu out %lu bytes, %lu msgs %lu opens %lu ok %lu crlf, %lu forwarded %lu discarded %lu wraps %lu stray\n",
+               millis() - m.since, m.bytesin, m.bytesout, m.urcs[URC_MSG], m.urcs[URC_SUBOPEN] + m.urcs[URC_PUBOPEN],
+               m.urcs[URC_OK], m.urcs[URC_CRLF], m.forwarded, m.discarded, m.rxwraps, m.okstray);
+        /* 10 publishes at each prompt delay, the stray OK and the long line */
+        ok = m.sendok == 40 && m.sendfail == 0 && m.okstray == 1 && m.rxwraps > 0 &&
+             m.latency[0] == 10 && m.latency[1] == 10 && m.latency[2] == 10 && m.latency[4] == 10;
+        printf("metrics  send ok %lu fail %lu, latency", m.sendok, m.sendfail);
+        for(int i = 0; i < ESEYE_LATENCY_BUCKETS; i++){
+            if(i < ESEYE_LATENCY_BUCKETS - 1)
+                printf(" <%u:%lu", (unsigned)eseyeLatencyBounds[i], m.latency[i]);
+            else
+                printf(" more:%lu", m.latency[i]);
+        }
+        aws.metrics(&m);
+        ok = ok && m.urcs[URC_MSG] == 0;
+        printf(", after reset %lu urcs%s\n", m.urcs[URC_MSG], ok ? "" : "  (WRONG COUNTS)");
+    }
+    hostUseSimClock(false);
+    double with = urccost<eseyeAWSHost>(count), without = urccost<eseyeAWSNoMetrics>(count);
+    printf("metrics  cost: %.1f ns/urc with, %.1f ns/urc without\n", with, without);
+    return ok;
+}
+
+/* Several modems driven through one poller - publishes are spread across
+ * them by queue depth while every modem also streams subscribed messages */
+#define MULTI_LINKS 3
+static bool bench_multi(unsigned long count, uint16_t payloadlen){
+    SimModem modem[MULTI_LINKS];
+    eseyeAWSHost *aws[MULTI_LINKS];
+    eseyeAWSPoller<MULTI_LINKS> poller;
+    int pubidx[MULTI_LINKS];
+    unsigned long injected = 0;
+
+    rxmsgs = rxbytes = 0;
+    for(int l = 0; l < MULTI_LINKS; l++){
+        aws[l] = new eseyeAWSHost(&modem[l]);
+        aws[l]->init();
+        poller.add(aws[l]);
+        pubidx[l] = aws[l]->pubreg((char *)"bench/pub");
+        if(setup_sub(modem[l], *aws[l]) < 0)
+            return false;
+    }
+
+    uint8_t payload[2048];
+    for(unsigned i = 0; i < payloadlen; i++)
+        payload[i] = 'A' + (i % 26);
+
+    unsigned long queued = 0;
+    bool busy = true;
+    double start = now_s();
+    while(queued < count || busy){
+        while(queued < count && poller.publishref(pubidx, payload, payloadlen) >= 0)
+            queued++;
+        /* Keep a message arriving on every link */
+        for(int l = 0; l < MULTI_LINKS && injected < count; l++, injected++)
+            modem[l].inject(0, payload, 32);
+        poller.poll(64);
+        busy = false;
+        for(int l = 0; l < MULTI_LINKS; l++)
+            busy = busy || !aws[l]->pubdone() || modem[l].available() > 0;
+    }
+    double elapsed = now_s() - start;
+
+    unsigned long publishes = 0;
+    printf("multi    %d links payload %4u: %8.0f publishes/s, %8.0f msgs/s, per link",
+           MULTI_LINKS, (unsigned)payloadlen, count / elapsed, rxmsgs / elapsed);
+    for(int l = 0; l < MULTI_LINKS; l++){
+        printf(" %lu", modem[l].publishes);
+        publishes += modem[l].publishes;
+        delete aws[l];
+    }
+    printf("%s\n", publishes == count && rxmsgs == injected ? "" : "  (MISSING MESSAGES)");
+    return publishes == count && rxmsgs == injected;
+}
+
+/* Status polling from loop() with response timeouts enabled and all topics
+ * in use - with one registration still waiting for its response or none */
+static bool bench_status(unsigned long count, bool pending){
+    SimModem modem;
+    eseyeAWSLarge aws(&modem);
+    aws.init();
+    int idx = 0;
+    char topic[16];
+    /* A topic per slot - one name would share a single slot */
+    for(int i = 0; i < eseyeAWSLarge::config::maxSubTopics; i++){
+        snprintf(topic, sizeof(topic), "bench/sub%d", i);
+        aws.subscribe(topic, countcb);
+        drain(modem, aws);
+    }
+    for(int i = 0; i < eseyeAWSLarge::config::maxPubTopics; i++){
+        snprintf(topic, sizeof(topic), "bench/pub%d", i);
+        idx = aws.pubreg(topic);
+        if(pending == false || i < eseyeAWSLarge::config::maxPubTopics - 1)
+            drain(modem, aws);
+    }
+    while(modem.available() > 0)
+        modem.read();
+
+    unsigned long registered = 0;
+    double start = now_s();
+    for(unsigned long i = 0; i < count; i++)
+        registered += aws.pubstate(0) == PUB_TOPIC_REGISTERED;
+    double elapsed = now_s() - start;
+    unsigned long next = aws.nextDeadline();
+    printf("status   %s %8lu calls %8.1f ns/pubstate() next deadline %ld ms%s\n",
+           pending ? "1 pending:" : "idle:     ", count, elapsed * 1e9 / count,
+           next == ESEYE_NO_DEADLINE ? -1L : (long)next, registered == count && idx >= 0 ? "" : "  (NOT REGISTERED)");
+    return registered == count && idx >= 0;
+}
+
+/* Non-blocking TX: publishes and commands trickle out through a uart FIFO
+ * which only has room for fifobytes each simulated millisecond */
+static bool bench_nonblocking(unsigned long count, uint16_t payloadlen, int fifobytes){
+    bool ok;
+    hostUseSimClock(true);
+    hostSetMillis(0);
+    {
+        SimModem modem;
+        eseyeAWSHost aws(&modem);
+        aws.init();
+        aws.txnonblocking(true);
+        modem.setWriteRoom(fifobytes);
+        int idx = aws.pubreg((char *)"bench/pub");
+        uint8_t payload[2048];
+        for(unsigned i = 0; i < payloadlen; i++)
+            payload[i] = 'A' + (i % 26);
+
+        unsigned long queued = 0, ms = 0;
+        double worst = 0;
+        while(queued < count || !aws.pubdone() || modem.available() > 0){
+            while(queued < count && aws.pubstate(idx) == PUB_TOPIC_REGISTERED &&
+                  aws.publishref(idx, payload, payloadlen) >= 0)
+                queued++;
+            double start = now_s();
+            aws.poll();
+            double elapsed = now_s() - start;
+            if(elapsed > worst)
+                worst = elapsed;
+            hostAdvanceMillis(1);
+            modem.tick();
+            if(++ms > count * 1000)
+                break;
+        }
+        printf("nonblock payload %4u fifo %3d: %8lu msgs in %lu simulated ms, worst poll() %.1f us%s\n",
+               (unsigned)payloadlen, fifobytes, modem.publishes, ms, worst * 1e6,
+               modem.publishes == count ? "" : "  (MISSING PUBLISHES)");
+        ok = modem.publishes == count;
+    }
+    hostUseSimClock(false);
+    return ok;
+}
+
+int main(int argc, char **argv){
+    unsigned long count = 200000;
+    bool ok = true;
+    if(argc > 1)
+        count = strtoul(argv[1], NULL, 10);
+
+    {
+        SimModem modem;
+        eseyeAWS aws(&modem);
+        eseyeAWSHost host(&modem);
+        eseyeAWSTiny tiny(&modem);
+        eseyeAWSLarge large(&modem);
+        printf("ram      static %u bytes, per instance %u bytes (with the host tools' features %u, tiny %u, large %u)\n",
+               (unsigned)eseyeAWS::staticram(), (unsigned)aws.instanceram(), (unsigned)host.instanceram(),
+               (unsigned)tiny.instanceram(), (unsigned)large.instanceram());
+    }
+    ok = bench_urc(count, 16) && ok;
+    ok = bench_urc(count, 64) && ok;
+    ok = bench_urc(count, 96) && ok;
+    ok = bench_urc(count, 96, true) && ok;
+    ok = bench_urc(count / 10, 1024, true) && ok;
+    ok = bench_ingest(count, 16, 4096) && ok;
+    ok = bench_ingest(count, 96, 4096) && ok;
+    ok = bench_publish(count / 10, 16) && ok;
+    ok = bench_publish(count / 10, 100) && ok;
+    ok = bench_publish_queued(count / 10, 16, PUB_MODE_COPY) && ok;
+    ok = bench_publish_queued(count / 10, 100, PUB_MODE_COPY) && ok;
+    ok = bench_publish_queued(count / 10, 100, PUB_MODE_REF) && ok;
+    ok = bench_publish_queued(count / 10, 1024, PUB_MODE_REF) && ok;
+    ok = bench_publish_queued(count / 10, 1024, PUB_MODE_WRITER) && ok;
+    ok = bench_batch(count / 10, 16) && ok;
+    ok = bench_cbor(count) && ok;
+    ok = bench_journal(count / 10) && ok;
+    ok = bench_multi(count / 10, 100) && ok;
+    ok = bench_ops(count / 10) && ok;
+    ok = bench_cmds(count / 10) && ok;
+    ok = bench_status(count, false) && ok;
+    ok = bench_status(count, true) && ok;
+    ok = bench_nonblocking(1000, 100, 16) && ok;
+    ok = bench_metrics(count) && ok;
+    ok = bench_recover(0) && ok;
+    ok = bench_recover(5000) && ok;
+    ok = bench_recover(60000) && ok;
+    ok = bench_recover(600000) && ok;
+    bench_paced(100, 64, 60);
+    bench_paced(1000, 32, 60);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,246 @@
+/***************************************************************************
+  Multi-threaded stress benchmark for the gateway mode (awsgateway.h) of
+  host builds of the eseyeaws library.
+
+  Producer threads publish through one AWSGateway whose I/O thread owns an
+  instance and the simulated modem, while consumer threads each take the
+  messages of their own subscription (arriving at CONSUMER_MSG_RATE) out of
+  their own ring. Reports publish throughput with every producer flooding
+  the queue, then publish latency (publish() to SEND OK) with them paced at
+  PACED_RATE in total, and the rate, latency (URC parsed to pop()) and
+  overruns of the message delivery which ran alongside.
+
+  usage: gateway_bench [producers] [consumers] [messages]
+
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "awsgateway.h"
+#include "simmodem.h"
+
+#define CONSUMER_MSG_RATE 20000
+#define CONSUMER_PAYLOAD 64
+#define PACED_RATE 20000
+#define PACED_SECONDS 2
+
+/* A gateway instance - a deep publish queue, whole messages up to 255 bytes
+ * and a completion for each publish it can have in flight */
+struct GatewayConfig : eseyeAWSDefaults
+{
+    static const uint16_t txBufSize = 2048;
+    static const uint8_t rxBufSize = 255;
+    static const uint8_t rxChunkSize = 128;
+    static const uint8_t pubQueueLen = 7;
+    static const uint8_t pendingOps = 16;
+    typedef eseyeNoTrace tracePolicy;
+};
+typedef eseyeAWSBasic<GatewayConfig> eseyeAWSGateway;
+
+struct producer
+{
+    int pub;
+    unsigned long count;
+    /* 0 floods */
+    double rate;
+    /* Filled in on the I/O thread, read once it has stopped */
+    std::vector<uint32_t> latencyns;
+    unsigned long failed;
+};
+
+struct consumer
+{
+    GatewayRing *ring;
+    std::vector<uint32_t> latencyns;
+    unsigned long bytes;
+};
+
+static std::atomic<bool> consuming;
+
+static double now_s(void){
+    return gatewayNanos() / 1e9;
+}
+
+static void pubdone(void *ctx, int8_t result, uint64_t latencyns){
+    struct producer *p = (struct producer *)ctx;
+    if(result != 0)
+        p->failed++;
+    p->latencyns.push_back(latencyns > 0xffffffffULL ? 0xffffffffUL : (uint32_t)latencyns);
+}
+
+static void produce(AWSGateway<eseyeAWSGateway> *gw, struct producer *p){
+    uint8_t payload[32];
+    uint64_t start = gatewayNanos(), due;
+    struct timespec ts;
+    snprintf((char *)payload, sizeof(payload), "{\"seq\":%08lu}", 0UL);
+    for(unsigned long i = 0; i < p->count; i++){
+        if(p->rate > 0){
+            due = start + (uint64_t)(i * 1e9 / p->rate);
+            uint64_t now = gatewayNanos();
+            if(due > now){
+                ts.tv_sec = (due - now) / 1000000000ULL;
+                ts.tv_nsec = (due - now) % 1000000000ULL;
+                nanosleep(&ts, NULL);
+            }
+        }
+        while(!gw->publish(p->pub, payload, 16, pubdone, p))
+            std::this_thread::yield();
+    }
+}
+
+static void consume(struct consumer *c){
+    uint8_t buf[256];
+    uint64_t stamp;
+    int n;
+    for(;;){
+        n = c->ring->pop(buf, sizeof(buf), NULL, &stamp);
+        if(n < 0){
+            if(!consuming.load(std::memory_order_relaxed) && c->ring->empty())
+                return;
+            std::this_thread::yield();
+            continue;
+        }
+        c->bytes += n;
+        c->latencyns.push_back((uint32_t)(gatewayNanos() - stamp));
+    }
+}
+
+/* The I/O thread drives the simulated modem's message stream */
+static void modemtick(void *ctx){
+    ((SimModem *)ctx)->tick();
+}
+
+static void percentiles(std::vector<uint32_t> &v, char *out, size_t size){
+    if(v.empty()){
+        snprintf(out, size, "none");
+        return;
+    }
+    std::sort(v.begin(), v.end());
+    snprintf(out, size, "p50 %.1f p99 %.1f p99.9 %.1f max %.1f us",
+             v[v.size() / 2] / 1e3, v[v.size() * 99 / 100] / 1e3, v[v.size() * 999 / 1000] / 1e3, v.back() / 1e3);
+}
+
+/* One run - every producer publishes count messages (at rate in total, or
+ * flat out if it is 0) while every consumer takes messages */
+static bool run(unsigned nproducers, unsigned nconsumers, unsigned long count, double rate){
+    SimModem modem;
+    eseyeAWSGateway aws(&modem);
+    std::vector<GatewayRing *> rings;
+    std::vector<struct producer> producers(nproducers);
+    std::vector<struct consumer> consumers(nconsumers);
+    std::vector<std::thread> threads;
+    struct GatewayCounts gc;
+    std::vector<uint32_t> all;
+    char lat[128];
+    bool ok = true;
+    aws.init();
+    {
+        AWSGateway<eseyeAWSGateway> gw(aws);
+        int pub = gw.pubreg("gateway/report");
+        for(unsigned i = 0; i < nconsumers; i++){
+            char topic[32];
+            snprintf(topic, sizeof(topic), "gateway/cmd/%u", i);
+            rings.push_back(new GatewayRing(1 << 16));
+            consumers[i].ring = rings[i];
+            consumers[i].bytes = 0;
+            if(gw.subscribe(topic, rings[i], i) != (int)i){
+                printf("gateway  no route for consumer %u\n", i);
+                ok = false;
+            }
+        }
+        while(modem.available() > 0)
+            aws.poll();
+        if(pub < 0 || aws.pubstate(pub) != PUB_TOPIC_REGISTERED){
+            printf("gateway  couldn't register the publish topic\n");
+            ok = false;
+        }
+        for(unsigned i = 0; i < nconsumers; i++)
+            modem.setMessageRate(i, CONSUMER_MSG_RATE, CONSUMER_PAYLOAD);
+        gw.pollhook(modemtick, &modem);
+        for(unsigned i = 0; i < nproducers; i++){
+            producers[i].pub = pub;
+            producers[i].count = count / nproducers;
+            producers[i].rate = rate / nproducers;
+            producers[i].failed = 0;
+            producers[i].latencyns.reserve(producers[i].count);
+        }
+
+        consuming = true;
+        gw.start();
+        double start = now_s();
+        for(unsigned i = 0; i < nconsumers; i++)
+            threads.push_back(std::thread(consume, &consumers[i]));
+        std::vector<std::thread> pubthreads;
+        for(unsigned i = 0; i < nproducers; i++)
+            pubthreads.push_back(std::thread(produce, &gw, &producers[i]));
+        for(size_t i = 0; i < pubthreads.size(); i++)
+            pubthreads[i].join();
+        gw.stop();
+        double elapsed = now_s() - start;
+        consuming = false;
+        for(size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+        gw.counts(&gc);
+
+        unsigned long published = 0, failed = 0;
+        for(unsigned i = 0; i < nproducers; i++){
+            published += producers[i].count;
+            failed += producers[i].failed;
+            all.insert(all.end(), producers[i].latencyns.begin(), producers[i].latencyns.end());
+        }
+        percentiles(all, lat, sizeof(lat));
+        if(rate > 0)
+            printf("gateway  paced   %2u producers at %6.0f/s: %8lu publishes, latency %s%s\n",
+                   nproducers, rate, published, lat,
+                   all.size() == published && failed == 0 ? "" : "  (MISSING COMPLETIONS)");
+        else
+            printf("gateway  flood   %2u producers: %8lu publishes in %.2f s, %9.0f/s, %lu refused while full, latency %s%s\n",
+                   nproducers, published, elapsed, published / elapsed, gc.queuefull, lat,
+                   all.size() == published && failed == 0 ? "" : "  (MISSING COMPLETIONS)");
+        ok = ok && all.size() == published && failed == 0 && modem.publishes == published;
+
+        all.clear();
+        unsigned long received = 0;
+        for(unsigned i = 0; i < nconsumers; i++){
+            received += consumers[i].latencyns.size();
+            all.insert(all.end(), consumers[i].latencyns.begin(), consumers[i].latencyns.end());
+        }
+        percentiles(all, lat, sizeof(lat));
+        printf("gateway  deliver %2u consumers: %8lu messages, %9.0f/s, %lu overruns, latency %s%s\n",
+               nconsumers, received, received / elapsed, gc.overruns, lat,
+               received == gc.delivered ? "" : "  (MISSING MESSAGES)");
+        ok = ok && received == gc.delivered;
+    }
+    for(size_t i = 0; i < rings.size(); i++)
+        delete rings[i];
+    return ok;
+}
+
+int main(int argc, char **argv){
+    unsigned producers = 4;
+    unsigned consumers = 2;
+    unsigned long count = 200000;
+    bool ok;
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if(argc > 1)
+        producers = atoi(argv[1]);
+    if(argc > 2)
+        consumers = atoi(argv[2]);
+    if(argc > 3)
+        count = strtoul(argv[3], NULL, 10);
+    if(producers == 0 || consumers > GATEWAY_MAX_ROUTES || consumers > GatewayConfig::maxSubTopics){
+        fprintf(stderr, "usage: %s [producers] [consumers (up to %u)] [messages]\n", argv[0],
+                (unsigned)std::min<unsigned>(GATEWAY_MAX_ROUTES, GatewayConfig::maxSubTopics));
+        return 2;
+    }
+    ok = run(producers, consumers, count, 0);
+    ok = run(producers, consumers, PACED_RATE * PACED_SECONDS, PACED_RATE) && ok;
+    return ok ? 0 : 1;
+}
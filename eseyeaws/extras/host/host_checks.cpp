@@ -0,0 +1,175 @@
+/***************************************************************************
+  Behaviour checks for host builds of the eseyeaws library.
+
+  Unlike the benchmarks these measure nothing: each check drives a part of
+  the library (against SimModem where it talks to the modem) and reports
+  whether it did what it should. The exit status
+  is 1 if any check failed, so it can run under CTest.
+
+  usage: host_checks
+
+ ***************************************************************************/
+
+#include <stdio.h>
+
+#include "eseyeaws.h"
+#include "eseyeaws_cbor.h"
+#include "simmodem.h"
+
+/* Sharing needs the topic pool, which is off by default - turned on here
+ * whatever the build so the checks run with ESEYEAWS_LOWRAM too */
+struct eseyeSharingConfig : eseyeAWSDefaults
+{
+    static const uint8_t topicPoolSize = 64;
+    static const uint8_t sharedSubHandlers = 2;
+};
+typedef eseyeAWSBasic<eseyeSharingConfig> eseyeAWSSharing;
+
+static bool report(const char *name, bool ok){
+    printf("%-44s %s\n", name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+/* A float of each width and an integer read as floats */
+static bool cbor_floats(void){
+    static const uint8_t msg[] = {
+        0x84, 0xf9, 0x4d, 0x60, 0xfa, 0x41, 0xac, 0x00, 0x00,
+        0xfb, 0x40, 0x35, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x38, 0x14};
+    eseyeCBORReader rd(msg, sizeof(msg));
+    uint16_t items = 0;
+    float f[4] = {0, 0, 0, 0};
+    bool ok = rd.array(&items) && items == 4;
+    for(uint16_t i = 0; ok && i < items; i++)
+        ok = rd.number(&f[i]);
+    return report("cbor: half, single and double floats", ok && f[0] == 21.5f && f[1] == 21.5f &&
+                  f[2] == 21.5f && f[3] == -21.0f && rd.peek() == CBOR_END);
+}
+
+/* A double, 64 bit integers and a tagged double ahead of the key wanted -
+ * skip() has to step over them whatever the width of long */
+static bool cbor_skips(void){
+    static const uint8_t msg[] = {
+        0xa5,
+        0x61, 'd', 0xfb, 0x40, 0x09, 0x21, 0xfb, 0x54, 0x44, 0x2d, 0x18,
+        0x61, 'u', 0x1b, 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0,
+        0x61, 'n', 0x3b, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe,
+        0x61, 't', 0xdb, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0xfb, 0x3f, 0xf0, 0, 0, 0, 0, 0, 0,
+        0x64, 'T', 'e', 'm', 'p', 0xf9, 0x4d, 0x60};
+    eseyeCBORReader rd(msg, sizeof(msg));
+    uint16_t pairs = 0;
+    float temp = 0;
+    bool ok = rd.map(&pairs) && pairs == 5;
+    for(uint16_t i = 0; ok && i < pairs - 1; i++)
+        ok = !rd.key("Temp") && rd.skip() && rd.skip();
+    ok = ok && rd.key("Temp") && rd.number(&temp) && temp == 21.5f && rd.peek() == CBOR_END && !rd.error();
+    return report("cbor: skip wide numbers in a map", ok);
+}
+
+/* Items running past the end of the message */
+static bool cbor_truncated(void){
+    static const uint8_t msg[] = {0xa1, 0x64, 'T', 'e', 'm', 'p', 0xfb, 0x40, 0x35};
+    eseyeCBORReader rd(msg, sizeof(msg));
+    uint16_t pairs = 0;
+    bool ok = rd.map(&pairs) && rd.key("Temp") && !rd.skip() && rd.error() && rd.peek() == CBOR_END;
+    return report("cbor: truncated item fails the read", ok);
+}
+
+static unsigned long msgsa, msgsb;
+
+static void cba(uint8_t *data, uint8_t length){
+    (void)data;
+    (void)length;
+    msgsa++;
+}
+
+static void cbb(uint8_t *data, uint8_t length){
+    (void)data;
+    (void)length;
+    msgsb++;
+}
+
+static void drain(SimModem &modem, eseyeAWSSharing &aws){
+    while(modem.available() > 0)
+        aws.poll();
+}
+
+/* Topics open on the modem */
+static int opened(const bool *open){
+    int n = 0;
+    for(int i = 0; i < SIM_MAX_TOPICS; i++)
+        n += open[i];
+    return n;
+}
+
+/* A second subscription to a topic shares its slot and both get every
+ * message; only the last unsubscribe() closes it on the modem */
+static bool sub_sharing(void){
+    SimModem modem;
+    eseyeAWSSharing aws(&modem);
+    aws.init();
+    drain(modem, aws);
+    unsigned long opens = modem.opens;
+    int a = aws.subscribe((char *)"check/sub", cba);
+    int b = aws.subscribe((char *)"check/sub", cbb);
+    drain(modem, aws);
+    bool ok = a >= 0 && b >= 0 && a != b && modem.opens - opens == 1 && opened(modem.subopen) == 1 &&
+              aws.substate(a) == SUB_TOPIC_SUBSCRIBED && aws.substate(b) == SUB_TOPIC_SUBSCRIBED;
+    msgsa = msgsb = 0;
+    modem.inject(0, (const uint8_t *)"ping", 4);
+    drain(modem, aws);
+    ok = report("sub: second subscribe shares the slot", ok && msgsa == 1 && msgsb == 1);
+
+    unsigned long commands = modem.commands;
+    bool first = aws.unsubscribe(a) == 0;
+    drain(modem, aws);
+    msgsa = msgsb = 0;
+    modem.inject(0, (const uint8_t *)"ping", 4);
+    drain(modem, aws);
+    first = first && modem.commands == commands && opened(modem.subopen) == 1 &&
+            aws.substate(b) == SUB_TOPIC_SUBSCRIBED && msgsa == 0 && msgsb == 1;
+    ok = report("sub: unsubscribe of a shared topic keeps it", first) && ok;
+
+    bool last = aws.unsubscribe(b) == 0;
+    drain(modem, aws);
+    last = last && modem.commands == commands + 1 && opened(modem.subopen) == 0 && aws.substate(b) == SUB_TOPIC_NOT_IN_USE;
+    return report("sub: last unsubscribe sends SUBCLOSE", last) && ok;
+}
+
+/* pubreg() of a registered topic returns its index and counts a reference;
+ * pubunreg() closes it only once the last one is undone */
+static bool pub_refs(void){
+    SimModem modem;
+    eseyeAWSSharing aws(&modem);
+    aws.init();
+    drain(modem, aws);
+    unsigned long opens = modem.opens;
+    int p1 = aws.pubreg((char *)"check/pub");
+    int p2 = aws.pubreg((char *)"check/pub");
+    drain(modem, aws);
+    bool ok = p1 >= 0 && p1 == p2 && modem.opens - opens == 1 && opened(modem.pubopen) == 1 &&
+              aws.pubstate(p1) == PUB_TOPIC_REGISTERED;
+    ok = report("pub: second pubreg shares the index", ok);
+
+    unsigned long commands = modem.commands;
+    bool first = aws.pubunreg(p1) == 0;
+    drain(modem, aws);
+    first = first && modem.commands == commands && opened(modem.pubopen) == 1 && aws.pubstate(p2) == PUB_TOPIC_REGISTERED;
+    ok = report("pub: pubunreg with a reference left keeps it", first) && ok;
+
+    bool last = aws.pubunreg(p2) == 0;
+    drain(modem, aws);
+    last = last && modem.commands == commands + 1 && opened(modem.pubopen) == 0 && aws.pubstate(p2) == PUB_TOPIC_NOT_IN_USE;
+    ok = report("pub: last pubunreg sends PUBCLOSE", last) && ok;
+    return report("pub: pubunreg of a released topic is refused", aws.pubunreg(p2) < 0) && ok;
+}
+
+int main(void){
+    bool ok = true;
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    ok = cbor_floats() && ok;
+    ok = cbor_skips() && ok;
+    ok = cbor_truncated() && ok;
+    ok = sub_sharing() && ok;
+    ok = pub_refs() && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,34 @@
+/***************************************************************************
+  Library configuration for the host tools.
+
+  The opt-in features (topic pool and shared subscriptions, publish
+  batching, topic recovery, link metrics, uart capture and the publish
+  journal) are off in the default configuration, so the tools which exercise
+  them run eseyeAWSHost - the defaults with those features turned on. With
+  ESEYEAWS_LOWRAM it is the default configuration, as on a 2KB part.
+
+ ***************************************************************************/
+
+#ifndef ESEYEAWS_HOSTCONFIG_H__
+#define ESEYEAWS_HOSTCONFIG_H__
+
+#include "eseyeaws.h"
+
+#ifdef ESEYEAWS_LOWRAM
+typedef eseyeAWSDefaults eseyeAWSHostConfig;
+#else
+struct eseyeAWSHostConfig : eseyeAWSDefaults
+{
+    static const uint8_t topicPoolSize = 128;
+    static const uint8_t sharedSubHandlers = 4;
+    static const uint8_t pubBatches = MODEM_TX_BUFSIZE >= PUB_BATCH_SIZE ? 1 : 0;
+    typedef eseyeRecovery<> recoveryPolicy;
+    typedef eseyeMetrics metricsPolicy;
+    typedef eseyeCapture capturePolicy;
+    typedef eseyeJournal journalPolicy;
+};
+#endif
+
+typedef eseyeAWSBasic<eseyeAWSHostConfig> eseyeAWSHost;
+
+#endif // ESEYEAWS_HOSTCONFIG_H__
@@ -0,0 +1,68 @@
+/***************************************************************************
+  Publish journal store in a memory mapped file for host builds of the
+  eseyeaws library.
+
+ ***************************************************************************/
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journalfile.h"
+
+JournalFile::JournalFile() : map(NULL), len(0) {
+}
+
+JournalFile::~JournalFile(){
+    this->close();
+}
+
+bool JournalFile::open(const char *path, uint16_t len){
+    struct stat st;
+    void *p;
+    int fd;
+    this->close();
+    fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0)
+        return false;
+    if(fstat(fd, &st) < 0 || (st.st_size < len && ftruncate(fd, len) < 0)){
+        ::close(fd);
+        return false;
+    }
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    /* The mapping keeps the file open */
+    ::close(fd);
+    if(p == MAP_FAILED)
+        return false;
+    this->map = (uint8_t *)p;
+    this->len = len;
+    return true;
+}
+
+void JournalFile::close(void){
+    if(this->map == NULL)
+        return;
+    msync(this->map, this->len, MS_SYNC);
+    munmap(this->map, this->len);
+    this->map = NULL;
+    this->len = 0;
+}
+
+void JournalFile::read(uint16_t addr, uint8_t *data, uint16_t len){
+    if(this->map == NULL || (uint32_t)addr + len > this->len)
+        return;
+    memcpy(data, &this->map[addr], len);
+}
+
+void JournalFile::write(uint16_t addr, const uint8_t *data, uint16_t len){
+    if(this->map == NULL || (uint32_t)addr + len > this->len)
+        return;
+    memcpy(&this->map[addr], data, len);
+}
+
+void JournalFile::commit(void){
+    if(this->map != NULL)
+        msync(this->map, this->len, MS_ASYNC);
+}
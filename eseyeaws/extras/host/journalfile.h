@@ -0,0 +1,44 @@
+/***************************************************************************
+  Publish journal store in a memory mapped file for host builds of the
+  eseyeaws library.
+
+  The file stands in for a node's EEPROM: it is created (zero filled) at
+  the requested size on first use and mapped shared, so records journaled
+  by one run are replayed by the next, or can be inspected in between.
+
+      JournalFile store;
+      store.open("/var/lib/node/journal", 4096);
+      aws.init();
+      aws.journal(&store);
+
+ ***************************************************************************/
+
+#ifndef ESEYEAWS_JOURNALFILE_H__
+#define ESEYEAWS_JOURNALFILE_H__
+
+#include "eseyeaws.h"
+
+class JournalFile : public eseyeJournalStore
+{
+public:
+    JournalFile();
+    virtual ~JournalFile();
+
+    /* Map len bytes of path, creating or growing it - returns false (with
+     * errno set) on failure */
+    bool open(const char *path, uint16_t len);
+    void close(void);
+
+    virtual uint16_t size(void) { return this->len; }
+    virtual void read(uint16_t addr, uint8_t *data, uint16_t len);
+    virtual void write(uint16_t addr, const uint8_t *data, uint16_t len);
+    /* Start writing the mapping back - records already outlive the process
+     * once written, this gets them to disk */
+    virtual void commit(void);
+
+private:
+    uint8_t *map;
+    uint16_t len;
+};
+
+#endif // ESEYEAWS_JOURNALFILE_H__
@@ -0,0 +1,197 @@
+/***************************************************************************
+  POSIX serial port transport for host builds - implementation.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "posixserial.h"
+
+/* Kernel tty output buffer size assumed by availableForWrite() */
+#define POSIXSERIAL_TX_ROOM 4096
+
+PosixSerial::PosixSerial(){
+    ttyfd = -1;
+    epfd = -1;
+    owned = false;
+    rxhead = rxtail = 0;
+    readcalls = writecalls = 0;
+}
+
+PosixSerial::~PosixSerial(){
+    this->end();
+}
+
+static speed_t baudconst(unsigned long baud){
+    switch(baud){
+        case 9600:    return B9600;
+        case 19200:   return B19200;
+        case 38400:   return B38400;
+        case 57600:   return B57600;
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+        case 460800:  return B460800;
+        case 921600:  return B921600;
+        default:      return B0;
+    }
+}
+
+bool PosixSerial::begin(const char *path, unsigned long baud){
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(fd < 0)
+        return false;
+    if(this->begin(fd, baud) == false){
+        close(fd);
+        return false;
+    }
+    this->owned = true;
+    return true;
+}
+
+bool PosixSerial::begin(int fd, unsigned long baud){
+    struct epoll_event ev;
+    this->end();
+    this->ttyfd = fd;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    if(this->setup(baud) == false){
+        this->ttyfd = -1;
+        return false;
+    }
+    this->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(this->epfd < 0){
+        this->ttyfd = -1;
+        return false;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(this->epfd, EPOLL_CTL_ADD, fd, &ev);
+    this->owned = false;
+    return true;
+}
+
+/* Raw 8N1, no flow control, reads return whatever has arrived */
+bool PosixSerial::setup(unsigned long baud){
+    struct termios tio;
+    if(tcgetattr(this->ttyfd, &tio) < 0)
+        return false;
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~CRTSCTS;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if(baud != 0){
+        speed_t speed = baudconst(baud);
+        if(speed == B0){
+            errno = EINVAL;
+            return false;
+        }
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+    }
+    return tcsetattr(this->ttyfd, TCSANOW, &tio) == 0;
+}
+
+void PosixSerial::end(void){
+    if(this->epfd >= 0)
+        close(this->epfd);
+    if(this->ttyfd >= 0 && this->owned)
+        close(this->ttyfd);
+    this->epfd = -1;
+    this->ttyfd = -1;
+    this->owned = false;
+    this->rxhead = this->rxtail = 0;
+}
+
+int PosixSerial::wait(long timeoutms){
+    struct epoll_event ev;
+    int n;
+    if(this->rxhead != this->rxtail)
+        return 1;
+    if(this->epfd < 0)
+        return -1;
+    do{
+        n = epoll_wait(this->epfd, &ev, 1, timeoutms < 0 ? -1 : (int)timeoutms);
+    }while(n < 0 && errno == EINTR);
+    return n;
+}
+
+/* Read everything the kernel has for us in one call */
+bool PosixSerial::fill(void){
+    ssize_t n;
+    if(this->ttyfd < 0)
+        return false;
+    this->rxhead = this->rxtail = 0;
+    do{
+        n = ::read(this->ttyfd, this->rxbuf, sizeof(this->rxbuf));
+    }while(n < 0 && errno == EINTR);
+    this->readcalls++;
+    if(n <= 0)
+        return false;
+    this->rxtail = n;
+    return true;
+}
+
+int PosixSerial::available(void){
+    if(this->rxhead == this->rxtail && this->fill() == false)
+        return 0;
+    return (int)(this->rxtail - this->rxhead);
+}
+
+int PosixSerial::read(void){
+    if(this->rxhead == this->rxtail && this->fill() == false)
+        return -1;
+    return this->rxbuf[this->rxhead++];
+}
+
+int PosixSerial::peek(void){
+    if(this->rxhead == this->rxtail && this->fill() == false)
+        return -1;
+    return this->rxbuf[this->rxhead];
+}
+
+size_t PosixSerial::write(uint8_t c){
+    return this->write(&c, 1);
+}
+
+/* Write it all - waiting for room if the kernel buffer is full, as a
+ * hardware uart would (use availableForWrite() to avoid blocking) */
+size_t PosixSerial::write(const uint8_t *buffer, size_t size){
+    size_t done = 0;
+    ssize_t n;
+    struct pollfd pfd;
+    if(this->ttyfd < 0)
+        return 0;
+    while(done < size){
+        n = ::write(this->ttyfd, buffer + done, size - done);
+        this->writecalls++;
+        if(n > 0){
+            done += n;
+        }else if(n < 0 && errno == EAGAIN){
+            pfd.fd = this->ttyfd;
+            pfd.events = POLLOUT;
+            ::poll(&pfd, 1, -1);
+        }else if(n < 0 && errno == EINTR){
+            continue;
+        }else{
+            break;
+        }
+    }
+    return done;
+}
+
+int PosixSerial::availableForWrite(void){
+    int queued = 0;
+    if(this->ttyfd < 0 || ioctl(this->ttyfd, TIOCOUTQ, &queued) < 0)
+        return 0;
+    return queued < POSIXSERIAL_TX_ROOM ? POSIXSERIAL_TX_ROOM - queued : 0;
+}
+
+void PosixSerial::flush(void){
+    if(this->ttyfd >= 0)
+        tcdrain(this->ttyfd);
+}
@@ -0,0 +1,69 @@
+/***************************************************************************
+  POSIX serial port transport for host builds of the eseyeaws library.
+
+  PosixSerial is the Stream an eseyeAWS instance talks to on a Linux gateway:
+  it opens /dev/ttyUSB*, /dev/ttyS* (or a pty) raw and non-blocking, reads
+  in bulk into a local buffer and writes whole buffers per syscall. Its
+  descriptor is exposed so poll() can be driven from epoll/select readiness,
+  or wait() blocks until the modem sends something or a timeout passes:
+
+      for(;;){
+        unsigned long next = aws.nextDeadline();
+        port.wait(next == ESEYE_NO_DEADLINE ? -1 : (long)next);
+        aws.poll();
+      }
+
+ ***************************************************************************/
+
+#ifndef ESEYEAWS_POSIXSERIAL_H__
+#define ESEYEAWS_POSIXSERIAL_H__
+
+#include <Arduino.h>
+
+#define POSIXSERIAL_RX_BUFSIZE 4096
+
+class PosixSerial : public Stream
+{
+public:
+    PosixSerial();
+    virtual ~PosixSerial();
+
+    /* Open a tty raw at baud - returns false (with errno set) on failure */
+    bool begin(const char *path, unsigned long baud = 115200);
+    /* Take over an already open descriptor, e.g. a pty slave (baud 0 = leave as is) */
+    bool begin(int fd, unsigned long baud = 0);
+    void end(void);
+
+    /* The tty descriptor for epoll/select (-1 if not open) */
+    int fd(void) { return this->ttyfd; }
+    /* Block until there is something to read or timeoutms passes (-1 waits
+     * forever) - returns >0 if readable, 0 on timeout, <0 on error */
+    int wait(long timeoutms);
+
+    /* Stream interface */
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    virtual int availableForWrite(void);
+    virtual void flush(void);
+    virtual int available(void);
+    virtual int read(void);
+    virtual int peek(void);
+
+    /* Statistics */
+    unsigned long readcalls;
+    unsigned long writecalls;
+
+private:
+    bool fill(void);
+    bool setup(unsigned long baud);
+
+    int ttyfd;
+    int epfd;
+    bool owned;
+    uint8_t rxbuf[POSIXSERIAL_RX_BUFSIZE];
+    size_t rxhead;
+    size_t rxtail;
+};
+
+#endif // ESEYEAWS_POSIXSERIAL_H__
@@ -0,0 +1,165 @@
+/***************************************************************************
+  Event-driven poll loop over a pty pair for host builds of the eseyeaws
+  library.
+
+  The simulated modem runs in its own thread on the pty master; the
+  library talks to the pty slave through PosixSerial exactly as it would
+  to /dev/ttyUSB0. The library thread sleeps in PosixSerial::wait() (epoll)
+  until the modem sends something or the next response deadline is due,
+  and this reports the CPU it used while idle, while receiving a paced URC
+  stream and, for comparison, when spinning on poll().
+
+  usage: pty_sim [seconds]
+
+ ***************************************************************************/
+
+#include <atomic>
+#include <thread>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "eseyeaws.h"
+#include "posixserial.h"
+#include "simmodem.h"
+
+#define PTY_MSG_RATE 20
+#define PTY_PAYLOAD 64
+#define PTY_PUBLISHES 10
+
+static std::atomic<bool> running;
+static std::atomic<int> msgrate;
+static unsigned long rxmsgs;
+
+static void countcb(uint8_t *data, uint8_t length){
+    (void)data;
+    (void)length;
+    rxmsgs++;
+}
+
+static double thread_cpu_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double now_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The modem end: shuttle bytes between the pty master and the simulated
+ * modem once a millisecond */
+static void modemthread(int master, SimModem *modem){
+    uint8_t buf[512];
+    int rate = 0;
+    while(running){
+        if(msgrate != rate){
+            rate = msgrate;
+            modem->setMessageRate(0, rate, PTY_PAYLOAD);
+        }
+        modem->tick();
+        ssize_t n;
+        while((n = read(master, buf, sizeof(buf))) > 0)
+            modem->write(buf, n);
+        n = 0;
+        while(n < (ssize_t)sizeof(buf) && modem->available() > 0)
+            buf[n++] = modem->read();
+        if(n > 0 && write(master, buf, n) != n)
+            fprintf(stderr, "pty write short\n");
+        usleep(1000);
+    }
+}
+
+/* The library end: sleep until the tty is readable or a deadline is due */
+template<class AWS> static void runfor(AWS &aws, PosixSerial &port, double seconds, bool spin){
+    double end = now_s() + seconds;
+    while(now_s() < end){
+        if(!spin){
+            unsigned long next = aws.nextDeadline();
+            long left = (long)((end - now_s()) * 1000) + 1;
+            port.wait(next == ESEYE_NO_DEADLINE || (long)next > left ? left : (long)next);
+        }
+        aws.poll();
+    }
+}
+
+static void phase(const char *name, eseyeAWS &aws, PosixSerial &port, double seconds, int rate, bool spin){
+    msgrate = rate;
+    rxmsgs = 0;
+    unsigned long reads = port.readcalls;
+    double start = thread_cpu_s();
+    runfor(aws, port, seconds, spin);
+    double cpu = thread_cpu_s() - start;
+    printf("%-8s %4d msgs/s: %6lu msgs %8lu reads %8.3f ms cpu %6.2f%% of one core\n",
+           name, rate, rxmsgs, port.readcalls - reads, cpu * 1e3, cpu * 100 / seconds);
+}
+
+int main(int argc, char **argv){
+    double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+    if(seconds <= 0)
+        seconds = 2.0;
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(master < 0 || grantpt(master) < 0 || unlockpt(master) < 0){
+        perror("posix_openpt");
+        return 1;
+    }
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    PosixSerial port;
+    if(!port.begin(ptsname(master))){
+        perror(ptsname(master));
+        return 1;
+    }
+
+    SimModem modem;
+    running = true;
+    msgrate = 0;
+    std::thread modemside(modemthread, master, &modem);
+
+    eseyeAWS aws(&port);
+    aws.init();
+    int sub = aws.subscribe((char *)"pty/sub", countcb);
+    int pub = aws.pubreg((char *)"pty/pub");
+    double setup = now_s() + 2.0;
+    while(now_s() < setup && (aws.substate(sub) != SUB_TOPIC_SUBSCRIBED || aws.pubstate(pub) != PUB_TOPIC_REGISTERED)){
+        port.wait(100);
+        aws.poll();
+    }
+    if(sub < 0 || pub < 0 || aws.substate(sub) != SUB_TOPIC_SUBSCRIBED || aws.pubstate(pub) != PUB_TOPIC_REGISTERED){
+        printf("registration over %s failed\n", ptsname(master));
+        running = false;
+        modemside.join();
+        return 1;
+    }
+
+    /* Referenced rather than copied, as it needn't fit a LOWRAM txbuf */
+    uint8_t payload[PTY_PAYLOAD];
+    for(unsigned i = 0; i < sizeof(payload); i++)
+        payload[i] = 'A' + (i % 26);
+    double deadline = now_s() + 5.0;
+    for(int i = 0; i < PTY_PUBLISHES && now_s() < deadline; i++){
+        while(aws.publishref(pub, payload, sizeof(payload)) < 0 && now_s() < deadline){
+            port.wait(10);
+            aws.poll();
+        }
+    }
+    while(aws.pubqueued() > 0 && now_s() < deadline){
+        port.wait(10);
+        aws.poll();
+    }
+
+    phase("idle", aws, port, seconds, 0, false);
+    phase("urcs", aws, port, seconds, PTY_MSG_RATE, false);
+    phase("spin", aws, port, seconds, PTY_MSG_RATE, true);
+
+    running = false;
+    modemside.join();
+    printf("publishes over the pty: %lu/%d, %lu write calls\n", modem.publishes, PTY_PUBLISHES, port.writecalls);
+    return modem.publishes == PTY_PUBLISHES ? 0 : 1;
+}
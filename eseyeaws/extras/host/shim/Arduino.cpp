@@ -0,0 +1,182 @@
+/***************************************************************************
+  Minimal Arduino core shim for building the eseyeaws library on a Linux
+  host - implementation.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+
+static boolean simclock = false;
+static unsigned long long simmicros = 0;
+/* Time millis() has missed while frozen, and when it was frozen */
+static unsigned long long lagmicros = 0;
+static boolean frozen = false;
+static unsigned long long frozenat = 0;
+
+static unsigned long long hostMicros(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static unsigned long long simNow(void){
+    return (frozen ? frozenat : simmicros) - lagmicros;
+}
+
+unsigned long millis(void){
+    if(simclock)
+        return (unsigned long)(simNow() / 1000);
+    return (unsigned long)(hostMicros() / 1000);
+}
+
+unsigned long micros(void){
+    if(simclock)
+        return (unsigned long)simNow();
+    return (unsigned long)hostMicros();
+}
+
+void delay(unsigned long ms){
+    if(simclock){
+        simmicros += (unsigned long long)ms * 1000;
+        return;
+    }
+    usleep(ms * 1000);
+}
+
+void hostUseSimClock(boolean enable){
+    simclock = enable;
+}
+
+void hostSetMillis(unsigned long ms){
+    simmicros = (unsigned long long)ms * 1000;
+    lagmicros = 0;
+    frozen = false;
+}
+
+void hostAdvanceMillis(unsigned long ms){
+    simmicros += (unsigned long long)ms * 1000;
+}
+
+void hostFreezeMillis(boolean freeze){
+    if(freeze && !frozen)
+        frozenat = simmicros;
+    else if(!freeze && frozen)
+        lagmicros += simmicros - frozenat;
+    frozen = freeze;
+}
+
+void hostAdjustMillis(unsigned long ms){
+    unsigned long long us = (unsigned long long)ms * 1000;
+    lagmicros -= us < lagmicros ? us : lagmicros;
+}
+
+/* Random numbers - a 32 bit LCG so runs are repeatable for a given seed */
+static unsigned long randstate = 1;
+
+void randomSeed(unsigned long seed){
+    if(seed != 0)
+        randstate = seed;
+}
+
+long random(long howbig){
+    if(howbig <= 0)
+        return 0;
+    randstate = (randstate * 1103515245UL + 12345UL) & 0xffffffffUL;
+    return (long)((randstate >> 1) % (unsigned long)howbig);
+}
+
+long random(long howsmall, long howbig){
+    if(howsmall >= howbig)
+        return howsmall;
+    return howsmall + random(howbig - howsmall);
+}
+
+unsigned long hostWallMillis(void){
+    if(simclock)
+        return (unsigned long)(simmicros / 1000);
+    return millis();
+}
+
+/* Print */
+
+size_t Print::write(const uint8_t *buffer, size_t size){
+    size_t n = 0;
+    while(size--){
+        if(write(*buffer++) == 0)
+            break;
+        n++;
+    }
+    return n;
+}
+
+size_t Print::write(const char *str){
+    if(str == NULL)
+        return 0;
+    return write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::print(unsigned long n, int base){
+    char buf[8 * sizeof(long) + 1];
+    char *str = &buf[sizeof(buf) - 1];
+    if(base < 2)
+        base = 10;
+    *str = '\0';
+    do{
+        char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    }while(n);
+    return write(str);
+}
+
+size_t Print::print(long n, int base){
+    if(base == 10 && n < 0){
+        size_t t = print('-');
+        return t + print((unsigned long)-n, base);
+    }
+    return print((unsigned long)n, base);
+}
+
+/* Stream */
+
+int Stream::timedRead(void){
+    int c;
+    this->_startMillis = millis();
+    do{
+        c = read();
+        if(c >= 0)
+            return c;
+    }while(millis() - this->_startMillis < this->_timeout);
+    return -1;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length){
+    size_t count = 0;
+    while(count < length){
+        int c = timedRead();
+        if(c < 0)
+            break;
+        *buffer++ = (char)c;
+        count++;
+    }
+    return count;
+}
+
+/* Serial */
+
+HostSerial Serial;
+
+size_t HostSerial::write(uint8_t c){
+    return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HostSerial::write(const uint8_t *buffer, size_t size){
+    return fwrite(buffer, 1, size, stdout);
+}
+
+void HostSerial::flush(void){
+    fflush(stdout);
+}
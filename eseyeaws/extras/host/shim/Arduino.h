@@ -0,0 +1,136 @@
+/***************************************************************************
+  Minimal Arduino core shim for building the eseyeaws library on a Linux
+  host.
+
+  Only the parts of the Arduino API the library (and the host tools) use
+  are provided: the Print/Stream classes, millis()/micros()/delay(),
+  random() and no-op interrupt control. The millisecond clock can be switched to a
+  simulated clock so timeouts and sleep can be driven deterministically.
+
+ ***************************************************************************/
+
+#ifndef ESEYEAWS_HOST_ARDUINO_H__
+#define ESEYEAWS_HOST_ARDUINO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+
+#define LOW  0
+#define HIGH 1
+#define CHANGE  1
+#define FALLING 2
+#define RISING  3
+
+/* There is only one address space - flash data is ordinary memory */
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_ptr(addr)  (*(void * const *)(addr))
+#define strncmp_P strncmp
+#define strlen_P  strlen
+#define memcpy_P  memcpy
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper *)(s))
+
+/* Time */
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+
+/* Simulated clock control - when enabled millis()/micros() only advance
+ * through hostAdvanceMillis()/hostSetMillis() */
+void hostUseSimClock(boolean enable);
+void hostSetMillis(unsigned long ms);
+void hostAdvanceMillis(unsigned long ms);
+/* Model a board whose millis() timer stops while it sleeps: while frozen
+ * millis()/micros() stand still as the simulated clock advances, and the
+ * time they missed stays missing until hostAdjustMillis() puts it back */
+void hostFreezeMillis(boolean freeze);
+void hostAdjustMillis(unsigned long ms);
+/* The simulated clock itself - what millis() would read had it never stopped */
+unsigned long hostWallMillis(void);
+
+/* Pseudo-random numbers (alongside the C library's random(void)) */
+void randomSeed(unsigned long seed);
+long random(long howbig);
+long random(long howsmall, long howbig);
+
+/* Interrupt control is meaningless on the host */
+inline void cli(void) {}
+inline void sei(void) {}
+inline void noInterrupts(void) {}
+inline void interrupts(void) {}
+inline void attachInterrupt(uint8_t, void (*)(void), int) {}
+inline void detachInterrupt(uint8_t) {}
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str);
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    virtual int availableForWrite(void) { return 0; }
+    virtual void flush(void) {}
+
+    size_t print(const char *str) { return write(str); }
+    size_t print(const __FlashStringHelper *str) { return write((const char *)str); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+
+    size_t println(void) { return write("\r\n"); }
+    template<typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+    template<typename T> size_t println(T v, int base) { size_t n = print(v, base); return n + println(); }
+};
+
+class Stream : public Print
+{
+public:
+    Stream() : _timeout(1000), _startMillis(0) {}
+    virtual int available(void) = 0;
+    virtual int read(void) = 0;
+    virtual int peek(void) = 0;
+
+    void setTimeout(unsigned long timeout) { this->_timeout = timeout; }
+    /* Not virtual, as in the AVR core - every byte goes through timedRead()
+     * and so millis(), and waits up to the timeout for one which is late */
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+
+protected:
+    int timedRead(void);
+    unsigned long _timeout;
+    unsigned long _startMillis;
+};
+
+/* Serial is the process's stdout; it never has anything to read */
+class HostSerial : public Stream
+{
+public:
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    virtual int available(void) { return 0; }
+    virtual int read(void) { return -1; }
+    virtual int peek(void) { return -1; }
+    virtual void flush(void);
+};
+
+extern HostSerial Serial;
+
+#endif // ESEYEAWS_HOST_ARDUINO_H__
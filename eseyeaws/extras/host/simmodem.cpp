@@ -0,0 +1,335 @@
+/***************************************************************************
+  Simulated anynet-secure modem for host builds - implementation.
+ ***************************************************************************/
+
+#include <ctype.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "simmodem.h"
+
+SimModem::SimModem(){
+    commands = opens = publishes = publishfails = publishbytes = 0;
+    urcs = bytestohost = bytesfromhost = 0;
+    for(int i = 0; i < SIM_MAX_TOPICS; i++){
+        subopen[i] = pubopen[i] = false;
+        rate[i] = credit[i] = 0;
+        ratelen[i] = 0;
+    }
+    pubidx = -1;
+    pubremaining = 0;
+    failevery = 0;
+    openfail = false;
+    promptdelay = 0;
+    promptat = 0;
+    promptpending = false;
+    skiplf = false;
+    writerate = 0;
+    writeroom = 0;
+    lasttick = hostWallMillis();
+    seq = 0;
+    garbledtohost = garbledfromhost = 0;
+    basebaud = modembaud = oldbaud = hostbaud = 0;
+    switchat = 0;
+    iprmode = SIM_IPR_OK;
+}
+
+/* Bytes from the host */
+
+size_t SimModem::write(uint8_t c){
+    bytesfromhost++;
+    if(this->writeroom > 0)
+        this->writeroom--;
+    if(this->modembaud != 0 && this->hostbaud != this->modembaud){
+        this->garbledfromhost++;
+        return 1;
+    }
+    /* The command terminator is '\r', a following '\n' is ignored */
+    if(this->skiplf){
+        this->skiplf = false;
+        if(c == '\n')
+            return 1;
+    }
+    if(this->pubremaining > 0){
+        this->lastpayload.push_back(c);
+        if(--this->pubremaining == 0){
+            this->publishes++;
+            this->publishbytes += this->lastpayload.size();
+            bool ok = this->pubidx >= 0 && this->pubidx < SIM_MAX_TOPICS && this->pubopen[this->pubidx];
+            if(ok && this->failevery > 0 && (this->publishes % this->failevery) == 0)
+                ok = false;
+            if(ok){
+                this->respond("SEND OK\r\n");
+            }else{
+                this->publishfails++;
+                this->respond("SEND FAIL\r\n");
+            }
+            this->respond("OK\r\n");
+        }
+        return 1;
+    }
+    if(c == '\r' || c == '\n'){
+        this->skiplf = c == '\r';
+        if(!this->line.empty()){
+            std::string cmd;
+            cmd.swap(this->line);
+            this->command(cmd);
+        }
+        return 1;
+    }
+    this->line.push_back((char)c);
+    return 1;
+}
+
+size_t SimModem::write(const uint8_t *buffer, size_t size){
+    for(size_t i = 0; i < size; i++)
+        this->write(buffer[i]);
+    return size;
+}
+
+int SimModem::availableForWrite(void){
+    return (int)this->writeroom;
+}
+
+void SimModem::setWriteRoom(int bytesPerMs){
+    this->writerate = bytesPerMs;
+    this->writeroom = bytesPerMs;
+}
+
+/* Bytes to the host */
+
+int SimModem::available(void){
+    this->release();
+    return (int)this->tohost.size();
+}
+
+int SimModem::read(void){
+    this->release();
+    if(this->tohost.empty())
+        return -1;
+    uint8_t c = this->tohost.front();
+    this->garbledtohost += this->garble(&c, 1);
+    this->tohost.pop_front();
+    return c;
+}
+
+size_t SimModem::readBytes(char *buffer, size_t length){
+    this->release();
+    if(length > this->tohost.size())
+        length = this->tohost.size();
+    std::copy(this->tohost.begin(), this->tohost.begin() + length, buffer);
+    this->garbledtohost += this->garble((uint8_t *)buffer, length);
+    this->tohost.erase(this->tohost.begin(), this->tohost.begin() + length);
+    return length;
+}
+
+int SimModem::peek(void){
+    this->release();
+    if(this->tohost.empty())
+        return -1;
+    uint8_t c = this->tohost.front();
+    this->garble(&c, 1);
+    return c;
+}
+
+void SimModem::queue(const uint8_t *data, size_t len){
+    this->tohost.insert(this->tohost.end(), data, data + len);
+    this->bytestohost += len;
+}
+
+void SimModem::respond(const std::string &text){
+    this->queue((const uint8_t *)text.data(), text.size());
+}
+
+void SimModem::injectRaw(const char *text){
+    this->queue((const uint8_t *)text, strlen(text));
+}
+
+void SimModem::inject(int idx, const uint8_t *data, uint16_t len){
+    char hdr[24];
+    int n = snprintf(hdr, sizeof(hdr), "+AWS:%d,%u\r\n", idx, (unsigned)len);
+    this->queue((const uint8_t *)hdr, n);
+    this->queue(data, len);
+    this->urcs++;
+}
+
+/* Bytes from the front of tohost as the host's uart hears them - sent at a
+ * rate it isn't running at (or a broken one) they come out as noise, which
+ * is never a line end or URC start. Returns how many did */
+size_t SimModem::garble(uint8_t *data, size_t len){
+    size_t n = 0;
+    if(this->modembaud == 0)
+        return 0;
+    unsigned long pos = this->bytestohost - this->tohost.size();
+    for(size_t i = 0; i < len; i++, pos++){
+        unsigned long rate = pos < this->switchat ? this->oldbaud : this->modembaud;
+        if(rate == this->hostbaud && (this->iprmode != SIM_IPR_BROKEN || rate == this->basebaud))
+            continue;
+        data[i] = (data[i] ^ 0x5a) | 0x80;
+        n++;
+    }
+    return n;
+}
+
+/* Release a delayed '>' prompt once its time has come */
+void SimModem::release(void){
+    if(this->promptpending && (long)(hostWallMillis() - this->promptat) >= 0){
+        this->promptpending = false;
+        this->respond(">");
+    }
+}
+
+/* Parse a complete command line from the host */
+void SimModem::command(const std::string &cmd){
+    std::string upper;
+    size_t eq = cmd.find('=');
+    for(size_t i = 0; i < cmd.size() && i < eq; i++)
+        upper.push_back((char)toupper((unsigned char)cmd[i]));
+    const char *args = eq == std::string::npos ? "" : cmd.c_str() + eq + 1;
+    char resp[48];
+
+    this->commands++;
+
+    if(upper == "AT+AWSSUBOPEN" || upper == "AT+AWSPUBOPEN"){
+        bool sub = upper[6] == 'S';
+        int idx = (int)strtol(args, NULL, 10);
+        const char *q = strchr(args, '"');
+        std::string topic = q ? std::string(q + 1, strcspn(q + 1, "\"")) : std::string();
+        int err = 0;
+        this->opens++;
+        if(idx < 0 || idx >= SIM_MAX_TOPICS || topic.empty() || this->openfail){
+            err = -1;
+        }else if(sub ? this->subopen[idx] : this->pubopen[idx]){
+            err = -2;
+        }else if(sub){
+            this->subopen[idx] = true;
+            this->subtopic[idx] = topic;
+        }else{
+            this->pubopen[idx] = true;
+            this->pubtopic[idx] = topic;
+        }
+        this->respond("OK\r\n");
+        snprintf(resp, sizeof(resp), "+AWS%sOPEN:%d,%d\r\n", sub ? "SUB" : "PUB", idx, err);
+        this->respond(resp);
+    }else if(upper == "AT+AWSSUBCLOSE" || upper == "AT+AWSPUBCLOSE"){
+        bool sub = upper[6] == 'S';
+        int idx = (int)strtol(args, NULL, 10);
+        int err = 0;
+        if(idx < 0 || idx >= SIM_MAX_TOPICS || !(sub ? this->subopen[idx] : this->pubopen[idx])){
+            err = -1;
+        }else if(sub){
+            this->subopen[idx] = false;
+        }else{
+            this->pubopen[idx] = false;
+        }
+        this->respond("OK\r\n");
+        snprintf(resp, sizeof(resp), "+AWS%sCLOSE:%d,%d\r\n", sub ? "SUB" : "PUB", idx, err);
+        this->respond(resp);
+    }else if(upper == "AT+AWSPUBLISH"){
+        char *lenptr;
+        this->pubidx = (int)strtol(args, &lenptr, 10);
+        this->pubremaining = *lenptr == ',' ? strtol(lenptr + 1, NULL, 10) : 0;
+        this->lastpayload.clear();
+        if(this->pubremaining <= 0){
+            this->respond("ERROR\r\n");
+            return;
+        }
+        this->promptat = hostWallMillis() + this->promptdelay;
+        this->promptpending = true;
+        this->release();
+    }else if(upper == "AT+AWSVER"){
+        this->respond("+AWSVER: 1.2.0\r\nOK\r\n");
+    }else if(upper == "AT+QCCID"){
+        this->respond("+QCCID: 89441000300000000001\r\nOK\r\n");
+    }else if(upper == "AT+IPR"){
+        unsigned long rate = strtoul(args, NULL, 10);
+        if(this->iprmode == SIM_IPR_REFUSE || rate == 0){
+            this->respond("ERROR\r\n");
+            return;
+        }
+        this->respond("OK\r\n");
+        if(this->modembaud != 0){
+            this->oldbaud = this->modembaud;
+            this->switchat = this->bytestohost;
+            this->modembaud = rate;
+        }
+    }else if(upper == "AT" || upper == "AT+AWSBUTTON"){
+        this->respond("OK\r\n");
+    }else{
+        this->respond("ERROR\r\n");
+    }
+}
+
+/* Rate-driven URC generation */
+
+void SimModem::setMessageRate(int idx, double msgsPerSec, uint16_t payloadlen){
+    if(idx < 0 || idx >= SIM_MAX_TOPICS)
+        return;
+    this->rate[idx] = msgsPerSec;
+    this->ratelen[idx] = payloadlen;
+    this->credit[idx] = 0;
+    this->lasttick = hostWallMillis();
+}
+
+void SimModem::tick(void){
+    unsigned long now = hostWallMillis();
+    unsigned long elapsed = now - this->lasttick;
+    if(elapsed == 0)
+        return;
+    this->lasttick = now;
+    this->writeroom = this->writerate;
+    for(int idx = 0; idx < SIM_MAX_TOPICS; idx++){
+        if(this->rate[idx] <= 0 || !this->subopen[idx])
+            continue;
+        this->credit[idx] += this->rate[idx] * elapsed / 1000.0;
+        while(this->credit[idx] >= 1.0){
+            std::vector<uint8_t> payload(this->ratelen[idx]);
+            for(size_t i = 0; i < payload.size(); i++)
+                payload[i] = '0' + (uint8_t)((i + this->seq) % 10);
+            this->seq++;
+            this->inject(idx, payload.data(), (uint16_t)payload.size());
+            this->credit[idx] -= 1.0;
+        }
+    }
+}
+
+void SimModem::setPublishFailEvery(unsigned long n){
+    this->failevery = n;
+}
+
+void SimModem::setOpenFail(bool fail){
+    this->openfail = fail;
+}
+
+void SimModem::restart(void){
+    for(int i = 0; i < SIM_MAX_TOPICS; i++)
+        this->subopen[i] = this->pubopen[i] = false;
+    this->pubidx = -1;
+    this->pubremaining = 0;
+    this->promptpending = false;
+    this->line.clear();
+    this->tohost.clear();
+    this->modembaud = this->basebaud;
+    this->switchat = this->bytestohost;
+    this->respond("\r\nRDY\r\n");
+}
+
+void SimModem::setBaud(unsigned long baud){
+    this->basebaud = this->modembaud = baud;
+    this->switchat = this->bytestohost;
+    if(this->hostbaud == 0)
+        this->hostbaud = baud;
+}
+
+void SimModem::setHostBaud(unsigned long baud){
+    this->hostbaud = baud;
+}
+
+void SimModem::setIprMode(int mode){
+    this->iprmode = mode;
+}
+
+void SimModem::setPromptDelay(unsigned long ms){
+    this->promptdelay = ms;
+}
@@ -0,0 +1,139 @@
+/***************************************************************************
+  Simulated anynet-secure modem for host builds of the eseyeaws library.
+
+  SimModem is a Stream: the library writes AT commands to it and reads the
+  scripted responses back. It understands AT+AWSSUBOPEN/SUBCLOSE,
+  PUBOPEN/PUBCLOSE and PUBLISH (including the '>' prompt and
+  SEND OK/SEND FAIL) plus a couple of informational commands, and can emit
+  +AWS:<idx>,<len> message URCs either on demand or at a configured rate
+  driven by the (simulated) wall clock, which keeps running while a
+  sleeping host's millis() is stopped. Once given a baud rate it also models
+  the link's rate, which AT+IPR changes, and the garbage a mismatch makes.
+
+ ***************************************************************************/
+
+#ifndef ESEYEAWS_SIMMODEM_H__
+#define ESEYEAWS_SIMMODEM_H__
+
+#include <Arduino.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#define SIM_MAX_TOPICS 16
+
+/* How AT+IPR is answered - switch, refuse with ERROR (staying put), or
+ * switch to a rate at which nothing the modem sends reaches the host intact */
+#define SIM_IPR_OK     0
+#define SIM_IPR_REFUSE 1
+#define SIM_IPR_BROKEN 2
+
+class SimModem : public Stream
+{
+public:
+    SimModem();
+
+    /* Stream interface (host -> modem on write, modem -> host on read) */
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    virtual int available(void);
+    virtual int read(void);
+    virtual int peek(void);
+    /* Bulk copy for callers holding a SimModem (Stream::readBytes() isn't
+     * virtual, so the library doesn't get this) */
+    size_t readBytes(char *buffer, size_t length);
+    using Stream::readBytes;
+    virtual int availableForWrite(void);
+
+    /* Queue a subscribed message URC for subscription index idx */
+    void inject(int idx, const uint8_t *data, uint16_t len);
+    /* Queue raw bytes as if the modem had sent them */
+    void injectRaw(const char *text);
+
+    /* Emit msgsPerSec messages of payloadlen bytes on idx (0 disables) */
+    void setMessageRate(int idx, double msgsPerSec, uint16_t payloadlen);
+    /* Generate any rate-driven URCs that are due at millis() */
+    void tick(void);
+
+    /* Fail publishes: every nth publish fails (0 = never) */
+    void setPublishFailEvery(unsigned long n);
+    /* Network lost: SUBOPEN/PUBOPEN are answered with error -1 */
+    void setOpenFail(bool fail);
+    /* Reboot - every topic and anything in progress is forgotten and RDY is
+     * sent once it is back */
+    void restart(void);
+    /* Delay (ms) before the '>' prompt is released (0 = immediately) */
+    void setPromptDelay(unsigned long ms);
+    /* Model a uart TX FIFO: availableForWrite() reports room for bytesPerMs
+     * which tick() replenishes every millisecond (0 = report 0 like
+     * SoftwareSerial, which doesn't implement it) */
+    void setWriteRoom(int bytesPerMs);
+    /* Baud rates (not modelled until setBaud() is called) - bytes only get
+     * through while the host uart's rate matches the modem's. Others are
+     * lost on the way to the modem and reach the host as noise. AT+IPR moves
+     * the modem once its OK has gone, and restart() brings back baud */
+    void setBaud(unsigned long baud);
+    void setHostBaud(unsigned long baud);
+    unsigned long baud(void) { return this->modembaud; }
+    void setIprMode(int mode);
+
+    /* Statistics */
+    unsigned long commands;
+    unsigned long opens;
+    unsigned long publishes;
+    unsigned long publishfails;
+    unsigned long publishbytes;
+    unsigned long urcs;
+    unsigned long bytestohost;
+    unsigned long bytesfromhost;
+    /* Bytes lost to a baud rate mismatch each way */
+    unsigned long garbledtohost;
+    unsigned long garbledfromhost;
+
+    bool subopen[SIM_MAX_TOPICS];
+    bool pubopen[SIM_MAX_TOPICS];
+    std::string subtopic[SIM_MAX_TOPICS];
+    std::string pubtopic[SIM_MAX_TOPICS];
+    std::vector<uint8_t> lastpayload;
+
+private:
+    void command(const std::string &cmd);
+    void respond(const std::string &text);
+    void queue(const uint8_t *data, size_t len);
+    void release(void);
+    size_t garble(uint8_t *data, size_t len);
+
+    std::deque<uint8_t> tohost;
+    std::string line;
+    bool skiplf;
+
+    /* Publish in progress */
+    int pubidx;
+    long pubremaining;
+    unsigned long failevery;
+    bool openfail;
+    unsigned long promptdelay;
+    unsigned long promptat;
+    bool promptpending;
+
+    /* Rate-driven message generation */
+    double rate[SIM_MAX_TOPICS];
+    uint16_t ratelen[SIM_MAX_TOPICS];
+    double credit[SIM_MAX_TOPICS];
+    int writerate;
+    long writeroom;
+    unsigned long lasttick;
+    uint8_t seq;
+
+    /* Baud rates - bytes queued before switchat went at oldbaud */
+    unsigned long basebaud;
+    unsigned long modembaud;
+    unsigned long oldbaud;
+    unsigned long hostbaud;
+    unsigned long switchat;
+    int iprmode;
+};
+
+#endif // ESEYEAWS_SIMMODEM_H__
@@ -0,0 +1,87 @@
+/***************************************************************************
+  Simulated sleep hardware for host builds - implementation.
+ ***************************************************************************/
+
+#include "simsleep.h"
+
+SimSleepHal::SimSleepHal(){
+    sleeps = asleepms = interrupts = correctedms = 0;
+    for(int i = 0; i < SIM_PINS; i++)
+        level[i] = LOW;
+    for(int i = 0; i < ESEYE_WAKE_INTS; i++)
+        isr[i] = NULL;
+    source = NULL;
+    sourcectx = NULL;
+    pendingpin = -1;
+    pendingat = 0;
+}
+
+void SimSleepHal::setWakeSource(int (*source)(void *ctx), void *ctx){
+    this->source = source;
+    this->sourcectx = ctx;
+}
+
+void SimSleepHal::interruptAt(uint8_t pin, unsigned long wallms){
+    this->pendingpin = pin;
+    this->pendingat = wallms;
+}
+
+void SimSleepHal::pinwrite(uint8_t pin, uint8_t level){
+    if(pin < SIM_PINS)
+        this->level[pin] = level;
+}
+
+/* Pins 0..ESEYE_WAKE_INTS-1 are their own interrupt numbers */
+uint8_t SimSleepHal::pinint(uint8_t pin){
+    return pin < ESEYE_WAKE_INTS ? pin : INVALID_INT;
+}
+
+void SimSleepHal::intattach(uint8_t intnum, void (*isr)(void), int mode){
+    (void)mode;
+    if(intnum < ESEYE_WAKE_INTS)
+        this->isr[intnum] = isr;
+}
+
+void SimSleepHal::intdetach(uint8_t intnum){
+    if(intnum < ESEYE_WAKE_INTS)
+        this->isr[intnum] = NULL;
+}
+
+void SimSleepHal::raise(uint8_t pin){
+    uint8_t intnum = this->pinint(pin);
+    if(intnum == INVALID_INT || this->isr[intnum] == NULL)
+        return;
+    this->interrupts++;
+    this->isr[intnum]();
+}
+
+/* The wall clock runs a millisecond at a time with millis() stopped until
+ * the time is up or an attached interrupt fires */
+unsigned long SimSleepHal::powerdown(unsigned long ms, volatile uint8_t *woken){
+    unsigned long slept = 0;
+    int pin;
+    this->sleeps++;
+    hostFreezeMillis(true);
+    while(*woken == NO_INT_OCCURRED && (ms == 0 || slept < ms)){
+        hostAdvanceMillis(1);
+        slept++;
+        if(this->pendingpin >= 0 && (long)(hostWallMillis() - this->pendingat) >= 0){
+            pin = this->pendingpin;
+            this->pendingpin = -1;
+            this->raise(pin);
+        }
+        if(this->source != NULL && (pin = this->source(this->sourcectx)) >= 0)
+            this->raise(pin);
+        /* Nothing can ever wake an untimed sleep */
+        if(ms == 0 && this->pendingpin < 0 && this->source == NULL)
+            break;
+    }
+    hostFreezeMillis(false);
+    this->asleepms += slept;
+    return slept;
+}
+
+void SimSleepHal::clockadvance(unsigned long ms){
+    this->correctedms += ms;
+    hostAdjustMillis(ms);
+}
@@ -0,0 +1,57 @@
+/***************************************************************************
+  Simulated sleep hardware for host builds of the eseyeaws library.
+
+  SimSleepHal is an eseyeSleepHal on the simulated clock which behaves like
+  an AVR in power-down: millis() stops while it sleeps (the simulated wall
+  clock carries on) so the library has to correct it, pins written by the
+  library are recorded, and the interrupts it attaches can be raised at a
+  given wall time or by a wake source called every simulated millisecond -
+  a SimModem with something to send, say. It counts the time spent asleep
+  so schedules and duty cycles can be checked without a board.
+
+ ***************************************************************************/
+
+#ifndef ESEYEAWS_SIMSLEEP_H__
+#define ESEYEAWS_SIMSLEEP_H__
+
+#include "eseyeaws.h"
+
+#define SIM_PINS 32
+
+class SimSleepHal : public eseyeSleepHal
+{
+public:
+    SimSleepHal();
+
+    /* Called every simulated ms while asleep - returns a pin to raise or -1 */
+    void setWakeSource(int (*source)(void *ctx), void *ctx);
+    /* Raise pin once the wall clock reaches wallms */
+    void interruptAt(uint8_t pin, unsigned long wallms);
+    uint8_t pinlevel(uint8_t pin) { return pin < SIM_PINS ? this->level[pin] : LOW; }
+
+    /* eseyeSleepHal */
+    virtual void pinwrite(uint8_t pin, uint8_t level);
+    virtual uint8_t pinint(uint8_t pin);
+    virtual void intattach(uint8_t intnum, void (*isr)(void), int mode);
+    virtual void intdetach(uint8_t intnum);
+    virtual unsigned long powerdown(unsigned long ms, volatile uint8_t *woken);
+    virtual void clockadvance(unsigned long ms);
+
+    /* Statistics */
+    unsigned long sleeps;
+    unsigned long asleepms;
+    unsigned long interrupts;
+    unsigned long correctedms;
+
+private:
+    void raise(uint8_t pin);
+
+    uint8_t level[SIM_PINS];
+    void (*isr[ESEYE_WAKE_INTS])(void);
+    int (*source)(void *ctx);
+    void *sourcectx;
+    int pendingpin;
+    unsigned long pendingat;
+};
+
+#endif // ESEYEAWS_SIMSLEEP_H__
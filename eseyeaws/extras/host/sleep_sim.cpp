@@ -0,0 +1,143 @@
+/***************************************************************************
+  Tickless sleep schedule check for host builds of the eseyeaws library.
+
+  A battery node which publishes a reading every period and is subscribed
+  to a topic the simulated modem sends messages on, run on the simulated
+  clock with SimSleepHal standing in for AVR power-down. Each turn of the
+  loop costs a millisecond awake; the rest of the time is spent in sleep().
+  For each scenario it reports the duty cycle, why each sleep ended, how
+  late the application's readings were, the worst millis() error after a
+  sleep and whether the click was held asleep while the host slept. One
+  scenario batches its readings with pubbatch() to show the publishes saved.
+  The exit status is 1 if a schedule went wrong.
+
+  usage: sleep_sim [seconds]
+
+ ***************************************************************************/
+
+#include <stdio.h>
+
+#include "eseyeaws.h"
+#include "simmodem.h"
+#include "simsleep.h"
+
+/* Click wake pin (an interrupt on SimSleepHal) and click sleep pin */
+#define CLICK_WAKE_PIN  0
+#define CLICK_SLEEP_PIN 10
+
+/* One publish index can batch its readings */
+struct eseyeNodeConfig : eseyeAWSConfig<2, 2, 128, 64, eseyeFilterOK, eseyeTimeouts<> >
+{
+    static const uint8_t pubBatches = 1;
+};
+typedef eseyeAWSBasic<eseyeNodeConfig> eseyeAWSNode;
+
+struct wakectx{
+    SimModem *modem;
+    SimSleepHal *hal;
+    unsigned long clickawake;
+};
+
+static unsigned long rxmsgs;
+
+static void countcb(uint8_t *data, uint8_t length){
+    (void)data;
+    (void)length;
+    rxmsgs++;
+}
+
+/* The click raises its wake pin when it has something for the host */
+static int clickwake(void *ctx){
+    struct wakectx *w = (struct wakectx *)ctx;
+    if(w->hal->pinlevel(CLICK_SLEEP_PIN) != HIGH)
+        w->clickawake++;
+    w->modem->tick();
+    return w->modem->available() > 0 ? CLICK_WAKE_PIN : -1;
+}
+
+static bool run(const char *name, double msgrate, unsigned long period, unsigned long promptdelay, unsigned long batchdelay, unsigned long seconds){
+    static const char *reasons[] = {"again", "timer", "click", "int", "deadline"};
+    unsigned long wakes[5] = {0, 0, 0, 0, 0};
+    bool ok;
+    hostUseSimClock(true);
+    hostSetMillis(0);
+    {
+        SimModem modem;
+        SimSleepHal hal;
+        eseyeAWSNode aws(&modem);
+        struct wakectx w = {&modem, &hal, 0};
+        aws.init();
+        aws.sleephal(&hal);
+        aws.sleepctrl(CLICK_SLEEP_PIN, HIGH, CLICK_WAKE_PIN, LOW);
+        hal.setWakeSource(clickwake, &w);
+
+        int subidx = aws.subscribe((char *)"node/cmd", countcb);
+        int pubidx = aws.pubreg((char *)"node/data");
+        while(modem.available() > 0)
+            aws.poll();
+        if(aws.substate(subidx) != SUB_TOPIC_SUBSCRIBED || aws.pubstate(pubidx) != PUB_TOPIC_REGISTERED){
+            printf("%s: setup failed\n", name);
+            hostUseSimClock(false);
+            return false;
+        }
+        if(batchdelay > 0 && aws.pubbatch(pubidx, batchdelay) < 0){
+            printf("%s: no batches in this build\n", name);
+            hostUseSimClock(false);
+            return true;
+        }
+        modem.setMessageRate(0, msgrate, 32);
+        modem.setPromptDelay(promptdelay);
+
+        uint8_t reading[] = "{\"Humidity\":45.0,\"Temp\":21.5}";
+        unsigned long next = period, late = 0, clockerr = 0, readings = 0;
+        unsigned long start = hostWallMillis();
+        rxmsgs = 0;
+        while(hostWallMillis() - start < seconds * 1000){
+            hostAdvanceMillis(1);
+            modem.tick();
+            aws.poll();
+            if((long)(millis() - next) >= 0){
+                if(millis() - next > late)
+                    late = millis() - next;
+                if(batchdelay > 0)
+                    aws.pubappend(pubidx, reading, sizeof(reading) - 1);
+                else if(aws.pubstate(pubidx) == PUB_TOPIC_REGISTERED)
+                    aws.publish(pubidx, reading, sizeof(reading) - 1);
+                readings++;
+                next += period;
+            }
+            twakeReason r = aws.sleep(next - millis());
+            wakes[r]++;
+            if(hostWallMillis() - millis() > clockerr)
+                clockerr = hostWallMillis() - millis();
+        }
+        unsigned long elapsed = hostWallMillis() - start;
+        printf("%-8s duty %6.3f%% sleeps %5lu wakes", name, 100.0 * (elapsed - hal.asleepms) / elapsed, hal.sleeps);
+        for(int i = 0; i < 5; i++)
+            printf(" %s %lu", reasons[i], wakes[i]);
+        ok = clockerr == 0 && w.clickawake == 0 && late <= 1;
+        printf(", readings %lu in %lu publishes late <= %lu ms, rx %lu msgs, clock error %lu ms%s\n",
+               readings, modem.publishes, late, rxmsgs, clockerr, ok ? "" : "  (SCHEDULE FAILED)");
+    }
+    hostUseSimClock(false);
+    return ok;
+}
+
+int main(int argc, char **argv){
+    unsigned long seconds = 3600;
+    bool ok = true;
+    if(argc > 1)
+        seconds = strtoul(argv[1], NULL, 10);
+
+    /* Nothing but the reading every minute */
+    ok = run("idle", 0, 60000, 0, 0, seconds) && ok;
+    /* A message every 10s wakes it through the click */
+    ok = run("rx 0.1/s", 0.1, 60000, 0, 0, seconds) && ok;
+    ok = run("rx 1/s", 1, 10000, 0, 0, seconds) && ok;
+    /* Readings every 10s batched for up to a minute */
+    ok = run("10s", 0, 10000, 0, 0, seconds) && ok;
+    ok = run("batched", 0, 10000, 0, 60000, seconds) && ok;
+    /* The modem never prompts in time, so sleeps end at the publish timeout */
+    ok = run("slow", 0, 60000, 5000, 0, seconds) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+/***************************************************************************
+  UART capture and replay tool for host builds of the eseyeaws library.
+
+  record runs a node against the simulated modem on the simulated clock -
+  two subscriptions with messages arriving, a publish every half second
+  (some answered with SEND FAIL), an AT command of its own, a modem restart
+  the library recovers from and an unsubscribe - and captures its uart to
+  a file, or with --ring only the last bytes of it held in RAM.
+
+  replay feeds a capture back through poll() (see tracereplay.h), reports
+  what the instance made of it, whether it sent what was captured, and the
+  throughput of the fastest of --loops replays. --realtime sleeps out the
+  recorded gaps instead. With no arguments a session is recorded to a
+  temporary file and replayed.
+
+  usage: trace_replay record <file> [--ring bytes]
+         trace_replay replay <file> [--realtime] [--loops n]
+
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hostconfig.h"
+#include "simmodem.h"
+#include "tracereplay.h"
+
+static unsigned long rxmsgs;
+static unsigned long urclines;
+/* The capture was empty - this build has no uart capture (ESEYEAWS_LOWRAM) */
+static bool nocapture;
+
+static void countcb(uint8_t *data, uint8_t length){
+    (void)data;
+    (void)length;
+    rxmsgs++;
+}
+
+static void urccb(char *line){
+    (void)line;
+    urclines++;
+}
+
+static bool record(const char *path, uint16_t ringsize){
+    static const uint8_t report[] = "{\"Temp\":21.5,\"Humidity\":40}";
+    CaptureFile file;
+    std::vector<uint8_t> ringbuf(ringsize);
+    eseyeCaptureRing ring(ringbuf.data(), ringsize);
+    eseyeCapturePrint print(&file);
+    if(!file.open(path)){
+        perror(path);
+        return false;
+    }
+    hostUseSimClock(true);
+    hostSetMillis(0);
+    randomSeed(1);
+    {
+        SimModem modem;
+        eseyeAWSHost aws(&modem);
+        aws.init(urccb);
+        if(ringsize > 0)
+            aws.capture(&ring);
+        else
+            aws.capture(&print);
+        int sub1 = aws.subscribe((char *)"node/cmd", countcb);
+        int sub2 = aws.subscribe((char *)"node/config", countcb);
+        int pub = aws.pubreg((char *)"node/report");
+        modem.setMessageRate(sub1, 4, 24);
+        modem.setMessageRate(sub2, 0.5, 120);
+        modem.setPublishFailEvery(7);
+        for(unsigned long t = 0; t < 20000; t++){
+            if(t % 500 == 250)
+                aws.publishref(pub, report, sizeof(report) - 1);
+            if(t == 3000)
+                aws.sendAT((char *)"AT+AWSVER\r\n");
+            if(t == 8000)
+                modem.restart();
+            if(t == 15000)
+                aws.unsubscribe(sub2);
+            modem.tick();
+            aws.poll();
+            hostAdvanceMillis(1);
+        }
+        aws.capture(NULL);
+        if(ringsize > 0){
+            ring.dump(&file);
+            printf("record   ring of %u bytes holds the last %u records, %lu dropped\n",
+                   ringsize, ring.records(), ring.dropped());
+        }
+        printf("record   20000 ms: %lu messages, %lu publishes (%lu failed), %lu bytes to the modem, %lu from it\n",
+               rxmsgs, modem.publishes, modem.publishfails, modem.bytesfromhost, modem.bytestohost);
+    }
+    hostUseSimClock(false);
+    file.close();
+    return true;
+}
+
+static bool replay(const char *path, bool realtime, unsigned loops){
+    std::vector<TraceRecord> trace;
+    struct TraceReplayStats stats;
+    double best = 0;
+    if(!loadTrace(path, trace)){
+        nocapture = errno == ENODATA;
+        if(nocapture)
+            printf("replay   no uart capture in this build\n");
+        else if(errno == EINVAL)
+            printf("replay   %s is not a capture\n", path);
+        else
+            perror(path);
+        return false;
+    }
+    if(trace.empty()){
+        printf("replay   %s holds no records\n", path);
+        return false;
+    }
+    TraceReplay<eseyeAWSHost> driver(trace, realtime);
+    for(unsigned i = 0; i < loops; i++){
+        ReplayStream uart;
+        eseyeAWSHost aws(&uart);
+        urclines = 0;
+        randomSeed(1);
+        aws.init(urccb);
+        driver.run(aws, uart, &stats);
+        if(i == 0 || stats.seconds < best)
+            best = stats.seconds;
+    }
+    printf("replay   %zu records over %lu ms: %lu bytes in, %lu out\n",
+           trace.size(), trace.back().ms - trace.front().ms, stats.rxbytes, stats.txbytes);
+    printf("replay   %lu messages (%lu bytes), %lu lines to the application, publishes %lu ok %lu failed, %lu actions (%lu refused)\n",
+           stats.messages, stats.msgbytes, urclines, stats.pubok, stats.pubfail, stats.actions, stats.refused);
+    if(stats.txdiverge < 0)
+        printf("replay   sent bytes match the capture\n");
+    else
+        printf("replay   sent bytes DIVERGE from the capture at byte %ld\n", stats.txdiverge);
+    if(!realtime)
+        printf("replay   %.1f MB/s in, %.1f ns per byte (best of %u)\n",
+               stats.rxbytes / best / 1e6, best * 1e9 / stats.rxbytes, loops);
+    return stats.txdiverge < 0;
+}
+
+int main(int argc, char **argv){
+    bool realtime = false;
+    unsigned loops = 20;
+    uint16_t ringsize = 0;
+    int i;
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if(argc < 2){
+        char path[] = "/tmp/trace_replayXXXXXX";
+        int fd = mkstemp(path);
+        bool ok;
+        if(fd < 0){
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+        ok = record(path, 0) && replay(path, false, loops);
+        unlink(path);
+        return ok || nocapture ? 0 : 1;
+    }
+    if(argc < 3){
+        fprintf(stderr, "usage: %s record <file> [--ring bytes]\n"
+                        "       %s replay <file> [--realtime] [--loops n]\n", argv[0], argv[0]);
+        return 2;
+    }
+    for(i = 3; i < argc; i++){
+        if(strcmp(argv[i], "--realtime") == 0)
+            realtime = true;
+        else if(strcmp(argv[i], "--loops") == 0 && i + 1 < argc)
+            loops = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--ring") == 0 && i + 1 < argc)
+            ringsize = atoi(argv[++i]);
+    }
+    if(loops == 0 || realtime)
+        loops = 1;
+    if(strcmp(argv[1], "record") == 0)
+        return record(argv[2], ringsize) ? 0 : 1;
+    if(strcmp(argv[1], "replay") == 0)
+        return replay(argv[2], realtime, loops) ? 0 : 1;
+    fprintf(stderr, "%s: unknown command %s\n", argv[0], argv[1]);
+    return 2;
+}
@@ -0,0 +1,150 @@
+/***************************************************************************
+  UART capture files and deterministic replay for host builds of the
+  eseyeaws library.
+
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "tracereplay.h"
+
+bool CaptureFile::open(const char *path){
+    this->close();
+    this->fp = fopen(path, "wb");
+    return this->fp != NULL;
+}
+
+void CaptureFile::close(void){
+    if(this->fp != NULL)
+        fclose(this->fp);
+    this->fp = NULL;
+}
+
+size_t CaptureFile::write(const uint8_t *buffer, size_t size){
+    if(this->fp == NULL)
+        return 0;
+    return fwrite(buffer, 1, size, this->fp);
+}
+
+static bool getvarint(const std::vector<uint8_t> &buf, size_t *off, unsigned long *n){
+    unsigned shift = 0;
+    uint8_t b;
+    *n = 0;
+    do{
+        if(*off >= buf.size() || shift > 28)
+            return false;
+        b = buf[(*off)++];
+        *n |= (unsigned long)(b & 0x7f) << shift;
+        shift += 7;
+    }while(b & 0x80);
+    return true;
+}
+
+bool loadTrace(const char *path, std::vector<TraceRecord> &records){
+    std::vector<uint8_t> buf;
+    uint8_t block[4096];
+    unsigned long delta, lendir, ms = 0;
+    size_t off = 3, n;
+    FILE *fp = fopen(path, "rb");
+    records.clear();
+    if(fp == NULL)
+        return false;
+    while((n = fread(block, 1, sizeof(block), fp)) > 0)
+        buf.insert(buf.end(), block, block + n);
+    fclose(fp);
+    if(buf.empty()){
+        errno = ENODATA;
+        return false;
+    }
+    if(buf.size() < 3 || buf[0] != 'E' || buf[1] != 'C' || buf[2] != ESEYE_CAPTURE_VERSION){
+        errno = EINVAL;
+        return false;
+    }
+    while(getvarint(buf, &off, &delta) && getvarint(buf, &off, &lendir)){
+        TraceRecord r;
+        if(buf.size() - off < (lendir >> 1))
+            break;
+        ms += delta;
+        r.dir = lendir & 1;
+        r.ms = ms;
+        r.data.assign(buf.begin() + off, buf.begin() + off + (lendir >> 1));
+        off += lendir >> 1;
+        records.push_back(r);
+    }
+    return true;
+}
+
+int ReplayStream::read(void){
+    int c;
+    if(this->rx.empty())
+        return -1;
+    c = this->rx.front();
+    this->rx.pop_front();
+    return c;
+}
+
+/* AT+AWS<verb><idx>[,"topic"|,<len>] - returns the index, or -1 if the line
+ * isn't that command */
+static int awsverb(const std::string &line, const char *verb, std::string *arg){
+    std::string start = std::string("AT+AWS") + verb;
+    size_t comma;
+    if(line.compare(0, start.size(), start) != 0)
+        return -1;
+    comma = line.find(',', start.size());
+    if(arg != NULL){
+        if(comma == std::string::npos)
+            return -1;
+        *arg = line.substr(comma + 1);
+        if(arg->size() >= 2 && (*arg)[0] == '"' && (*arg)[arg->size() - 1] == '"')
+            *arg = arg->substr(1, arg->size() - 2);
+    }
+    return atoi(line.c_str() + start.size());
+}
+
+void traceActions(const std::vector<TraceRecord> &records, std::vector<TraceAction> &actions){
+    std::string line, body, arg;
+    size_t payload = 0;
+    size_t publish = 0;
+    TraceAction a;
+    actions.clear();
+    for(size_t i = 0; i < records.size(); i++){
+        if(records[i].dir != ESEYE_CAPTURE_TX)
+            continue;
+        for(uint8_t c : records[i].data){
+            if(payload > 0){
+                /* Payloads follow their command at the prompt */
+                actions[publish].text += (char)c;
+                payload--;
+                continue;
+            }
+            line += (char)c;
+            if(c != '\n')
+                continue;
+            body = line.substr(0, line.find_last_not_of("\r\n") + 1);
+            a.record = i;
+            a.text.clear();
+            if((a.idx = awsverb(body, "SUBOPEN=", &a.text)) >= 0)
+                a.kind = TraceAction::SUBOPEN;
+            else if((a.idx = awsverb(body, "SUBCLOSE=", NULL)) >= 0)
+                a.kind = TraceAction::SUBCLOSE;
+            else if((a.idx = awsverb(body, "PUBOPEN=", &a.text)) >= 0)
+                a.kind = TraceAction::PUBOPEN;
+            else if((a.idx = awsverb(body, "PUBCLOSE=", NULL)) >= 0)
+                a.kind = TraceAction::PUBCLOSE;
+            else if((a.idx = awsverb(body, "PUBLISH=", &arg)) >= 0){
+                a.kind = TraceAction::PUBLISH;
+                payload = atoi(arg.c_str());
+                publish = actions.size();
+            }else{
+                a.kind = TraceAction::ATCMD;
+                a.idx = -1;
+                a.text = line;
+            }
+            actions.push_back(a);
+            line.clear();
+        }
+    }
+}
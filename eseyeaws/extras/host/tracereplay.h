@@ -0,0 +1,236 @@
+/***************************************************************************
+  UART capture files and deterministic replay for host builds of the
+  eseyeaws library.
+
+  CaptureFile is a Print onto a file for eseyeCapturePrint (or for dumping
+  an eseyeCaptureRing), and loadTrace() reads a capture back as records.
+
+  TraceReplay drives an instance with a capture. Received runs are fed
+  through a ReplayStream into poll() at their recorded times on the
+  simulated clock. The commands the application caused (topic opens and
+  closes, publishes with their payloads, its own AT commands) are made
+  through the API when the capture shows them being sent. So the instance
+  sees what it saw in the field, and what it sends can be compared byte for
+  byte with what was captured. Replays run as fast as they can unless
+  realtime is set, which sleeps out the gaps between records.
+
+      std::vector<TraceRecord> trace;
+      loadTrace("field.cap", trace);
+      ReplayStream uart;
+      eseyeAWS aws(&uart);
+      aws.init(urccb);
+      TraceReplay<eseyeAWS> replay(trace);
+      struct TraceReplayStats stats;
+      replay.run(aws, uart, &stats);
+
+ ***************************************************************************/
+
+#ifndef ESEYEAWS_TRACEREPLAY_H__
+#define ESEYEAWS_TRACEREPLAY_H__
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "eseyeaws.h"
+
+class CaptureFile : public Print
+{
+public:
+    CaptureFile() : fp(NULL) {}
+    virtual ~CaptureFile() { this->close(); }
+    /* Returns false (with errno set) if path can't be created */
+    bool open(const char *path);
+    void close(void);
+    virtual size_t write(uint8_t c) { return this->write(&c, 1); }
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+private:
+    FILE *fp;
+};
+
+struct TraceRecord
+{
+    uint8_t dir;
+    unsigned long ms;
+    std::vector<uint8_t> data;
+};
+
+/* Read a capture - false if it can't be read, is empty (ENODATA) or isn't
+ * one (EINVAL). A capture cut off part way through a record keeps the
+ * records before it */
+bool loadTrace(const char *path, std::vector<TraceRecord> &records);
+
+/* The modem end of a replay - received runs are queued by feed() and what the
+ * library writes is kept */
+class ReplayStream : public Stream
+{
+public:
+    virtual size_t write(uint8_t c) { return this->write(&c, 1); }
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        this->sent.insert(this->sent.end(), buffer, buffer + size);
+        return size;
+    }
+    using Print::write;
+    virtual int available(void) { return this->rx.size(); }
+    virtual int read(void);
+    virtual int peek(void) { return this->rx.empty() ? -1 : this->rx.front(); }
+    virtual int availableForWrite(void) { return 4096; }
+
+    void feed(const std::vector<uint8_t> &data) { this->rx.insert(this->rx.end(), data.begin(), data.end()); }
+    std::vector<uint8_t> sent;
+private:
+    std::deque<uint8_t> rx;
+};
+
+/* Something the application did, found in the sent bytes of a capture */
+struct TraceAction
+{
+    enum { SUBOPEN, SUBCLOSE, PUBOPEN, PUBCLOSE, PUBLISH, ATCMD } kind;
+    /* Record which finished the command */
+    size_t record;
+    int idx;
+    /* Topic, publish payload or AT command */
+    std::string text;
+};
+
+/* Split the sent side of a capture into the application's actions */
+void traceActions(const std::vector<TraceRecord> &records, std::vector<TraceAction> &actions);
+
+struct TraceReplayStats
+{
+    unsigned long rxbytes;
+    unsigned long txbytes;
+    unsigned long messages;
+    unsigned long msgbytes;
+    unsigned long pubok;
+    unsigned long pubfail;
+    unsigned long actions;
+    /* Actions which couldn't be made (e.g. no free index) */
+    unsigned long refused;
+    /* Offset of the first sent byte which differs from the capture (-1 if none) */
+    long txdiverge;
+    double seconds;
+};
+
+template<class AWS>
+class TraceReplay
+{
+public:
+    TraceReplay(const std::vector<TraceRecord> &records, bool realtime = false) : records(records), realtime(realtime) {
+        traceActions(records, this->actions);
+    }
+
+    void run(AWS &aws, ReplayStream &uart, struct TraceReplayStats *stats);
+
+private:
+    const std::vector<TraceRecord> &records;
+    std::vector<TraceAction> actions;
+    bool realtime;
+
+    static struct TraceReplayStats *current;
+    static void msgcb(uint8_t *data, uint8_t length) {
+        (void)data;
+        current->messages++;
+        current->msgbytes += length;
+    }
+    static void pubcb(uint8_t id, boolean success) {
+        (void)id;
+        if(success)
+            current->pubok++;
+        else
+            current->pubfail++;
+    }
+    bool act(AWS &aws, const TraceAction &a);
+};
+
+template<class AWS> struct TraceReplayStats *TraceReplay<AWS>::current;
+
+/* Make an action through the API - opens of an index the library already
+ * holds were its own retries so are left to it */
+template<class AWS>
+bool TraceReplay<AWS>::act(AWS &aws, const TraceAction &a){
+    switch(a.kind){
+        case TraceAction::SUBOPEN:
+            if(aws.substate(a.idx) != SUB_TOPIC_NOT_IN_USE)
+                return true;
+            return aws.subscribe((char *)a.text.c_str(), msgcb) >= 0;
+        case TraceAction::SUBCLOSE:
+            return aws.unsubscribe(a.idx) >= 0;
+        case TraceAction::PUBOPEN:
+            if(aws.pubstate(a.idx) != PUB_TOPIC_NOT_IN_USE)
+                return true;
+            return aws.pubreg((char *)a.text.c_str()) >= 0;
+        case TraceAction::PUBCLOSE:
+            return aws.pubunreg(a.idx) >= 0;
+        case TraceAction::PUBLISH:
+            return aws.publishref(a.idx, (const uint8_t *)a.text.data(), a.text.size()) >= 0;
+        case TraceAction::ATCMD:
+            aws.sendAT((char *)a.text.c_str());
+            return true;
+    }
+    return false;
+}
+
+template<class AWS>
+void TraceReplay<AWS>::run(AWS &aws, ReplayStream &uart, struct TraceReplayStats *stats){
+    struct timespec ts;
+    size_t next = 0;
+    size_t i, n;
+    double start;
+    memset(stats, 0, sizeof(*stats));
+    current = stats;
+    aws.pubcallback(pubcb);
+    uart.sent.clear();
+    hostUseSimClock(true);
+    if(!this->records.empty())
+        hostSetMillis(this->records[0].ms);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start = ts.tv_sec + ts.tv_nsec / 1e9;
+    for(i = 0; i < this->records.size(); i++){
+        const TraceRecord &r = this->records[i];
+        if((long)(r.ms - millis()) > 0){
+            if(this->realtime)
+                usleep((r.ms - millis()) * 1000);
+            hostSetMillis(r.ms);
+        }
+        if(r.dir == ESEYE_CAPTURE_RX){
+            stats->rxbytes += r.data.size();
+            uart.feed(r.data);
+            while(uart.available() > 0)
+                aws.poll();
+        }else{
+            aws.poll();
+        }
+        for(; next < this->actions.size() && this->actions[next].record == i; next++){
+            stats->actions++;
+            if(!this->act(aws, this->actions[next]))
+                stats->refused++;
+        }
+    }
+    aws.poll();
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    stats->seconds = ts.tv_sec + ts.tv_nsec / 1e9 - start;
+    stats->txbytes = uart.sent.size();
+    stats->txdiverge = -1;
+    n = 0;
+    for(i = 0; i < this->records.size() && stats->txdiverge < 0; i++){
+        const TraceRecord &r = this->records[i];
+        for(size_t j = 0; r.dir == ESEYE_CAPTURE_TX && j < r.data.size(); j++, n++){
+            if(n >= uart.sent.size() || uart.sent[n] != r.data[j]){
+                stats->txdiverge = n;
+                break;
+            }
+        }
+    }
+    if(stats->txdiverge < 0 && n != uart.sent.size())
+        stats->txdiverge = n;
+    hostUseSimClock(false);
+}
+
+#endif // ESEYEAWS_TRACEREPLAY_H__
@@ -0,0 +1,258 @@
+/***************************************************************************
+  Receive ring and baud rate upgrade check for host builds of the eseyeaws
+  library.
+
+  WireRing stands in for a uart receive interrupt: the bytes the simulated
+  modem sends reach an eseyeRxRing at the wire's rate (a tenth of the baud
+  rate a second) on the simulated clock, whether or not loop() is busy. A
+  node subscribed to a stream of messages stalls its loop() every period.
+  Read through 64 bytes of buffer as a plain Stream (as the core's serial
+  buffers are) bytes are lost unseen and messages come out corrupted; given
+  the ring the library counts the losses and drops what they damaged, and a
+  big enough ring loses nothing. Then baudup() is run against modems which
+  accept AT+IPR, refuse it, can't be heard at the new rate, are already
+  there or at neither rate, and the message rate the link carries at the
+  old and the new rate is compared.
+
+  usage: uart_sim [seconds]
+
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "eseyeaws.h"
+#include "simmodem.h"
+
+#define BASE_BAUD 9600UL
+#define FAST_BAUD 115200UL
+#define PAYLOAD 64
+
+/* Link metrics count the losses the ring reports */
+struct eseyeNodeConfig : eseyeAWSConfig<2, 2, 128, 100, eseyeFilterOK, eseyeTimeouts<> >
+{
+    typedef eseyeMetrics metricsPolicy;
+};
+typedef eseyeAWSBasic<eseyeNodeConfig> eseyeAWSNode;
+
+/* The modem uart's receive interrupt - run in arrears whenever the library
+ * looks at the ring, for everything the wire carried since */
+class WireRing : public eseyeRxRing
+{
+public:
+    WireRing(SimModem *modem, uint8_t *buf, uint16_t size, bool silent)
+        : eseyeRxRing(buf, size, modem), modem(modem), baud(0), last(hostWallMillis()), credit(0), silent(silent) {}
+    void setbaud(unsigned long rate) {
+      this->service();
+      this->baud = rate;
+      this->modem->setHostBaud(rate);
+    }
+    void service(void) {
+      unsigned long now = hostWallMillis();
+      this->modem->tick();
+      this->credit += (now - this->last) * this->baud / 10000.0;
+      this->last = now;
+      while(this->credit >= 1.0 && this->modem->available() > 0){
+        this->put((uint8_t)this->modem->read());
+        this->credit -= 1.0;
+      }
+      /* An idle wire doesn't save up bytes */
+      if(this->credit > 1.0)
+        this->credit = 1.0;
+    }
+    virtual int available(void) {
+      this->service();
+      /* A core buffer just drops bytes - nobody is told */
+      if(this->silent)
+        this->gap();
+      return eseyeRxRing::available();
+    }
+private:
+    SimModem *modem;
+    unsigned long baud;
+    unsigned long last;
+    double credit;
+    bool silent;
+};
+
+static void setbaud(unsigned long baud, void *ctx){
+    ((WireRing *)ctx)->setbaud(baud);
+}
+
+static unsigned long intact, corrupt, junk;
+
+/* Simulated messages are runs of consecutive digits */
+static void checkcb(uint8_t *data, uint8_t length){
+    bool ok = length == PAYLOAD;
+    for(uint8_t i = 1; ok && i < length; i++)
+        ok = data[i] == '0' + (data[i - 1] - '0' + 1) % 10;
+    if(ok)
+        intact++;
+    else
+        corrupt++;
+}
+
+static void junkcb(char *line){
+    (void)line;
+    junk++;
+}
+
+/* A subscriber whose loop() goes away for stall ms every period ms */
+static bool stalls(const char *name, uint16_t ringsize, bool silent, double rate, unsigned long period,
+                   unsigned long stall, unsigned long seconds){
+    uint8_t *buf = new uint8_t[ringsize];
+    struct eseyeRxCounts rc;
+    struct eseyeMetricCounts mc;
+    bool ok = true;
+    hostSetMillis(0);
+    intact = corrupt = junk = 0;
+    {
+        SimModem modem;
+        WireRing ring(&modem, buf, ringsize, silent);
+        eseyeAWSNode plain((Stream *)&ring);
+        eseyeAWSNode ringed(&ring);
+        eseyeAWSNode &aws = silent ? plain : ringed;
+        modem.setBaud(BASE_BAUD);
+        ring.setbaud(BASE_BAUD);
+        aws.init(junkcb);
+        int idx = aws.subscribe((char *)"node/stream", checkcb);
+        for(int i = 0; i < 100 && aws.substate(idx) != SUB_TOPIC_SUBSCRIBED; i++){
+            hostAdvanceMillis(1);
+            aws.poll();
+        }
+        if(aws.substate(idx) != SUB_TOPIC_SUBSCRIBED){
+            printf("%-22s setup failed\n", name);
+            delete[] buf;
+            return false;
+        }
+        ring.counts(&rc, true);
+        aws.metrics(&mc, true);
+        modem.setMessageRate(idx, rate, PAYLOAD);
+        unsigned long sent = modem.urcs;
+        for(unsigned long ms = 0; ms < seconds * 1000; ms++){
+            if(ms % period == 0){
+                hostAdvanceMillis(stall);
+                ms += stall;
+            }
+            hostAdvanceMillis(1);
+            aws.poll();
+        }
+        modem.setMessageRate(idx, 0, PAYLOAD);
+        for(int i = 0; i < 2000 && modem.available() + ring.available() > 0; i++){
+            hostAdvanceMillis(1);
+            aws.poll();
+        }
+        sent = modem.urcs - sent;
+        ring.counts(&rc);
+        aws.metrics(&mc);
+        printf("%-22s %5lu msgs sent, %5lu intact, %4lu corrupt, %4lu junk lines, %5lu bytes lost in %4lu runs, "
+               "%4lu resyncs, high water %u\n",
+               name, sent, intact, corrupt, junk, rc.dropped, rc.overruns, mc.rxoverruns, rc.highwater);
+        /* The core buffer only shows what goes wrong unseen */
+        if(!silent){
+            ok = corrupt == 0 && (rc.dropped > 0) == (mc.rxoverruns > 0);
+            if(rc.dropped == 0)
+                ok = ok && intact == sent;
+        }
+    }
+    delete[] buf;
+    return ok;
+}
+
+static int8_t atresult;
+
+static void atcb(char *line, int8_t result, void *ctx){
+    (void)line;
+    (void)ctx;
+    if(result != ESEYE_CMD_LINE)
+        atresult = result;
+}
+
+/* baudup() against a modem at modembaud which answers AT+IPR as iprmode */
+static bool upgrade(const char *name, unsigned long modembaud, int iprmode, unsigned long expect){
+    uint8_t buf[256];
+    bool ok;
+    hostSetMillis(0);
+    SimModem modem;
+    WireRing ring(&modem, buf, sizeof(buf), false);
+    eseyeAWSNode aws(&ring);
+    modem.setBaud(modembaud);
+    modem.setIprMode(iprmode);
+    ring.setbaud(BASE_BAUD);
+    aws.init();
+    unsigned long rate = aws.baudup(BASE_BAUD, FAST_BAUD, setbaud, &ring);
+    unsigned long took = millis();
+    /* Does the link work at the rate baudup() left it at */
+    atresult = ESEYE_OP_PENDING;
+    aws.sendAT((char *)"AT\r\n", atcb);
+    for(int i = 0; i < 1000 && atresult == ESEYE_OP_PENDING; i++){
+        hostAdvanceMillis(1);
+        aws.poll();
+    }
+    ok = rate == expect && (rate == 0 || (atresult == 0 && modem.baud() == rate));
+    printf("baudup %-18s %6lu in %4lu ms, modem at %6lu, link %s%s\n", name, rate, took, modem.baud(),
+           atresult == 0 ? "answers" : "silent", ok ? "" : "  (UNEXPECTED)");
+    return ok;
+}
+
+/* Messages offered at rate over a link at baud - what gets through, and what
+ * is still queued in the modem at the end */
+static bool throughput(unsigned long baud, double rate, unsigned long seconds){
+    uint8_t buf[1024];
+    hostSetMillis(0);
+    intact = corrupt = junk = 0;
+    SimModem modem;
+    WireRing ring(&modem, buf, sizeof(buf), false);
+    eseyeAWSNode aws(&ring);
+    modem.setBaud(BASE_BAUD);
+    ring.setbaud(BASE_BAUD);
+    aws.init();
+    if(baud != BASE_BAUD && aws.baudup(BASE_BAUD, baud, setbaud, &ring) != baud){
+        printf("link %6lu: couldn't move the link\n", baud);
+        return false;
+    }
+    int idx = aws.subscribe((char *)"node/stream", checkcb);
+    for(int i = 0; i < 100 && aws.substate(idx) != SUB_TOPIC_SUBSCRIBED; i++){
+        hostAdvanceMillis(1);
+        aws.poll();
+    }
+    modem.setMessageRate(idx, rate, PAYLOAD);
+    unsigned long sent = modem.urcs;
+    for(unsigned long ms = 0; ms < seconds * 1000; ms++){
+        hostAdvanceMillis(1);
+        aws.poll();
+    }
+    sent = modem.urcs - sent;
+    printf("link %6lu: %5.1f msgs/s offered, %5.1f/s delivered, %6d bytes backed up in the modem\n",
+           baud, rate, (double)intact / seconds, modem.available());
+    return corrupt == 0 && (baud == BASE_BAUD || intact + 1 >= sent);
+}
+
+int main(int argc, char **argv){
+    unsigned long seconds = 30;
+    bool ok = true;
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if(argc > 1)
+        seconds = strtoul(argv[1], NULL, 10);
+    if(seconds == 0){
+        fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+        return 2;
+    }
+    hostUseSimClock(true);
+    /* 8 messages a second fill 60% of a 9600 baud link - each 200 ms stall
+     * leaves about 150 bytes waiting */
+    ok = stalls("rx 64 B plain stream", 64, true, 8, 500, 200, seconds) && ok;
+    ok = stalls("rx 64 B ring", 64, false, 8, 500, 200, seconds) && ok;
+    ok = stalls("rx 512 B ring", 512, false, 8, 500, 200, seconds) && ok;
+
+    ok = upgrade("accepted", BASE_BAUD, SIM_IPR_OK, FAST_BAUD) && ok;
+    ok = upgrade("refused", BASE_BAUD, SIM_IPR_REFUSE, BASE_BAUD) && ok;
+    ok = upgrade("unheard at new rate", BASE_BAUD, SIM_IPR_BROKEN, BASE_BAUD) && ok;
+    ok = upgrade("already there", FAST_BAUD, SIM_IPR_OK, FAST_BAUD) && ok;
+    ok = upgrade("at neither", 57600, SIM_IPR_OK, 0) && ok;
+
+    ok = throughput(BASE_BAUD, 40, seconds / 3 + 1) && ok;
+    ok = throughput(FAST_BAUD, 40, seconds / 3 + 1) && ok;
+    hostUseSimClock(false);
+    return ok ? 0 : 1;
+}